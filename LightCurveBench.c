@@ -0,0 +1,383 @@
+// clang -framework CoreVideo -framework IOKit -framework Cocoa -framework GLUT -framework OpenGL lib/libraylib.a LightCurveBench.c -o LightCurveBench
+/*******************************************************************************************
+*
+*   Light Curve Engine microbenchmarks
+*
+*   Times the engine's CPU hot paths in isolation on synthetic inputs of increasing size, without
+*   opening a window or GL context:
+*     parse_text, parse_binary   LoadLightCurveCommand() of a generated .lcc / .lccb, per data point
+*     mvp, mvp_bias              CalculateMVPFromCamera() / CalculateMVPBFromMVP(), per matrix
+*     translations               GenerateTranslations() plus TransformOffsetToCameraPlane(), per instance
+*     frame_constants            PrepareFramePacket(), everything the three cases above compute for a frame
+*                                (both cameras), per instance
+*     reduce_rgba8, reduce_rgba32f  ReduceLightCurveImage(), the pixel loop of CalculateLightCurveValues(),
+*                                per pixel of the minified image
+*     prepare                    GenProceduralMesh() of a subdivided cube plus PrepareLightCurveMesh()
+*                                (weld, vertex cache order), per triangle
+*
+*   Usage: LightCurveBench [filter] [--min-ms N]
+*     filter       only run cases whose name contains it
+*     --min-ms N   each case repeats until it has run this long (default 200)
+*
+*   Each line reports ns/op and the bytes and allocations the engine code made per op, counted
+*   by routing its malloc/calloc/realloc through this file (raylib's own allocations are not seen).
+*
+********************************************************************************************/
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static long long lc_bench_bytes = 0;     // Allocation counters, see the macros below
+static long long lc_bench_allocations = 0;
+
+static void *LCBenchMalloc(size_t size) { lc_bench_bytes += size; lc_bench_allocations++; return malloc(size); }
+static void *LCBenchCalloc(size_t count, size_t size) { lc_bench_bytes += count * size; lc_bench_allocations++; return calloc(count, size); }
+static void *LCBenchRealloc(void *pointer, size_t size) { lc_bench_bytes += size; lc_bench_allocations++; return realloc(pointer, size); }
+
+// System headers are already in, so only the engine modules below see these
+#define malloc(size)          LCBenchMalloc(size)
+#define calloc(count, size)   LCBenchCalloc(count, size)
+#define realloc(pointer, size) LCBenchRealloc(pointer, size)
+
+//User-defined
+#include "include/lightcurvelib.c"
+#include "include/lightcurveio.c"
+#include "include/lightcurveattitude.c"
+#include "include/lightcurvemesh.c"
+#include "include/lightcurveprocedural.c"
+#include "include/lightcurvededup.c"
+#include "include/lightcurverefine.c"
+#include "include/lightcurveshadow.c"
+#include "include/lightcurveframes.c"
+#include "include/lightcurvelut.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
+
+#define LC_BENCH_PATH_LENGTH 512            // Synthetic command files, created in $TMPDIR (or /tmp) and removed at exit
+
+typedef struct {
+  const char *name;
+  const char *unit;                       // What one op is
+  long size;                              // Input size the case was set up with
+  long ops_per_run;                       // Ops one call of run() performs
+  void (*run)(void *context);
+  void *context;
+} LCBenchCase;
+
+typedef struct {
+  const char *filename;
+} LCParseContext;
+
+typedef struct {
+  Camera camera;
+  Vector3 offsets[MAX_INSTANCES];
+  Matrix mvps[MAX_INSTANCES];
+  int instances;
+  LCFramePacket packet;                   // Same cameras and tiles, for frame_constants
+} LCMatrixContext;
+
+typedef struct {
+  Image image;
+  int instances;
+  float clipping_area;
+} LCReduceContext;
+
+static volatile float lc_bench_sink;     // Keeps results observable so the work is not optimized away
+
+void RunBenchCase(const LCBenchCase *bench, double min_ms);
+bool CreateBenchFile(char *path, const char *extension);
+bool WriteBenchCommands(int data_points, const char *text_file, const char *binary_file);
+void RunParse(void *context);
+void RunMVP(void *context);
+void RunMVPBias(void *context);
+void RunTranslations(void *context);
+void RunFrameConstants(void *context)
+{
+  LCFramePacket *packet = &((LCMatrixContext *) context)->packet;
+  PrepareFramePacket(packet);
+  lc_bench_sink = packet->instances[packet->count - 1].mvp_light_bias.m12;
+}
+
+void RunReduce(void *context);
+void RunPrepare(void *context);
+Image GenerateMinifiedImage(int screen_pixels, int grid_width, bool float_pixels);
+
+// Doubles the repetitions until the case has run min_ms, then reports per op
+void RunBenchCase(const LCBenchCase *bench, double min_ms)
+{
+  bench->run(bench->context);             //Warm up caches and the allocator
+
+  long runs = 1;
+  double elapsed;
+  long long bytes, allocations;
+  for(;;) {
+    lc_bench_bytes = lc_bench_allocations = 0;
+    double start = LCMonotonicMs();
+    for(long r = 0; r < runs; r++) bench->run(bench->context);
+    elapsed = LCMonotonicMs() - start;
+    bytes = lc_bench_bytes;
+    allocations = lc_bench_allocations;
+    if(elapsed >= min_ms || runs > (1L << 40)) break;
+    runs *= (elapsed > 0.0 && elapsed < min_ms / 8.0) ? 8 : 2;
+  }
+
+  double ops = (double) runs * bench->ops_per_run;
+  printf("%-16s %9ld  %-10s %12.2f %14.2f %12.4f\n", bench->name, bench->size, bench->unit, elapsed * 1e6 / ops, bytes / ops, allocations / ops);
+  fflush(stdout);
+}
+
+bool CreateBenchFile(char *path, const char *extension) //A new, uniquely named file in the temporary directory
+{
+  const char *directory = getenv("TMPDIR");
+#if defined(LC_NO_POSIX)
+  if(directory == NULL) directory = getenv("TEMP");
+  if(directory == NULL) directory = ".";
+  snprintf(path, LC_BENCH_PATH_LENGTH, "%s/LightCurveBench.tmp%s", directory, extension);
+  FILE *file = fopen(path, "wb");
+  if(file == NULL) return false;
+  fclose(file);
+  return true;
+#else
+  if(directory == NULL || directory[0] == '\0') directory = "/tmp";
+  snprintf(path, LC_BENCH_PATH_LENGTH, "%s/LightCurveBench.XXXXXX%s", directory, extension);
+  int fd = mkstemps(path, (int) strlen(extension));
+  if(fd < 0) return false;
+  close(fd);
+  return true;
+#endif
+}
+
+bool WriteBenchCommands(int data_points, const char *text_file, const char *binary_file) //Random directions at distance 2, as writeLCRFile.m writes them
+{
+  FILE *text = fopen(text_file, "w");
+  FILE *binary = fopen(binary_file, "wb");
+  if(text == NULL || binary == NULL) {
+    if(text != NULL) fclose(text);
+    if(binary != NULL) fclose(binary);
+    return false;
+  }
+
+  fprintf(text, "Light Curve Command File\n\nBegin header\n");
+  fprintf(text, "%-20s %-20s\n%-20s %-20d\n%-20s %-20d\n", "Model File", "bench.obj", "Instances", MAX_INSTANCES, "Square Dimensions", 900);
+  fprintf(text, "%-20s %-20s\n%-20s %-20s\n", "Format", "SunXYZViewerXYZ", "Reference Frame", "ObjectBody");
+  fprintf(text, "%-20s %-20d\n%-20s %-20s\n%-20s %-20d\n", "Data Points", data_points, "Expected .lcr Name", "bench.lcr", "Target Framerate", 500);
+  fprintf(text, "End header\n\nBegin data\n");
+
+  LCCBHeader header = { 0 };
+  memcpy(header.magic, LCCB_MAGIC, 4);
+  header.version = LCCB_VERSION;
+  header.header_size = LCCB_HEADER_SIZE;
+  header.instances = MAX_INSTANCES;
+  header.square_dimensions = 900;
+  header.frame_rate = 500;
+  header.data_points = (uint64_t) data_points;
+  snprintf(header.model_file, LCCB_NAME_LENGTH, "bench.obj");
+  snprintf(header.results_file, LCCB_NAME_LENGTH, "bench.lcrb");
+  unsigned char header_bytes[LCCB_HEADER_SIZE] = { 0 };
+  memcpy(header_bytes, &header, sizeof(LCCBHeader));
+  fwrite(header_bytes, 1, LCCB_HEADER_SIZE, binary);
+
+  double *vectors = (double *) malloc(6 * (size_t) data_points * sizeof(double));
+  if(vectors == NULL) {
+    fclose(text);
+    fclose(binary);
+    return false;
+  }
+  srand(1);
+  for(int i = 0; i < 2 * data_points; i++) {
+    double v[3], norm;
+    do {
+      for(int k = 0; k < 3; k++) v[k] = 2.0 * rand() / RAND_MAX - 1.0;
+      norm = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    } while(norm < 1e-3 || norm > 1.0);
+    for(int k = 0; k < 3; k++) vectors[3*i + k] = 2.0 * v[k] / norm;
+  }
+  for(int i = 0; i < data_points; i++) {
+    const double *sun = vectors + 3*i, *viewer = vectors + 3*(data_points + i);
+    fprintf(text, "%-10f %-10f %-10f %-10f %-10f %-10f\n", sun[0], sun[1], sun[2], viewer[0], viewer[1], viewer[2]);
+  }
+  fprintf(text, "End data");
+  fwrite(vectors, sizeof(double), 6 * (size_t) data_points, binary);
+  free(vectors);
+
+  bool ok = (fclose(text) == 0);
+  return (fclose(binary) == 0) && ok;
+}
+
+void RunParse(void *context)
+{
+  LightCurveCommand command;
+  if(!LoadLightCurveCommand(((LCParseContext *) context)->filename, &command)) return;
+  lc_bench_sink = (float) command.sun_vectors[0];
+  UnloadLightCurveCommand(&command);
+}
+
+void RunMVP(void *context)
+{
+  LCMatrixContext *c = (LCMatrixContext *) context;
+  for(int i = 0; i < c->instances; i++) c->mvps[i] = CalculateMVPFromCamera(c->camera, c->offsets[i]);
+  lc_bench_sink = c->mvps[c->instances - 1].m0;
+}
+
+void RunMVPBias(void *context)
+{
+  LCMatrixContext *c = (LCMatrixContext *) context;
+  float sum = 0.0f;
+  for(int i = 0; i < c->instances; i++) sum += CalculateMVPBFromMVP(c->mvps[i]).m12;
+  lc_bench_sink = sum;
+}
+
+void RunTranslations(void *context)
+{
+  LCMatrixContext *c = (LCMatrixContext *) context;
+  GenerateTranslations(c->offsets, c->camera, c->instances);
+  float sum = 0.0f;
+  for(int i = 0; i < c->instances; i++) sum += TransformOffsetToCameraPlane(c->camera, c->offsets[i]).x;
+  lc_bench_sink = sum;
+}
+
+void RunReduce(void *context)
+{
+  LCReduceContext *c = (LCReduceContext *) context;
+  float irradiance[MAX_INSTANCES], lit_area[MAX_INSTANCES], relative_error[MAX_INSTANCES];
+  ReduceLightCurveImage(irradiance, lit_area, relative_error, c->image, c->clipping_area, c->instances, 1.0f);
+  lc_bench_sink = irradiance[0] + lit_area[c->instances - 1] + relative_error[0];
+}
+
+void RunPrepare(void *context)
+{
+  Mesh mesh = GenProceduralMesh(*(LCProceduralBody *) context);
+  Model model = { 0 };
+  model.meshCount = 1;
+  model.meshes = &mesh;
+  LCPreparedMesh prepared;
+  if(PrepareLightCurveMesh(model, &prepared)) {
+    lc_bench_sink = prepared.acmr_optimized;
+    UnloadPreparedMesh(&prepared);
+  }
+  MemFree(mesh.vertices);
+  MemFree(mesh.normals);
+}
+
+// What the minify pass leaves for the readback: grid_width columns of row averages over tiles holding an ellipse
+Image GenerateMinifiedImage(int screen_pixels, int grid_width, bool float_pixels)
+{
+  int format = float_pixels ? PIXELFORMAT_UNCOMPRESSED_R32G32B32A32 : PIXELFORMAT_UNCOMPRESSED_R8G8B8A8;
+  Image image = { 0 };
+  image.width = grid_width;
+  image.height = screen_pixels;
+  image.mipmaps = 1;
+  image.format = format;
+  image.data = malloc((size_t) grid_width * screen_pixels * (float_pixels ? 16 : 4));
+
+  int tile = screen_pixels / grid_width;
+  for(int y = 0; y < screen_pixels; y++) {
+    float t = (float) (y % tile) / tile * 2.0f - 1.0f;
+    float lit = (fabsf(t) < 0.8f) ? sqrtf(1.0f - t*t/0.64f) * 0.6f : 0.0f;  //Fraction of the row that is lit
+    float pix[4] = { lit * 0.7f, lit, (lit > 0.0f) ? 2.0f / tile : 0.0f, 1.0f };
+    for(int x = 0; x < grid_width; x++) {
+      if(float_pixels) memcpy((float *) image.data + 4 * (y * grid_width + x), pix, sizeof(pix));
+      else for(int k = 0; k < 4; k++) ((unsigned char *) image.data)[4 * (y * grid_width + x) + k] = (unsigned char) (pix[k] * 255.0f + 0.5f);
+    }
+  }
+  return image;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *filter = NULL;
+  double min_ms = 200.0;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) min_ms = atof(argv[++i]);
+    else filter = argv[i];
+  }
+  SetTraceLogLevel(LOG_WARNING);          // Parsing logs a line per load
+
+  printf("%-16s %9s  %-10s %12s %14s %12s\n", "case", "size", "op", "ns/op", "bytes/op", "allocs/op");
+
+  static const int point_counts[] = { 1000, 10000, 100000, 1000000 };
+  bool text = filter == NULL || strstr("parse_text", filter) != NULL;
+  bool binary = filter == NULL || strstr("parse_binary", filter) != NULL;
+  char text_file[LC_BENCH_PATH_LENGTH] = "", binary_file[LC_BENCH_PATH_LENGTH] = "";
+  if((text || binary) && (!CreateBenchFile(text_file, ".lcc") || !CreateBenchFile(binary_file, ".lccb"))) {
+    TraceLog(LOG_ERROR, "BENCH: Could not create the synthetic command files in the temporary directory");
+    if(text_file[0] != '\0') remove(text_file);
+    return 1;
+  }
+  for(int s = 0; s < 4 && (text || binary); s++) {
+    if(!WriteBenchCommands(point_counts[s], text_file, binary_file)) {
+      TraceLog(LOG_ERROR, "BENCH: Could not write the synthetic command files");
+      remove(text_file);
+      remove(binary_file);
+      return 1;
+    }
+    LCParseContext text_context = { text_file }, binary_context = { binary_file };
+    LCBenchCase text_case = { "parse_text", "point", point_counts[s], point_counts[s], RunParse, &text_context };
+    LCBenchCase binary_case = { "parse_binary", "point", point_counts[s], point_counts[s], RunParse, &binary_context };
+    if(text) RunBenchCase(&text_case, min_ms);
+    if(binary) RunBenchCase(&binary_case, min_ms);
+  }
+  if(text || binary) {
+    remove(text_file);
+    remove(binary_file);
+  }
+
+  static const int instance_counts[] = { 1, 4, 9, 16, 25 };
+  for(int s = 0; s < 5; s++) {
+    LCMatrixContext matrices = { 0 };
+    InitializeViewerCamera(&matrices.camera);
+    matrices.instances = instance_counts[s];
+    matrices.packet.viewer_camera = matrices.camera;
+    matrices.packet.light_camera = matrices.camera;
+    matrices.packet.count = matrices.instances;
+    matrices.packet.grid_instances = matrices.instances;
+    for(int i = 0; i < matrices.instances; i++) {
+      for(int k = 0; k < 3; k++) matrices.packet.sun[k][i] = matrices.packet.viewer[k][i] = (&matrices.camera.position.x)[k];
+    }
+
+    LCBenchCase cases[4] = {
+      { "mvp", "matrix", matrices.instances, matrices.instances, RunMVP, &matrices },
+      { "mvp_bias", "matrix", matrices.instances, matrices.instances, RunMVPBias, &matrices },
+      { "translations", "instance", matrices.instances, matrices.instances, RunTranslations, &matrices },
+      { "frame_constants", "instance", matrices.instances, matrices.instances, RunFrameConstants, &matrices },
+    };
+    for(int c = 0; c < 4; c++) {
+      if(filter != NULL && strstr(cases[c].name, filter) == NULL) continue;
+      GenerateTranslations(matrices.offsets, matrices.camera, matrices.instances); //Inputs for the matrix cases
+      RunMVP(&matrices);
+      RunBenchCase(&cases[c], min_ms);
+    }
+  }
+
+  static const int screen_sizes[] = { 300, 600, 1200, 2400 };
+  for(int s = 0; s < 4; s++) {
+    for(int f = 0; f < 2; f++) {
+      const char *name = f ? "reduce_rgba32f" : "reduce_rgba8";
+      if(filter != NULL && strstr(name, filter) == NULL) continue;
+      Camera camera;
+      InitializeViewerCamera(&camera);
+      LCReduceContext reduce = { GenerateMinifiedImage(screen_sizes[s], 5, f == 1), MAX_INSTANCES, CalculateCameraArea(camera) };
+      LCBenchCase bench = { name, "pixel", screen_sizes[s], 5L * screen_sizes[s], RunReduce, &reduce };
+      RunBenchCase(&bench, min_ms);
+      free(reduce.image.data);
+    }
+  }
+
+  static const int cube_resolutions[] = { 4, 16, 64, 256 };
+  for(int s = 0; s < 4 && (filter == NULL || strstr("prepare", filter) != NULL); s++) {
+    LCProceduralBody cube = { LC_BODY_CUBE, cube_resolutions[s] };
+    int triangles = ProceduralTriangleCapacity(cube);
+    LCBenchCase bench = { "prepare", "triangle", triangles, triangles, RunPrepare, &cube };
+    RunBenchCase(&bench, min_ms);
+  }
+
+  return 0;
+}
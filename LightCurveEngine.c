@@ -7,6 +7,28 @@
 *   written by MATLAB. All additional functionality should be implemented through the MATLAB
 *   inteface for future flexibility.
 *
+*   Usage: LightCurveEngine [command_file] [--pipe [--binary] [--flush-ms N]] [--profile report.json] [--headless]
+*                           [--bake table.lclt [--lut-nside N]] [--query table.lclt|surrogate.lcsh [--spot-check N]]
+*        LightCurveEngine --fit-sh table.lclt surrogate.lcsh [--sh-degree L]
+*     command_file  .lcc (text) or .lccb (binary), defaults to light_curve.lcc
+*     --pipe        take the job settings from command_file but read geometry records from stdin
+*                   and write indexed results to stdout as each batch finishes
+*     --binary      stdin records are 6 float64 (sun xyz, viewer xyz; 10 with quaternion wxyz when the
+*                   command file sets Reference Frame Inertial), stdout records are a uint64
+*                   index followed by the result channels; text lines otherwise
+*     --flush-ms N  longest a partially filled batch waits for more geometry (default 5)
+*     --bake        render the model over a HEALPix grid of sun and viewer directions into a lookup
+*                   table instead of the command file's data points
+*     --lut-nside N grid resolution of a bake, 12 N^2 directions per sphere (default 8)
+*     --query       interpolate the command file's data points from a baked table on the CPU
+*     --spot-check N  render N of the queried points and log the table's error against them (default 64)
+*     --fit-sh      least-squares fit of a baked table by real spherical harmonics of sun and viewer
+*                   direction, a KB-sized surrogate --query accepts in place of the table
+*     --sh-degree L highest harmonic degree of the fit, (L + 1)^4 coefficients (default 4)
+*     --profile     time every GPU pass with timer queries and the CPU phases, and write totals and
+*                   per-frame percentiles as JSON at exit ("-" for stderr)
+*     --headless    hidden window, no frame rate cap and no on-screen preview (benchmark_engine.py)
+*
 ********************************************************************************************/
 
 #include "raylib.h"
@@ -18,58 +40,180 @@
 
 //User-defined
 #include "include/lightcurvelib.c"
+#include "include/lightcurveio.c"
+#include "include/lightcurveattitude.c"
+#include "include/lightcurvemesh.c"
+#include "include/lightcurveprocedural.c"
+#include "include/lightcurvededup.c"
+#include "include/lightcurverefine.c"
+#include "include/lightcurveshadow.c"
+#include "include/lightcurveframes.c"
+#include "include/lightcurvelut.c"
+#include "include/lightcurveshader.c"
+#include "include/lightcurvetarget.c"
+#include "include/lightcurveprofile.c"
 
 #define RLIGHTS_IMPLEMENTATION
 #include "include/rlights.h"
 
 #define MAX_INSTANCES          25
-#define MAX_DATA_POINTS        1000
-#define MAX_FNAME_LENGTH       100
 
-int main(void)
+int main(int argc, char *argv[])
 {
     //--------------------------------------------------------------------------------------
     // Initialization
     //--------------------------------------------------------------------------------------
-    int screenPixels;
-    char command_filename[] = "light_curve.lcc"; 
-    int instances; 
-    Vector3 sun_vectors[MAX_DATA_POINTS];
-    Vector3 viewer_vectors[MAX_DATA_POINTS]; 
-    int data_points;
-    char results_file[MAX_FNAME_LENGTH];
-    char model_name[MAX_FNAME_LENGTH];
-    int frame_rate;
+    const char *command_filename = "light_curve.lcc"; // .lcc (text) or .lccb (binary)
+    bool pipe_mode = false;
+    bool pipe_binary = false;
+    int flush_ms = LC_PIPE_DEFAULT_FLUSH_MS;
+    const char *bake_filename = NULL;
+    const char *query_filename = NULL;
+    int lut_nside = LC_LUT_DEFAULT_NSIDE;
+    int spot_checks = 64;
+    const char *fit_table_filename = NULL;
+    const char *fit_surrogate_filename = NULL;
+    int sh_degree = LC_SH_DEFAULT_DEGREE;
+    const char *profile_filename = NULL;
+    bool headless = false;
+
+    for(int i = 1; i < argc; i++) {
+      if(strcmp(argv[i], "--pipe") == 0) pipe_mode = true;
+      else if(strcmp(argv[i], "--binary") == 0) pipe_binary = true;
+      else if(strcmp(argv[i], "--flush-ms") == 0 && i + 1 < argc) flush_ms = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--bake") == 0 && i + 1 < argc) bake_filename = argv[++i];
+      else if(strcmp(argv[i], "--lut-nside") == 0 && i + 1 < argc) lut_nside = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--query") == 0 && i + 1 < argc) query_filename = argv[++i];
+      else if(strcmp(argv[i], "--spot-check") == 0 && i + 1 < argc) spot_checks = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--fit-sh") == 0 && i + 2 < argc) {
+        fit_table_filename = argv[++i];
+        fit_surrogate_filename = argv[++i];
+      }
+      else if(strcmp(argv[i], "--sh-degree") == 0 && i + 1 < argc) sh_degree = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc) profile_filename = argv[++i];
+      else if(strcmp(argv[i], "--headless") == 0) headless = true;
+      else command_filename = argv[i];
+    }
+
+    if(fit_table_filename != NULL) return BuildSHSurrogate(fit_table_filename, fit_surrogate_filename, sh_degree) ? 0 : 1; // CPU only, no command file
+
+    LightCurveProfiler profiler;                    // Disabled without --profile
+    InitProfiler(&profiler, profile_filename != NULL);
+
+    LightCurveCommand command;
+    LightCurveGeometryPipe *geometry_pipe = NULL;
+
+    BeginProfilePhase(&profiler, LC_PHASE_PARSE);
+    if(pipe_mode) {
+      SetTraceLogCallback(TraceLogToStderr);        // stdout carries the results
+      if(!LoadLightCurveCommandHeader(command_filename, &command)) return 1;
+      if(command.reference_frame == LC_FRAME_PROPAGATED) {
+        TraceLog(LOG_ERROR, "PIPE: Propagated commands generate their own geometry, --pipe does not apply");
+        return 1;
+      }
 
-    bool rendering = true;
+      geometry_pipe = malloc(sizeof(LightCurveGeometryPipe));
+      InitGeometryPipe(geometry_pipe, 0, pipe_binary, flush_ms, command.reference_frame);
+    }
+    else if(!LoadLightCurveCommand(command_filename, &command)) return 1;
+    EndProfilePhase(&profiler, LC_PHASE_PARSE);
 
-    ReadLightCurveCommandFile(command_filename, model_name, &instances, &screenPixels, sun_vectors, viewer_vectors, &data_points, results_file, &frame_rate);
-    ClearLightCurveResults(results_file);
+    if((bake_filename != NULL || query_filename != NULL) && pipe_mode) {
+      TraceLog(LOG_ERROR, "LUT: --bake and --query take their geometry from the command file, not --pipe");
+      return 1;
+    }
+
+    LightCurveLUT lut = { 0 };
+    float *lut_expected = NULL;                     // Query: interpolated values of the spot-checked points
+    if(query_filename != NULL) {
+      if(!LoadLightCurveLUT(query_filename, &lut)) return 1;
+      if(command.results_channels & LC_CHANNEL_LIT_AREA) TraceLog(LOG_WARNING, "LUT: Tables hold irradiance only, the lit area channel is not written");
+      if(command.reference_frame == LC_FRAME_PROPAGATED && !MaterializePropagatedGeometry(&command)) return 1;
+
+      LightCurveResultsWriter query_results;
+      if(!OpenLightCurveResults(&query_results, command.results_file, command.data_points, command.results_precision, LC_CHANNEL_IRRADIANCE)) return 1;
+      RunLUTQuery(&lut, &command, &query_results);
+      CloseLightCurveResults(&query_results);
+
+      bool spot_check = spot_checks > 0 && BuildLUTSpotCheck(&lut, &command, spot_checks, &lut_expected);
+      UnloadLightCurveLUT(&lut);
+      if(!spot_check) {
+        UnloadLightCurveCommand(&command);
+        return 0;
+      }
+    }
+    else if(bake_filename != NULL) {
+      if(lut_nside < 1 || lut_nside > LC_LUT_MAX_NSIDE) {
+        TraceLog(LOG_ERROR, "LUT: --lut-nside must be between 1 and %d", LC_LUT_MAX_NSIDE);
+        return 1;
+      }
+      if(!BuildLUTBakeGeometry(&command, lut_nside)) return 1;
+      command.dedup_mode = LC_DEDUP_OFF;            // The pairs are distinct and already reduced by reciprocity
+    }
+
+    LCProceduralBody procedural_body;               // "Model File procedural:<body>:<resolution>" is generated, not read from models/
+    bool procedural = IsProceduralModel(command.model_name);
+    if(procedural && !ParseProceduralBody(command.model_name, &procedural_body)) return 1;
+
+    LightCurvePropagator *propagator = NULL;         // Propagated frame: body-frame geometry is generated batch by batch
+    if(command.reference_frame == LC_FRAME_PROPAGATED) {
+      propagator = malloc(sizeof(LightCurvePropagator));
+      if(propagator == NULL || !InitPropagator(propagator, &command)) return 1;
+    }
+
+    int screenPixels = command.screen_pixels;
+    int instances = command.instances;
+    int data_points = command.data_points;
+    char *results_file = command.results_file;
+    char *model_name = command.model_name;
+    int frame_rate = command.frame_rate;
+
+    LightCurveResultsWriter results;                // .lcrb extension selects binary output, anything else text
+    float *lut_rendered = NULL;                     // Bake and spot check results stay in memory
+    if(bake_filename != NULL || lut_expected != NULL) {
+      lut_rendered = (float *) malloc((size_t) data_points * sizeof(float));
+      if(lut_rendered == NULL) return 1;
+      OpenLightCurveResultsCapture(&results, lut_rendered, LC_CHANNEL_IRRADIANCE);
+    }
+    else if(pipe_mode) OpenLightCurveResultsStream(&results, stdout, pipe_binary, command.results_precision, command.results_channels);
+    else if(!OpenLightCurveResults(&results, results_file, data_points, command.results_precision, command.results_channels)) return 1;
 
     SetConfigFlags(FLAG_MSAA_4X_HINT);  // Enable Multi Sampling Anti Aliasing 4x (if available)
+    if(headless) SetConfigFlags(FLAG_WINDOW_HIDDEN); // Renders to textures only, the window just holds the context
     InitWindow(screenPixels, screenPixels, "Light Curve Engine"); // A cool name for a cool app
+    InitProfilerQueries(&profiler);
 
     int gridWidth = (int) ceil(sqrt(instances));
 
-    Model model = LoadModel(TextFormat("models/%s", model_name));
-    Mesh mesh = model.meshes[0];
-
     Camera viewer_camera;                            // Define the viewer camera
     InitializeViewerCamera(&viewer_camera);
-    
-    float mesh_scale_factor = CalculateMeshScaleFactor(mesh, viewer_camera, instances);
-    mesh = ApplyMeshScaleFactor(mesh, mesh_scale_factor);
+    float grid_fovy = viewer_camera.fovy;            // Frustum that holds the full grid, refinement passes narrow it
 
-    // Loading depth shader
-    Shader depthShader = LoadShader("shaders/depth_texture.vs", "shaders/create_depth_texture.fs");
-    Shader lighting_shader = LoadShader("shaders/base_shadowing.vs", "shaders/lighting.fs");
-    Shader brightness_shader = LoadShader("shaders/brightness.vs", "shaders/brightness.fs");
-    Shader light_curve_shader = LoadShader("shaders/light_curve_extraction.vs", "shaders/light_curve_extraction.fs");
-    Shader min_shader = LoadShader("shaders/minimize.vs", "shaders/minimize.fs");
+    float mesh_scale_factor;
+    BeginProfilePhase(&profiler, LC_PHASE_MODEL_LOAD);
+    LightCurveModel lc_model = procedural ? LoadProceduralLightCurveModel(procedural_body, viewer_camera, instances, screenPixels / gridWidth, command.lod_tolerance, &mesh_scale_factor) :
+                               LoadLightCurveModel(TextFormat("models/%s", model_name), viewer_camera, instances, screenPixels / gridWidth, command.lod_tolerance, &mesh_scale_factor); // Welded, cache-ordered, simplified to the tile size, scaled and uploaded, cached by OBJ hash
+    if(lc_model.model.meshCount == 0) return 1;
+    Model model = lc_model.model;                    // Shares the materials with lc_model
+    EndProfilePhase(&profiler, LC_PHASE_MODEL_LOAD);
 
-    int depth_light_mvp_locs[MAX_INSTANCES];
-    int lighting_light_mvp_locs[MAX_INSTANCES];
-    GetLCShaderLocations(&depthShader, &lighting_shader, &brightness_shader, &light_curve_shader, &min_shader, depth_light_mvp_locs, lighting_light_mvp_locs, instances);
+    // Loading depth shader
+    BeginProfilePhase(&profiler, LC_PHASE_SHADER_COMPILE);
+    LightCurveShaderCache shader_cache;              // Compiled variants, specialized for one directional sun with shadows
+    InitShaderCache(&shader_cache, true);           // Linked programs persist in shaders/.lccache between runs
+    LCShaderOptions shader_options = DefaultShaderOptions();
+    Shader depthShader = LoadShaderVariant(&shader_cache, "shaders/depth_texture.vs", "shaders/create_depth_texture.fs", &shader_options);
+    Shader lighting_shader = LoadShaderVariant(&shader_cache, "shaders/base_shadowing.vs", "shaders/lighting.fs", &shader_options);
+    Shader brightness_shader = LoadShaderVariant(&shader_cache, "shaders/brightness.vs", "shaders/brightness.fs", NULL);
+    Shader light_curve_shader = LoadShaderVariant(&shader_cache, "shaders/light_curve_extraction.vs", "shaders/light_curve_extraction.fs", NULL);
+    Shader min_shader = LoadShaderVariant(&shader_cache, "shaders/minimize.vs", "shaders/minimize.fs", NULL);
+    EndProfilePhase(&profiler, LC_PHASE_SHADER_COMPILE);
+    LogShaderCacheStatistics(&shader_cache);
+
+    int depth_light_mvps_loc;
+    int lighting_viewer_mvps_loc;
+    GetLCShaderLocations(&depthShader, &lighting_shader, &brightness_shader, &light_curve_shader, &min_shader, &depth_light_mvps_loc, &lighting_viewer_mvps_loc);
+    SetMaterialReflectance(lc_model, lighting_shader);   // Per-material reflectance table, indexed by the vertex material ID
 
     Light sun = CreateLight(LIGHT_DIRECTIONAL, (Vector3) { 2.0f, 2.0f, 2.0f }, Vector3Zero(), WHITE, lighting_shader);
 
@@ -81,105 +225,182 @@ int main(void)
     light_camera.projection = CAMERA_ORTHOGRAPHIC;      // Camera mode type
 
     RenderTexture2D depthTex = LoadRenderTexture(screenPixels, screenPixels);      // Creates a RenderTexture2D for the depth texture
-    RenderTexture2D renderedTex = LoadRenderTexture(screenPixels, screenPixels);   // Creates a RenderTexture2D for the rendered texture
-    RenderTexture2D brightnessTex = LoadRenderTexture(screenPixels, screenPixels); // Creates a RenderTexture2D for the brightness texture
-    RenderTexture2D lightCurveTex = LoadRenderTexture(screenPixels, screenPixels); // Creates a RenderTexture2D for the light curve texture
-    RenderTexture2D minifiedLightCurveTex = LoadRenderTexture(ceil(sqrt(instances)), screenPixels); // Creates a RenderTexture2D minified (height x instances) for the light curve texture
+    RenderTexture2D renderedTex = LoadLightCurveRenderTexture(screenPixels, screenPixels, command.render_target);   // Creates a RenderTexture2D for the rendered texture
+    RenderTexture2D brightnessTex = LoadLightCurveRenderTexture(screenPixels, screenPixels, command.render_target); // Creates a RenderTexture2D for the brightness texture
+    RenderTexture2D lightCurveTex = LoadLightCurveRenderTexture(screenPixels, screenPixels, command.render_target); // Creates a RenderTexture2D for the light curve texture
+    RenderTexture2D minifiedLightCurveTex = LoadLightCurveRenderTexture(ceil(sqrt(instances)), screenPixels, command.render_target); // Creates a RenderTexture2D minified (height x instances) for the light curve texture
+
+    LightCurveMultisampleTarget msaa;               // "MSAA Samples": the lighting pass draws here and is resolved into renderedTex
+    RenderTexture2D lightingTex = LoadMultisampleTarget(&msaa, screenPixels, screenPixels, command.msaa_samples, command.render_target) ? msaa.target : renderedTex;
+
+    if(!headless) SetTargetFPS(frame_rate);         // Attempt to run at 60 fps
+
+    LightCurveGeometryTable geometries;             // Canonical (sun, viewer) pairs already rendered or being rendered
+    InitGeometryTable(&geometries, command.dedup_mode, results.channel_mask);
+
+    LightCurveRefiner *refiner = malloc(sizeof(LightCurveRefiner)); // Orders results and re-renders points above the refine tolerance
+    InitRefiner(refiner, gridWidth, command.refine_tolerance, results.channel_count, &geometries);
 
-    SetTargetFPS(frame_rate);                       // Attempt to run at 60 fps
+    LightCurveShadowCache shadow_cache;             // Depth maps of earlier points, reused under the same sun
+    InitShadowCache(&shadow_cache, screenPixels, gridWidth, command.shadow_cache_mb, command.shadow_cache_tolerance);
+    bool input_done = false;
+
+    LCFramePacket frame;                                     // Per-instance transforms and MVPs of the current batch
 
-    float light_curve_results[MAX_DATA_POINTS];
-    int frame_number = 0;
     // Main animation loop
-    while (!WindowShouldClose() && rendering)            // Detect window close button or ESC key
+    while (!WindowShouldClose())            // Detect window close button or ESC key
     {
+      //----------------------------------------------------------------------------------
+      // Batch geometry
+      //----------------------------------------------------------------------------------
+      BeginProfilePhase(&profiler, LC_PHASE_FRAME);
+      BeginProfilePhase(&profiler, LC_PHASE_BATCH);
+      int level = NextRefineLevel(refiner, input_done);      // 0: new input on the command's grid, > 0: refinement of earlier points
+      if(level < 0) break;                                    // Every result written
+
+      if(level == 0) {
+        int new_count;
+        if(pipe_mode) {
+          new_count = ReadGeometryBatch(geometry_pipe, instances); // Blocks for the first record, then waits at most flush_ms
+          AddRefineBatch(refiner, geometry_pipe->sun_vectors, geometry_pipe->viewer_vectors, new_count);
+        }
+        else {
+          do {                                                     // Duplicates take no tile, keep reading until the frame is full
+            int batch_start = refiner->next_index;                 // Selects the entries of the command file for this frame
+            new_count = instances - refiner->queue_counts[0];
+            if(new_count > data_points - batch_start) new_count = data_points - batch_start;
+            if(new_count > RefineInputRoom(refiner)) new_count = RefineInputRoom(refiner);
+            if(propagator != NULL) {
+              PropagateAttitudeBatch(propagator, batch_start, new_count);
+              AddRefineBatch(refiner, propagator->sun_vectors, propagator->viewer_vectors, new_count);
+            }
+            else AddRefineBatch(refiner, command.sun_vectors + 3 * batch_start, command.viewer_vectors + 3 * batch_start, new_count);
+          } while(new_count > 0 && refiner->queue_counts[0] < instances);
+        }
+
+        input_done = (pipe_mode) ? new_count == 0 : refiner->next_index == data_points;
+        if((pipe_mode) ? new_count < instances : input_done) refiner->drain = true; // Nothing more to pack with, finish what is queued
+        if(refiner->queue_counts[0] == 0) {
+          EndProfilePhase(&profiler, LC_PHASE_BATCH);
+          BeginProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
+          FinishRefineBatch(refiner, 0, NULL, NULL, &results);     // Only duplicates: write what they finished, no frame
+          EndProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
+          continue;
+        }
+      }
+      EndProfilePhase(&profiler, LC_PHASE_BATCH);
+
+      int batch_count = RefineBatchSize(refiner, level);
+      const LCRefinePoint *batch = refiner->queues[level];
+      int pass_grid_width = refiner->grid_widths[level];
+      int pass_instances = pass_grid_width * pass_grid_width;
+
+      viewer_camera.fovy = grid_fovy * pass_grid_width / gridWidth; // Same model size in world units, fewer and larger tiles
+      light_camera.fovy = viewer_camera.fovy;
+
+      frame.viewer_camera = viewer_camera;
+      frame.light_camera = light_camera;
+      frame.count = batch_count;
+      frame.grid_instances = pass_instances;
+      for(int instance = 0; instance < batch_count; instance++) {
+        for(int k = 0; k < 3; k++) {
+          frame.sun[k][instance] = (float) batch[instance].sun[k];
+          frame.viewer[k][instance] = (float) batch[instance].viewer[k];
+        }
+      }
+      PrepareFramePacket(&frame);
+      SetShaderValueV(depthShader, depth_light_mvps_loc, frame.light_mvps, SHADER_UNIFORM_VEC4, 4 * batch_count);        // Every instance's MVPs in one upload per shader
+      SetShaderValueV(lighting_shader, lighting_viewer_mvps_loc, frame.viewer_mvps, SHADER_UNIFORM_VEC4, 4 * batch_count);
+
       //----------------------------------------------------------------------------------
       // Update
       //----------------------------------------------------------------------------------
+      BeginProfilePass(&profiler, LC_PASS_DEPTH);
       BeginTextureMode(depthTex);                             // Enable drawing to texture
           ClearBackground(BLACK);                             // Clear texture background
       EndTextureMode();
+      EndProfilePass(&profiler);
       
-      BeginTextureMode(renderedTex);                             // Enable drawing to texture
+      BeginProfilePass(&profiler, LC_PASS_LIGHTING);
+      BeginTextureMode(lightingTex);                             // Enable drawing to texture
           ClearBackground(BLACK);                             // Clear texture background
       EndTextureMode();
+      EndProfilePass(&profiler);
 
-      rlUpdateVertexBuffer(mesh.vboId[0], mesh.vertices, mesh.vertexCount*3*sizeof(float), 0);    // Update vertex position
-      rlUpdateVertexBuffer(mesh.vboId[2], mesh.normals, mesh.vertexCount*3*sizeof(float), 0);     // Update vertex normals
-      
-      for(int instance = 0; instance < instances; instance++) {
-        int render_index = instance + (frame_number * instances) % data_points; // Selects the correct entry of the command file for this instance
-
-        sun.position = sun_vectors[render_index];
-        viewer_camera.position = viewer_vectors[render_index];
+      for(int instance = 0; instance < batch_count; instance++) {            // Last frame may only be partially filled
+        const LCInstanceConstants *constants = &frame.instances[instance]; // Positions, tile transforms and MVPs
+        sun.position = constants->sun;
+        viewer_camera.position = constants->viewer;
 
         light_camera.position = (Vector3) {sun.position.x, sun.position.y, sun.position.z};
         UpdateLightValues(lighting_shader, sun);
         UpdateLightValues(depthShader, sun);
 
-        Vector3 mesh_offsets[MAX_INSTANCES] = { 0 };
-        GenerateTranslations(mesh_offsets, viewer_camera, instances);
-
-        Vector3 viewer_camera_transforms[MAX_INSTANCES] = { 0 };
-        Vector3 light_camera_transforms[MAX_INSTANCES] = { 0 };
-        Matrix mvp_lights[MAX_INSTANCES] = { 0 };
-        Matrix mvp_viewer[MAX_INSTANCES] = { 0 };
-        Matrix mvp_light_biases[MAX_INSTANCES] = { 0 };
-
-        viewer_camera_transforms[instance] = TransformOffsetToCameraPlane(viewer_camera, mesh_offsets[instance]);
-        light_camera_transforms[instance] = TransformOffsetToCameraPlane(light_camera, mesh_offsets[instance]);
-
-        float viewerCameraPos[3] = { viewer_camera.position.x, viewer_camera.position.y, viewer_camera.position.z };
         float lightPos[3] = { sun.position.x, sun.position.y, sun.position.z };
 
-        mvp_lights[instance] = CalculateMVPFromCamera(light_camera, mesh_offsets[instance]); //Calculates the model-view-projection matrix for the light_camera
-        mvp_viewer[instance] = CalculateMVPFromCamera(viewer_camera, mesh_offsets[instance]); //Calculates the model-view-projection matrix for the light_camera
-        mvp_light_biases[instance] = CalculateMVPBFromMVP(mvp_lights[instance]); //Takes [-1, 1] -> [0, 1] for texture sampling
+        Texture2D shadow_map = depthTex.texture;                // Cached maps only exist for the command's grid, refinement passes render their own
+        Matrix shadow_matrix = constants->mvp_light_bias;
+        Vector3 shadow_sun = sun.position;
+        bool shadow_cached = (level == 0) && FindShadowMap(&shadow_cache, sun.position, &shadow_map, &shadow_matrix, &shadow_sun);
 
-        SetShaderValue(lighting_shader, lighting_shader.locs[1], lightPos, SHADER_UNIFORM_VEC3); //Sends the light position vector to the lighting shader
+        float shadowLightPos[3] = { shadow_sun.x, shadow_sun.y, shadow_sun.z }; // The depth test must match the sun the map was rendered for
+        SetShaderValue(lighting_shader, lighting_shader.locs[1], shadowLightPos, SHADER_UNIFORM_VEC3); //Sends the light position vector to the lighting shader
 
         //----------------------------------------------------------------------------------
         // Write to depth texture
         //----------------------------------------------------------------------------------
-        BeginTextureMode(depthTex);                             // Enable drawing to texture
+        if(!shadow_cached) {
+          BeginProfilePass(&profiler, LC_PASS_DEPTH);
+          BeginTextureMode(depthTex);                             // Enable drawing to texture
 
-            BeginMode3D(light_camera);                          // Begin 3d mode drawing
-                model.materials[0].shader = depthShader;        // Assign depth texture shader to model
+              BeginMode3D(light_camera);                          // Begin 3d mode drawing
+                  model.materials[0].shader = depthShader;        // Assign depth texture shader to model
 
-                SetShaderValue(depthShader, depthShader.locs[3], &instance, SHADER_UNIFORM_INT); //Sends the light position vector to the lighting shader
-                SetShaderValueMatrix(depthShader, depth_light_mvp_locs[instance], mvp_lights[instance]);
+                  SetShaderValue(depthShader, depthShader.locs[3], &instance, SHADER_UNIFORM_INT); //Sends the light position vector to the lighting shader
                 
-                SetShaderValue(depthShader, depthShader.locs[2], lightPos, SHADER_UNIFORM_VEC3);         //Sends the light position vector to the depth shader
-                DrawMesh(mesh, model.materials[0], MatrixTranslate(light_camera_transforms[instance].x, light_camera_transforms[instance].y, light_camera_transforms[instance].z));  
+                  SetShaderValue(depthShader, depthShader.locs[2], lightPos, SHADER_UNIFORM_VEC3);         //Sends the light position vector to the depth shader
+                  DrawLightCurveModel(lc_model, model.materials[0], MatrixTranslate(constants->light_transform.x, constants->light_transform.y, constants->light_transform.z));  
 
-            EndMode3D();                                        // End 3d mode drawing, returns to orthographic 2d mode
-        EndTextureMode();                                       // End drawing to texture
+              EndMode3D();                                        // End 3d mode drawing, returns to orthographic 2d mode
+          EndTextureMode();                                       // End drawing to texture
+          EndProfilePass(&profiler);
+
+          if(level == 0) StoreShadowMap(&shadow_cache, depthTex, instance, sun.position, constants->mvp_light_bias);
+        }
 
         //----------------------------------------------------------------------------------
         // Write to the rendered texture
         //----------------------------------------------------------------------------------
-        BeginTextureMode(renderedTex);
+        BeginProfilePass(&profiler, LC_PASS_LIGHTING);
+        BeginTextureMode(lightingTex);
           model.materials[0].shader = lighting_shader;             //Sets the model's shader to the lighting shader (was the depth shader)
 
-          DrawTextureRec(depthTex.texture, (Rectangle){ 0, 0, 0, 0}, (Vector2){ 0, 0 }, WHITE);
+          DrawTextureRec(shadow_map, (Rectangle){ 0, 0, 0, 0}, (Vector2){ 0, 0 }, WHITE);
           
-          SetShaderValueTexture(lighting_shader, lighting_shader.locs[2], depthTex.texture); //Sends depth texture to the main lighting shader    
+          SetShaderValueTexture(lighting_shader, lighting_shader.locs[2], shadow_map); //Sends depth texture to the main lighting shader    
 
           BeginMode3D(viewer_camera);
-                DrawTextureRec(depthTex.texture, (Rectangle){ 0, 0, 0, 0}, (Vector2){ 0, 0 }, WHITE);
+                DrawTextureRec(shadow_map, (Rectangle){ 0, 0, 0, 0}, (Vector2){ 0, 0 }, WHITE);
                 
                 SetShaderValue(lighting_shader, lighting_shader.locs[4], &instance, SHADER_UNIFORM_INT); //Sends the light position vector to the lighting shader
-                SetShaderValueMatrix(lighting_shader, lighting_shader.locs[5], mvp_light_biases[instance]);
-                SetShaderValueMatrix(lighting_shader, lighting_shader.locs[3], mvp_viewer[instance]);
-                SetShaderValueTexture(lighting_shader, lighting_shader.locs[2], depthTex.texture); //Sends depth texture to the main lighting shader 
+                SetShaderValueMatrix(lighting_shader, lighting_shader.locs[5], shadow_matrix);
+                SetShaderValueTexture(lighting_shader, lighting_shader.locs[2], shadow_map); //Sends depth texture to the main lighting shader 
                 SetShaderValue(lighting_shader, lighting_shader.locs[6], &gridWidth, SHADER_UNIFORM_INT); //Sends depth texture to the main lighting shader 
 
-                DrawMesh(mesh, model.materials[0], MatrixTranslate(viewer_camera_transforms[instance].x, viewer_camera_transforms[instance].y, viewer_camera_transforms[instance].z));     
+                DrawLightCurveModel(lc_model, model.materials[0], MatrixTranslate(constants->viewer_transform.x, constants->viewer_transform.y, constants->viewer_transform.z));     
           EndMode3D();
 
         EndTextureMode();
+        EndProfilePass(&profiler);
+      }
+
+      if(msaa.samples > 0) {
+        BeginProfilePass(&profiler, LC_PASS_LIGHTING);
+        ResolveMultisampleTarget(&msaa, renderedTex);        // Averages the samples into the texture the brightness pass reads
+        EndProfilePass(&profiler);
       }
 
+      BeginProfilePass(&profiler, LC_PASS_BRIGHTNESS);
       BeginTextureMode(brightnessTex);
         ClearBackground(BLACK);                             // Clear texture background
         BeginShaderMode(brightness_shader);
@@ -187,6 +408,9 @@ int main(void)
         EndShaderMode();
       EndTextureMode();
 
+      EndProfilePass(&profiler);
+
+      BeginProfilePass(&profiler, LC_PASS_EXTRACTION);
       BeginTextureMode(lightCurveTex);
         ClearBackground(BLACK);                             // Clear texture background
         BeginShaderMode(light_curve_shader);
@@ -194,62 +418,97 @@ int main(void)
         EndShaderMode();
       EndTextureMode();
 
+      EndProfilePass(&profiler);
+
+      BeginProfilePass(&profiler, LC_PASS_MINIFY);
       BeginTextureMode(minifiedLightCurveTex);
         ClearBackground(BLACK);                             // Clear texture background
         BeginShaderMode(min_shader);
-          SetShaderValue(min_shader, min_shader.locs[0], &gridWidth, SHADER_UNIFORM_INT); //Sends the light position vector to the lighting shader
+          SetShaderValue(min_shader, min_shader.locs[0], &pass_grid_width, SHADER_UNIFORM_INT); //Sends the light position vector to the lighting shader
           DrawTextureRec(brightnessTex.texture, (Rectangle){ 0, 0, (float) screenPixels, (float) -screenPixels }, (Vector2){ 0, 0 }, WHITE);
         EndShaderMode();
       EndTextureMode();
+      EndProfilePass(&profiler);
 
       float clipping_area = CalculateCameraArea(viewer_camera);
 
       float lightCurveFunction[MAX_INSTANCES];
-      CalculateLightCurveValues(lightCurveFunction, minifiedLightCurveTex, brightnessTex, clipping_area, instances, mesh_scale_factor);
+      float litAreaFunction[MAX_INSTANCES];
+      float relativeErrorFunction[MAX_INSTANCES];
+      BeginProfilePhase(&profiler, LC_PHASE_CALCULATE);
+      BeginProfilePass(&profiler, LC_PASS_READBACK);
+      CalculateLightCurveValues(lightCurveFunction, litAreaFunction, relativeErrorFunction, minifiedLightCurveTex, clipping_area, pass_instances, mesh_scale_factor);
+      EndProfilePass(&profiler);
+      EndProfilePhase(&profiler, LC_PHASE_CALCULATE);
       
       //STORING LIGHT CURVE RESULTS
-      for(int i = 0; i < instances; i++) {
-        int data_point_index = (frame_number * instances) % data_points + i;
-        light_curve_results[data_point_index] = lightCurveFunction[i];
+      float batch_values[MAX_INSTANCES * LC_MAX_CHANNELS];
 
-        if(data_point_index + 1 == data_points) {
-          WriteLightCurveResults(results_file, light_curve_results, data_points);
-          rendering = false;
-        }
+      for(int i = 0; i < batch_count; i++) {
+        int channel = 0;
+        batch_values[i * results.channel_count + channel++] = lightCurveFunction[i];
+        if(results.channel_mask & LC_CHANNEL_LIT_AREA) batch_values[i * results.channel_count + channel++] = litAreaFunction[i];
       }
+      BeginProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
+      FinishRefineBatch(refiner, level, batch_values, relativeErrorFunction, &results); // Streamed out once no earlier point is waiting on refinement
+      EndProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
 
       //DRAWING
-      BeginDrawing();
-        ClearBackground(BLACK);
-        // DrawTextureRec(depthTex.texture, (Rectangle){ 0, 0, depthTex.texture.width, (float) -depthTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
-        DrawTextureRec(renderedTex.texture, (Rectangle){ 0, 0, depthTex.texture.width, (float) -depthTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
-        // DrawTextureRec(minifiedLightCurveTex.texture, (Rectangle){ 0, 0, minifiedLightCurveTex.texture.width, (float) -minifiedLightCurveTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
+      if(headless) PollInputEvents();                 // Nothing to show, skip the preview blit and buffer swap
+      else {
+        BeginDrawing();
+          ClearBackground(BLACK);
+          // DrawTextureRec(depthTex.texture, (Rectangle){ 0, 0, depthTex.texture.width, (float) -depthTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
+          DrawTextureRec(renderedTex.texture, (Rectangle){ 0, 0, depthTex.texture.width, (float) -depthTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
+          // DrawTextureRec(minifiedLightCurveTex.texture, (Rectangle){ 0, 0, minifiedLightCurveTex.texture.width, (float) -minifiedLightCurveTex.texture.height }, (Vector2){ 0, 0 }, WHITE);
 
-        DrawFPS(10, 10);
+          DrawFPS(10, 10);
 
-      EndDrawing();
-
-      frame_number++;
+        EndDrawing();
+      }
+      EndProfilePhase(&profiler, LC_PHASE_FRAME);
+      EndProfileFrame(&profiler);
     }
 
     //----------------------------------------------------------------------------------
     // Unloading GPU components
     //--------------------------------------------------------------------------------------
-    UnloadModel(model);                 // Unload the model
+    UnloadLightCurveModel(lc_model);    // Unload the model and its index buffer
 
-    UnloadShader(lighting_shader);      // Unload shader
-    UnloadShader(depthShader);          // Unload depth texture shader
-    UnloadShader(brightness_shader);    // Unload brightness shader
-    UnloadShader(light_curve_shader);   // Unload light curve shader
-    UnloadShader(min_shader);           // Unload minimize shader
+    UnloadShaderCache(&shader_cache);   // Unload the lighting, depth, brightness, light curve and minimize shaders
 
     UnloadRenderTexture(depthTex);      // Unload depth texture
     UnloadRenderTexture(renderedTex);   // Unload rendered texture
     UnloadRenderTexture(brightnessTex); // Unload brightnesss texture
     UnloadRenderTexture(lightCurveTex); // Unload light curve texture
     UnloadRenderTexture(minifiedLightCurveTex); // Unload minified light curve texture
+    UnloadMultisampleTarget(&msaa);     // Unload the multisampled lighting framebuffer
+    UnloadShadowCache(&shadow_cache);   // Unload the shadow map atlas
+    UnloadProfilerQueries(&profiler);   // Reads back the frames still in flight
 
     CloseWindow();                      // Close window and OpenGL context
 
+    LogRefineStatistics(refiner, screenPixels);
+    LogShadowCacheStatistics(&shadow_cache);
+    LogGeometryStatistics(&geometries);
+    LogPropagatorStatistics(propagator);
+    BeginProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
+    CloseLightCurveResults(&results);
+    EndProfilePhase(&profiler, LC_PHASE_RESULT_WRITE);
+    free(refiner);
+    UnloadGeometryTable(&geometries);
+
+    if(lut_rendered != NULL && results.points_written < data_points) TraceLog(LOG_WARNING, "LUT: Closed after %d of %d renders, no table or report", results.points_written, data_points);
+    else if(bake_filename != NULL) SaveLightCurveLUT(bake_filename, lut_nside, lut_rendered, &command);
+    else if(lut_expected != NULL) ReportLUTSpotCheck(lut_expected, lut_rendered, data_points);
+    free(lut_rendered);
+    free(lut_expected);
+    free(geometry_pipe);
+    free(propagator);
+    UnloadLightCurveCommand(&command);  // Unmap/free the command data
+
+    WriteProfileReport(&profiler, profile_filename, results.points_written);
+    UnloadProfiler(&profiler);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+"""Accuracy versus cost benchmark for LightCurveEngine settings.
+
+Renders convex test bodies (cube, faceted cylinder, icosphere) and compares every data
+point against the exact facet sum of computeReflectionMatrix.m, which is exact for a
+convex Lambertian body (no facet shadows another):
+
+    brightness = sum over facets of  reflectance * area * max(s.n, 0) * max(v.n, 0) / pi
+
+with s and v unit sun and viewer directions. Each (Square Dimensions, Instances,
+Render Target, MSAA Samples) setting is run on every body and reported as
+
+    rms_error, max_error   relative to the exact value, over points whose exact
+                           brightness is at least --min-fraction of the body's mean
+    ms_per_point           render loop time per data point (--profile frame totals)
+
+The table is sorted by cost and marks the Pareto front: settings no cheaper setting
+beats in RMS error. Pick production settings from the marked rows.
+
+    python3 benchmark_accuracy.py --dimensions 600 900 --instances 9 16 25 --json pareto.json
+
+Run it from the repository root. The bodies are written to models/lc_accuracy_*.obj
+and removed afterwards unless --keep-models is given.
+"""
+import argparse
+import itertools
+import json
+import math
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+
+from write_lccb import write_lccb
+
+BODIES = ('cube', 'cylinder', 'icosphere')
+DEFAULT_DIMENSIONS = (300, 600, 900, 1200)
+DEFAULT_INSTANCES = (1, 4, 9, 16, 25)
+DEFAULT_TARGETS = ('RGBA8', 'RGBA32F')
+DEFAULT_MSAA = (0, 4)
+CYLINDER_SEGMENTS = 64
+ICOSPHERE_SUBDIVISIONS = 2
+
+
+def cube():
+    vertices = [(x, y, z) for x in (-1, 1) for y in (-1, 1) for z in (-1, 1)]
+    quads = [(0, 1, 3, 2), (4, 6, 7, 5), (0, 4, 5, 1), (2, 3, 7, 6), (0, 2, 6, 4), (1, 5, 7, 3)]
+    return vertices, [t for a, b, c, d in quads for t in ((a, b, c), (a, c, d))]
+
+
+def cylinder(segments=CYLINDER_SEGMENTS):
+    vertices = []
+    for k in range(segments):
+        angle = 2 * math.pi * k / segments
+        vertices += [(math.cos(angle), math.sin(angle), -1.0), (math.cos(angle), math.sin(angle), 1.0)]
+    bottom, top = len(vertices), len(vertices) + 1
+    vertices += [(0.0, 0.0, -1.0), (0.0, 0.0, 1.0)]
+    triangles = []
+    for k in range(segments):
+        a, b = 2 * k, 2 * ((k + 1) % segments)
+        triangles += [(a, b, b + 1), (a, b + 1, a + 1), (bottom, b, a), (top, a + 1, b + 1)]
+    return vertices, triangles
+
+
+def icosphere(subdivisions=ICOSPHERE_SUBDIVISIONS):
+    t = (1 + math.sqrt(5)) / 2
+    vertices = [(-1, t, 0), (1, t, 0), (-1, -t, 0), (1, -t, 0), (0, -1, t), (0, 1, t),
+                (0, -1, -t), (0, 1, -t), (t, 0, -1), (t, 0, 1), (-t, 0, -1), (-t, 0, 1)]
+    vertices = [_normalize(v) for v in vertices]
+    triangles = [(0, 11, 5), (0, 5, 1), (0, 1, 7), (0, 7, 10), (0, 10, 11), (1, 5, 9), (5, 11, 4),
+                 (11, 10, 2), (10, 7, 6), (7, 1, 8), (3, 9, 4), (3, 4, 2), (3, 2, 6), (3, 6, 8),
+                 (3, 8, 9), (4, 9, 5), (2, 4, 11), (6, 2, 10), (8, 6, 7), (9, 8, 1)]
+    for _ in range(subdivisions):
+        midpoints = {}
+
+        def midpoint(a, b):
+            key = (min(a, b), max(a, b))
+            if key not in midpoints:
+                midpoints[key] = len(vertices)
+                vertices.append(_normalize([(p + q) / 2 for p, q in zip(vertices[a], vertices[b])]))
+            return midpoints[key]
+
+        refined = []
+        for a, b, c in triangles:
+            ab, bc, ca = midpoint(a, b), midpoint(b, c), midpoint(c, a)
+            refined += [(a, ab, ca), (b, bc, ab), (c, ca, bc), (ab, bc, ca)]
+        triangles = refined
+    return vertices, triangles
+
+
+def _normalize(v):
+    length = math.sqrt(sum(c * c for c in v))
+    return tuple(c / length for c in v)
+
+
+def facets(vertices, triangles):
+    """(unit normal, area) per triangle, counter-clockwise faces pointing outwards."""
+    result = []
+    for a, b, c in triangles:
+        p, q, r = vertices[a], vertices[b], vertices[c]
+        u = [q[i] - p[i] for i in range(3)]
+        w = [r[i] - p[i] for i in range(3)]
+        n = (u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0])
+        length = math.sqrt(sum(c * c for c in n))
+        result.append((tuple(c / length for c in n), length / 2))
+    return result
+
+
+def write_obj(filename, vertices, triangles):
+    with open(filename, 'w') as f:
+        f.write('# Convex accuracy benchmark body, written by benchmark_accuracy.py\n')
+        for v in vertices:
+            f.write('v %.9f %.9f %.9f\n' % tuple(v))
+        for n, _ in facets(vertices, triangles):
+            f.write('vn %.9f %.9f %.9f\n' % n)
+        for k, (a, b, c) in enumerate(triangles):
+            f.write('f %d//%d %d//%d %d//%d\n' % (a + 1, k + 1, b + 1, k + 1, c + 1, k + 1))
+
+
+def exact_brightness(body_facets, sun, viewer):
+    s, v = _normalize(sun), _normalize(viewer)
+    total = 0.0
+    for n, area in body_facets:
+        ns = n[0] * s[0] + n[1] * s[1] + n[2] * s[2]
+        nv = n[0] * v[0] + n[1] * v[1] + n[2] * v[2]
+        if ns > 0 and nv > 0:
+            total += area * ns * nv
+    return total / math.pi
+
+
+def read_lcrb(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if data[:4] != b'LCRB':
+        raise ValueError('%s is not an .lcrb file' % filename)
+    header_size, channel_count, _, sample_size = struct.unpack_from('<IIII', data, 8)
+    code = 'd' if sample_size == 8 else 'f'
+    count = (len(data) - header_size) // sample_size
+    samples = struct.unpack_from('<%d%s' % (count, code), data, header_size)
+    return list(samples[::channel_count])
+
+
+def random_directions(count, rng):
+    vectors = []
+    while len(vectors) < count:
+        v = [rng.gauss(0.0, 1.0) for _ in range(3)]
+        if sum(c * c for c in v) > 1e-12:
+            vectors.append([2.0 * c for c in _normalize(v)])
+    return vectors
+
+
+def run_setting(engine, setting, bodies, sun, viewer, workdir, min_fraction):
+    dimensions, instances, target, msaa = setting
+    errors, frame_ms = [], 0.0
+    for name, body_facets in bodies:
+        command_file = os.path.join(workdir, 'accuracy.lccb')
+        results_file = os.path.join(workdir, 'accuracy.lcrb')
+        profile_file = os.path.join(workdir, 'profile.json')
+        write_lccb(command_file, results_file, 'lc_accuracy_%s.obj' % name, instances, dimensions,
+                   sun, viewer, frame_rate=0, dedup='Off', render_target=target, msaa_samples=msaa)
+        subprocess.run([engine, command_file, '--headless', '--profile', profile_file],
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+        with open(profile_file) as f:
+            frame_ms += json.load(f)['cpu']['frame']['total_ms']
+
+        rendered = read_lcrb(results_file)
+        exact = [exact_brightness(body_facets, s, v) for s, v in zip(sun, viewer)]
+        floor = min_fraction * sum(exact) / len(exact)
+        errors += [(r - e) / e for r, e in zip(rendered, exact) if e >= floor]
+
+    return {
+        'dimensions': dimensions, 'instances': instances, 'render_target': target, 'msaa_samples': msaa,
+        'rms_error': math.sqrt(sum(e * e for e in errors) / len(errors)) if errors else float('nan'),
+        'max_error': max(abs(e) for e in errors) if errors else float('nan'),
+        'ms_per_point': frame_ms / (len(sun) * len(bodies)),
+        'points_compared': len(errors),
+    }
+
+
+def mark_pareto(rows):
+    rows.sort(key=lambda row: (row['ms_per_point'], row['rms_error']))
+    best = float('inf')
+    for row in rows:
+        row['pareto'] = row['rms_error'] < best
+        best = min(best, row['rms_error'])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--engine', default='./LightCurveEngine')
+    parser.add_argument('--dimensions', nargs='+', type=int, default=DEFAULT_DIMENSIONS)
+    parser.add_argument('--instances', nargs='+', type=int, default=DEFAULT_INSTANCES)
+    parser.add_argument('--targets', nargs='+', default=DEFAULT_TARGETS, choices=DEFAULT_TARGETS)
+    parser.add_argument('--msaa', nargs='+', type=int, default=DEFAULT_MSAA)
+    parser.add_argument('--points', type=int, default=500)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--min-fraction', type=float, default=0.05,
+                        help="points dimmer than this fraction of the body's mean are not compared")
+    parser.add_argument('--json', metavar='FILE', help='write every row, Pareto flag included')
+    parser.add_argument('--keep-models', action='store_true')
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    sun = random_directions(args.points, rng)
+    viewer = random_directions(args.points, rng)
+
+    bodies, model_files = [], []
+    for name, build in (('cube', cube), ('cylinder', cylinder), ('icosphere', icosphere)):
+        vertices, triangles = build()
+        model_file = os.path.join('models', 'lc_accuracy_%s.obj' % name)
+        write_obj(model_file, vertices, triangles)
+        model_files.append(model_file)
+        bodies.append((name, facets(vertices, triangles)))
+
+    rows = []
+    try:
+        with tempfile.TemporaryDirectory() as workdir:
+            for setting in itertools.product(args.dimensions, args.instances, args.targets, args.msaa):
+                row = run_setting(args.engine, setting, bodies, sun, viewer, workdir, args.min_fraction)
+                rows.append(row)
+                print('%5d px %3d inst %-7s %2dx MSAA  rms %.5f  max %.5f  %.4f ms/point' %
+                      (row['dimensions'], row['instances'], row['render_target'], row['msaa_samples'],
+                       row['rms_error'], row['max_error'], row['ms_per_point']), file=sys.stderr)
+    finally:
+        if not args.keep_models:
+            for model_file in model_files:
+                os.remove(model_file)
+
+    mark_pareto(rows)
+    print('%-8s %-10s %-9s %-5s %-11s %-11s %-12s' % ('Pareto', 'Dimensions', 'Instances', 'MSAA', 'Target', 'RMS error', 'Max error') + 'ms/point')
+    for row in rows:
+        print('%-8s %-10d %-9d %-5d %-11s %-11.5f %-12.5f%.4f' %
+              ('*' if row['pareto'] else '', row['dimensions'], row['instances'], row['msaa_samples'],
+               row['render_target'], row['rms_error'], row['max_error'], row['ms_per_point']))
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(rows, f, indent=2)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
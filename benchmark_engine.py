@@ -0,0 +1,171 @@
+"""End-to-end throughput benchmark for LightCurveEngine.
+
+Sweeps model x Instances x Square Dimensions x data point count. Each case writes a
+.lccb command of random sun and viewer directions (fixed seed, so every run renders the
+same geometry), runs the engine with --headless --profile and records
+
+    points_per_second   data points over the process's wall time, startup included
+    ms_per_frame        mean and p99 of the engine's per-frame time (--profile)
+    peak_rss_mb         the engine process's peak resident set
+
+Cases are repeated and the fastest repeat is kept. --save writes the results as a
+baseline, --baseline compares against one and exits with status 1 when any case is
+slower or larger than the baseline by more than --threshold (relative, default 0.10).
+
+    python3 benchmark_engine.py --save benchmarks/baseline.json
+    python3 benchmark_engine.py --baseline benchmarks/baseline.json --threshold 0.05
+
+Models are procedural bodies by default (see include/lightcurveprocedural.c): the cube
+sweep runs from 12 to about 10^6 triangles, the boxwing and dish add self-shadowing. Any
+other name is read as models/<name>.obj and skipped when that file is missing.
+
+Run it from the repository root: the engine reads models/, shaders/ and its cache
+directories relative to the working directory.
+"""
+import argparse
+import json
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+from write_lccb import write_lccb
+
+DEFAULT_MODELS = ('procedural:cube:1', 'procedural:cube:9', 'procedural:cube:29', 'procedural:cube:91',
+                  'procedural:cube:289', 'procedural:sphere:32', 'procedural:boxwing:16', 'procedural:dish:32')
+PROCEDURAL_PREFIX = 'procedural:'
+DEFAULT_INSTANCES = (1, 9, 25)
+DEFAULT_DIMENSIONS = (300, 600, 900)
+DEFAULT_POINTS = (1000, 10000)
+METRICS = {'points_per_second': +1, 'ms_per_frame': -1, 'peak_rss_mb': -1}  # +1: higher is better
+RESULTS_FILE_VERSION = 1
+
+
+def random_directions(count, rng, length=2.0):
+    vectors = []
+    while len(vectors) < count:
+        v = [rng.gauss(0.0, 1.0) for _ in range(3)]
+        norm = math.sqrt(sum(c * c for c in v))
+        if norm > 1e-9:
+            vectors.append([length * c / norm for c in v])
+    return vectors
+
+
+def run_case(engine, model, instances, dimensions, points, repeats, workdir, seed):
+    rng = random.Random(seed)
+    sun = random_directions(points, rng)
+    viewer = random_directions(points, rng)
+    command_file = os.path.join(workdir, 'benchmark.lccb')
+    results_file = os.path.join(workdir, 'benchmark.lcrb')
+    profile_file = os.path.join(workdir, 'profile.json')
+    model_file = model if model.startswith(PROCEDURAL_PREFIX) else model + '.obj'
+    write_lccb(command_file, results_file, model_file, instances, dimensions,
+               sun, viewer, frame_rate=0, dedup='Off')
+
+    best = None
+    for _ in range(repeats):
+        start = time.perf_counter()
+        process = subprocess.Popen([engine, command_file, '--headless', '--profile', profile_file],
+                                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+        if process.returncode != 0:
+            raise RuntimeError("engine exited with status %d" % process.returncode)
+
+        with open(profile_file) as f:
+            profile = json.load(f)
+        frame = profile['cpu']['frame']
+        rss_bytes = usage.ru_maxrss * (1 if sys.platform == 'darwin' else 1024)
+        result = {
+            'points_per_second': points / wall,
+            'ms_per_frame': frame.get('mean_ms', 0.0),
+            'p99_ms_per_frame': frame.get('p99_ms', 0.0),
+            'frames': profile['frames'],
+            'peak_rss_mb': rss_bytes / 2.0**20,
+            'wall_s': wall,
+        }
+        if best is None or result['points_per_second'] > best['points_per_second']:
+            best = result
+    return best
+
+
+def case_key(model, instances, dimensions, points):
+    return '%s/i%d/d%d/n%d' % (model, instances, dimensions, points)
+
+
+def compare(results, baseline, threshold):
+    regressions = []
+    for key, result in sorted(results.items()):
+        reference = baseline.get(key)
+        if reference is None:
+            print('%-40s new case, no baseline' % key)
+            continue
+        for metric, direction in METRICS.items():
+            old, new = reference[metric], result[metric]
+            if old <= 0:
+                continue
+            change = (new - old) / old
+            worse = -change * direction
+            flag = 'REGRESSION' if worse > threshold else ''
+            print('%-40s %-18s %12.3f -> %12.3f  %+7.1f%%  %s' % (key, metric, old, new, 100 * change, flag))
+            if flag:
+                regressions.append((key, metric))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--engine', default='./LightCurveEngine')
+    parser.add_argument('--models', nargs='+', default=DEFAULT_MODELS,
+                        help='procedural:<body>:<resolution> specs or names of models/*.obj')
+    parser.add_argument('--instances', nargs='+', type=int, default=DEFAULT_INSTANCES)
+    parser.add_argument('--dimensions', nargs='+', type=int, default=DEFAULT_DIMENSIONS)
+    parser.add_argument('--points', nargs='+', type=int, default=DEFAULT_POINTS)
+    parser.add_argument('--repeats', type=int, default=3)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--save', metavar='FILE', help='write the results as a baseline')
+    parser.add_argument('--baseline', metavar='FILE', help='compare against a saved baseline')
+    parser.add_argument('--threshold', type=float, default=0.10,
+                        help='relative slowdown or growth that counts as a regression')
+    args = parser.parse_args()
+
+    results = {}
+    with tempfile.TemporaryDirectory() as workdir:
+        for model in args.models:
+            if not model.startswith(PROCEDURAL_PREFIX) and not os.path.exists(os.path.join('models', model + '.obj')):
+                print('%-40s skipped, models/%s.obj not found' % (model, model))
+                continue
+            for instances in args.instances:
+                for dimensions in args.dimensions:
+                    for points in args.points:
+                        key = case_key(model, instances, dimensions, points)
+                        result = run_case(args.engine, model, instances, dimensions, points,
+                                          args.repeats, workdir, args.seed)
+                        results[key] = result
+                        print('%-40s %10.0f points/s %8.3f ms/frame (p99 %.3f) %7.1f MB' %
+                              (key, result['points_per_second'], result['ms_per_frame'],
+                               result['p99_ms_per_frame'], result['peak_rss_mb']))
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump({'version': RESULTS_FILE_VERSION, 'cases': results}, f, indent=2, sort_keys=True)
+        print('Wrote %d cases to %s' % (len(results), args.save))
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get('version') != RESULTS_FILE_VERSION:
+            sys.exit('%s is not a version %d benchmark file' % (args.baseline, RESULTS_FILE_VERSION))
+        regressions = compare(results, baseline['cases'], args.threshold)
+        if regressions:
+            print('%d regressions beyond %.0f%%' % (len(regressions), 100 * args.threshold))
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
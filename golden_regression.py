@@ -0,0 +1,314 @@
+"""Golden-output regression check for LightCurveEngine results.
+
+Runs every case -- a base command x a backend or reduction mode variant -- through the
+engine and compares its irradiance values with a stored golden, point by point:
+
+    |result - golden| <= atol + rtol * |golden|
+
+Base commands are light_curve.lcc (golden: the checked-in light_curve.lcr, its model
+models/warped_cube.obj is not in the tree) and fixed-seed commands on procedural bodies,
+whose goldens are checked in under goldens/. Variants:
+
+    default            "Deduplicate Off", "Shadow Cache MB 0"; every other variant starts
+                       from these, so each one differs from default in its own setting only
+    rgba32f, msaa4     "Render Target RGBA32F", "MSAA Samples 4"
+    dedup_reciprocal   "Deduplicate Reciprocal"
+    shadow_cache       "Shadow Cache MB 64"
+    refine, lod        "Refine Tolerance 0.01", "LOD Tolerance 0.01"
+    pipe_text          --pipe, geometry as text lines on stdin
+    pipe_binary        --pipe --binary, records laid out by Output Precision and Output Channels
+    lut                --bake a table, then --query it on the CPU
+    lut_query          --query the checked-in table goldens/<base>__lut_query.lclt with the
+                       command as .lcc and as .lccb (write_lccb.py); needs no GPU, the two
+                       parsers must agree exactly
+
+Backends (pipe_*, lut) must reproduce the base command's default golden; reduction modes
+and lut_query are held to goldens of their own. Every case has its own tolerances, see
+VARIANTS. The procedural goldens were recorded on Mesa llvmpipe (GL 3.3 core); a driver
+that rasterizes differently may need wider tolerances for the rendered cases. On a
+software rasterizer the default-resolution bake of lut dominates the run time.
+
+    python3 golden_regression.py                       # check, exit status 1 on any failure
+    python3 golden_regression.py --cases 'dish/*'      # fnmatch on base/variant
+    python3 golden_regression.py --update              # (re)record goldens, light_curve.lcr excepted
+    python3 golden_regression.py --report diff.json    # per-case statistics and worst points
+
+Run it from the repository root. Goldens live in goldens/<base>__<variant>.lcr. A case
+without its golden fails; only --update records one. Bases whose model .obj is missing
+are reported and skipped.
+"""
+import argparse
+import fnmatch
+import json
+import math
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+from write_lccb import write_lccb
+
+GOLDEN_DIR = 'goldens'
+PROCEDURAL_PREFIX = 'procedural:'
+PROCEDURAL_POINTS = 200
+WORST_POINTS = 10
+LUT_QUERY_NSIDE = 2                     # 48 directions per sphere, a 5 KB table per base
+
+# name: (model, instances, square dimensions); the geometry is drawn from a fixed seed
+PROCEDURAL_BASES = {
+    'cube': ('procedural:cube:4', 9, 900),
+    'boxwing': ('procedural:boxwing:8', 9, 900),
+    'dish': ('procedural:dish:16', 9, 900),
+}
+
+# name: header overrides (on top of default's), extra backend, which golden, rtol, atol
+VARIANTS = {
+    'default': ({'Deduplicate': 'Off', 'Shadow Cache MB': '0'}, None, 'own', 1e-4, 1e-6),
+    'rgba32f': ({'Render Target': 'RGBA32F'}, None, 'own', 1e-4, 1e-6),
+    'msaa4': ({'MSAA Samples': '4'}, None, 'own', 1e-4, 1e-6),
+    'dedup_reciprocal': ({'Deduplicate': 'Reciprocal'}, None, 'own', 1e-4, 1e-6),
+    'shadow_cache': ({'Shadow Cache MB': '64'}, None, 'own', 1e-4, 1e-6),
+    'refine': ({'Refine Tolerance': '0.01'}, None, 'own', 1e-4, 1e-6),
+    'lod': ({'LOD Tolerance': '0.01'}, None, 'own', 1e-4, 1e-6),
+    'pipe_text': ({}, 'pipe_text', 'default', 1e-6, 1e-7),
+    'pipe_binary': ({}, 'pipe_binary', 'default', 1e-6, 1e-7),
+    'lut': ({}, 'lut', 'default', 5e-2, 5e-2),  # Interpolation near the terminator, peaks are ~1
+    'lut_query': ({}, 'lut_query', 'own', 1e-6, 1e-9),
+}
+
+
+class Command:
+    """A text command file split into header lines, data lines and everything in between."""
+
+    def __init__(self, text):
+        lines = text.splitlines()
+        begin, end = lines.index('Begin header'), lines.index('End header')
+        self.before = lines[:begin + 1]
+        self.header = lines[begin + 1:end]
+        self.after = lines[end:]
+        start = self.after.index('Begin data') + 1
+        stop = next(i for i in range(start, len(self.after)) if self.after[i].startswith('End data'))
+        self.data = [line for line in self.after[start:stop] if line.strip()]
+
+    def get(self, key):
+        for line in self.header:
+            if line.startswith(key + ' '):
+                return line[len(key):].strip()
+        return None
+
+    def set(self, key, value):
+        line = '%-20s %-20s' % (key, value)
+        for i, existing in enumerate(self.header):
+            if existing.startswith(key + ' '):
+                self.header[i] = line
+                return
+        self.header.append(line)
+
+    def text(self):
+        return '\n'.join(self.before + self.header + self.after) + '\n'
+
+
+def procedural_command(model, instances, dimensions, seed):
+    rng = random.Random(seed)
+    rows = []
+    for _ in range(PROCEDURAL_POINTS):
+        sun, viewer = random_direction(rng), random_direction(rng)
+        rows.append(' '.join('%-10f' % c for c in sun + viewer))
+    header = [('Model File', model), ('Instances', instances), ('Square Dimensions', dimensions),
+              ('Format', 'SunXYZViewerXYZ'), ('Reference Frame', 'ObjectBody'),
+              ('Data Points', PROCEDURAL_POINTS), ('Expected .lcr Name', 'golden.lcr'), ('Target Framerate', 0)]
+    return Command('Light Curve Command File\n\nBegin header\n' +
+                   ''.join('%-20s %-20s\n' % item for item in header) +
+                   'End header\n\nBegin data\n' + '\n'.join(rows) + '\nEnd data')
+
+
+def random_direction(rng):
+    while True:
+        v = [rng.gauss(0.0, 1.0) for _ in range(3)]
+        norm = math.sqrt(sum(c * c for c in v))
+        if norm > 1e-9:
+            return [2.0 * c / norm for c in v]
+
+
+def load_bases():
+    bases = {}
+    with open('light_curve.lcc') as f:
+        bases['light_curve'] = (Command(f.read()), 'light_curve.lcr')
+    for seed, (name, (model, instances, dimensions)) in enumerate(sorted(PROCEDURAL_BASES.items())):
+        bases[name] = (procedural_command(model, instances, dimensions, seed + 1), None)
+    return bases
+
+
+def golden_path(base, variant, base_golden, extension='.lcr'):
+    if variant == 'default' and base_golden is not None and extension == '.lcr':
+        return base_golden
+    return os.path.join(GOLDEN_DIR, '%s__%s%s' % (base, variant, extension))
+
+
+def read_values(filename):
+    """First channel of a text results file."""
+    with open(filename) as f:
+        return [float(line.split()[0]) for line in f if line.strip()]
+
+
+def pipe_record_format(command):
+    """struct format of a --pipe --binary record: uint64 index, then each channel in LC_CHANNEL_* order."""
+    sample = 'd' if command.get('Output Precision') == '64' else 'f'
+    channels = set((command.get('Output Channels') or '').split()) | {'Irradiance'}
+    return '<Q' + sample * sum(name in channels for name in ('Irradiance', 'LitArea'))
+
+
+def run_engine(engine, command, backend, workdir, table=None, update=False):
+    command_file = os.path.join(workdir, 'case.lcc')
+    results_file = os.path.join(workdir, 'case.lcr')
+    command.set('Expected .lcr Name', results_file)
+    with open(command_file, 'w') as f:
+        f.write(command.text())
+    if os.path.exists(results_file):
+        os.remove(results_file)
+
+    run = lambda args, **kwargs: subprocess.run([engine, command_file, '--headless'] + args, check=True,
+                                                stderr=subprocess.DEVNULL, **kwargs)
+    if backend is None:
+        run([], stdout=subprocess.DEVNULL)
+        return read_values(results_file)
+
+    if backend == 'lut':
+        table = os.path.join(workdir, 'case.lclt')
+        run(['--bake', table], stdout=subprocess.DEVNULL)
+        run(['--query', table, '--spot-check', '0'], stdout=subprocess.DEVNULL)
+        return read_values(results_file)
+
+    if backend == 'lut_query':
+        if update:
+            run(['--bake', table, '--lut-nside', str(LUT_QUERY_NSIDE)], stdout=subprocess.DEVNULL)
+        elif not os.path.exists(table):
+            raise RuntimeError('no table %s, record it with --update' % table)
+        run(['--query', table, '--spot-check', '0'], stdout=subprocess.DEVNULL)
+        values = read_values(results_file)
+
+        rows = [[float(c) for c in line.split()] for line in command.data]
+        binary_file = os.path.join(workdir, 'case.lccb')
+        binary_results = os.path.join(workdir, 'case_lccb.lcr')
+        write_lccb(binary_file, binary_results, command.get('Model File'), int(command.get('Instances')),
+                   int(command.get('Square Dimensions')), [row[:3] for row in rows], [row[3:6] for row in rows],
+                   frame_rate=int(command.get('Target Framerate')), dedup=command.get('Deduplicate') or 'Off',
+                   shadow_cache_mb=float(command.get('Shadow Cache MB') or 0))
+        subprocess.run([engine, binary_file, '--headless', '--query', table, '--spot-check', '0'], check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        mismatches = sum(a != b for a, b in zip(values, read_values(binary_results)))
+        if mismatches:
+            raise RuntimeError('the .lccb round trip differs from the .lcc at %d points' % mismatches)
+        return values
+
+    rows = [[float(c) for c in line.split()] for line in command.data]
+    values = [None] * len(rows)
+    if backend == 'pipe_text':
+        stdin = ''.join(' '.join('%.17g' % c for c in row) + '\n' for row in rows).encode()
+        output = run(['--pipe'], input=stdin, stdout=subprocess.PIPE).stdout.decode()
+        for line in output.splitlines():
+            fields = line.split()
+            if fields:
+                values[int(fields[0])] = float(fields[1])
+    else:
+        stdin = b''.join(struct.pack('<%dd' % len(row), *row) for row in rows)
+        output = run(['--pipe', '--binary'], input=stdin, stdout=subprocess.PIPE).stdout
+        layout = pipe_record_format(command)
+        record = struct.calcsize(layout)
+        for offset in range(0, len(output) - record + 1, record):
+            index, value = struct.unpack_from(layout, output, offset)[:2]
+            values[index] = value
+    if any(v is None for v in values):
+        raise RuntimeError('the pipe returned %d of %d points' % (sum(v is not None for v in values), len(values)))
+    return values
+
+
+def compare(result, golden, rtol, atol):
+    stats = {'points': len(golden), 'failures': 0, 'max_abs': 0.0, 'max_rel': 0.0, 'worst': []}
+    if len(result) != len(golden):
+        stats['error'] = '%d values, golden has %d' % (len(result), len(golden))
+        return stats
+    points = []
+    for i, (r, g) in enumerate(zip(result, golden)):
+        error = abs(r - g)
+        relative = error / abs(g) if g != 0 else (0.0 if error == 0 else math.inf)
+        if error > atol + rtol * abs(g):
+            stats['failures'] += 1
+        stats['max_abs'] = max(stats['max_abs'], error)
+        stats['max_rel'] = max(stats['max_rel'], relative)
+        points.append((error - atol - rtol * abs(g), i, g, r))
+    points.sort(reverse=True)
+    stats['worst'] = [{'index': i, 'golden': g, 'result': r} for _, i, g, r in points[:WORST_POINTS]]
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--engine', default='./LightCurveEngine')
+    parser.add_argument('--cases', nargs='+', default=['*'], help='fnmatch patterns on base/variant')
+    parser.add_argument('--update', action='store_true', help='record goldens from this build instead of checking')
+    parser.add_argument('--report', metavar='FILE', help='write per-case statistics and worst points as JSON')
+    args = parser.parse_args()
+
+    bases = load_bases()
+    report, failed = [], 0
+    with tempfile.TemporaryDirectory() as workdir:
+        for base, (command, base_golden) in sorted(bases.items()):
+            model = command.get('Model File')
+            if not model.startswith(PROCEDURAL_PREFIX) and not os.path.exists(os.path.join('models', model)):
+                print('%-32s SKIP     models/%s not found' % (base + '/*', model))
+                continue
+            for variant, (overrides, backend, golden_of, rtol, atol) in VARIANTS.items():
+                case = '%s/%s' % (base, variant)
+                if not any(fnmatch.fnmatch(case, pattern) for pattern in args.cases):
+                    continue
+                golden_file = golden_path(base, variant if golden_of == 'own' else 'default', base_golden)
+                if args.update and (golden_of != 'own' or golden_file == base_golden):
+                    continue                    # Backends check against the default; the checked-in reference stays
+                if not args.update and not os.path.exists(golden_file):
+                    print('%-32s FAIL     no golden %s, record it with --update' % (case, golden_file))
+                    report.append({'case': case, 'status': 'FAIL', 'error': 'no golden %s' % golden_file})
+                    failed += 1
+                    continue
+
+                variant_command = Command(command.text())
+                for key, value in dict(VARIANTS['default'][0], **overrides).items():
+                    variant_command.set(key, value)
+                if args.update:
+                    os.makedirs(GOLDEN_DIR, exist_ok=True)
+                try:
+                    result = run_engine(args.engine, variant_command, backend, workdir,
+                                        golden_path(base, variant, None, '.lclt'), args.update)
+                except (subprocess.CalledProcessError, RuntimeError, OSError, ValueError) as error:
+                    print('%-32s ERROR    %s' % (case, error))
+                    report.append({'case': case, 'status': 'ERROR', 'error': str(error)})
+                    failed += 1
+                    continue
+
+                if args.update:
+                    shutil.copyfile(os.path.join(workdir, 'case.lcr'), golden_file)
+                    print('%-32s UPDATED  %s (%d points)' % (case, golden_file, len(result)))
+                    continue
+
+                stats = compare(result, read_values(golden_file), rtol, atol)
+                status = 'FAIL' if stats['failures'] or 'error' in stats else 'PASS'
+                failed += status == 'FAIL'
+                print('%-32s %-8s %s' % (case, status, stats.get('error') or
+                      'max abs %.3g, max rel %.3g, %d of %d points beyond rtol %g atol %g' %
+                      (stats['max_abs'], stats['max_rel'], stats['failures'], stats['points'], rtol, atol)))
+                report.append(dict(stats, case=case, status=status, golden=golden_file, rtol=rtol, atol=atol))
+
+    if args.report:
+        with open(args.report, 'w') as f:
+            json.dump(report, f, indent=2)
+    if failed:
+        print('%d cases failed' % failed)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <raylib.h>
+
+//----------------------------------------------------------------------------------
+// Torque-free attitude propagation
+//
+// A command in the "Propagated" reference frame gives the body's attitude and angular velocity at one epoch, its
+// inertia tensor and a list of epochs with inertial sun and viewer vectors. The propagator integrates Euler's
+// equations, I dw/dt = (I w) x w, together with the attitude kinematics with a fixed-step RK4 and rotates each
+// batch into the body frame as it is queued, so the body-frame time series is never stored.
+//
+// The attitude q takes inertial vectors to body vectors like LC_FRAME_INERTIAL quaternions, v_body = q v q*. With
+// w the body rate that gives dq/dt = -1/2 (0, w) q.
+//----------------------------------------------------------------------------------
+#define LC_PROPAGATOR_STEP_ANGLE  0.02   // Default step: radians turned at the initial rate
+
+typedef struct {
+  const LightCurveCommand *command;
+  double state[7];                        // Attitude quaternion (w, x, y, z), then body rates (rad/s), at epoch
+  double epoch;
+  double inertia[3][3];                   // Body frame
+  double inverse_inertia[3][3];
+  double step;                            // Longest RK4 step in seconds, INFINITY for a body at rest
+  long steps;                             // Statistics for LogPropagatorStatistics()
+  double quaternions[4 * MAX_INSTANCES];  // Current batch: attitude per point
+  double sun_vectors[3 * MAX_INSTANCES];  // Current batch in the body frame, row-major like LightCurveCommand
+  double viewer_vectors[3 * MAX_INSTANCES];
+} LightCurvePropagator;
+
+bool InitPropagator(LightCurvePropagator *propagator, const LightCurveCommand *command);
+void PropagateAttitude(LightCurvePropagator *propagator, double epoch);
+void LCAttitudeDerivative(const LightCurvePropagator *propagator, const double state[7], double derivative[7]);
+void PropagateAttitudeBatch(LightCurvePropagator *propagator, int first, int count);
+bool MaterializePropagatedGeometry(LightCurveCommand *command);
+void LogPropagatorStatistics(const LightCurvePropagator *propagator);
+
+bool InitPropagator(LightCurvePropagator *propagator, const LightCurveCommand *command)
+{
+  memset(propagator, 0, sizeof(LightCurvePropagator));
+  propagator->command = command;
+  propagator->epoch = command->initial_epoch;
+
+  const double *I = command->inertia;     //Ixx, Iyy, Izz, Ixy, Ixz, Iyz
+  double m[3][3] = { { I[0], I[3], I[4] }, { I[3], I[1], I[5] }, { I[4], I[5], I[2] } };
+  memcpy(propagator->inertia, m, sizeof(m));
+
+  double cofactor[3][3];
+  for(int r = 0; r < 3; r++) {
+    for(int c = 0; c < 3; c++) {
+      int r1 = (r + 1) % 3, r2 = (r + 2) % 3, c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+      cofactor[r][c] = m[r1][c1]*m[r2][c2] - m[r1][c2]*m[r2][c1];
+    }
+  }
+  double determinant = m[0][0]*cofactor[0][0] + m[0][1]*cofactor[0][1] + m[0][2]*cofactor[0][2];
+  double minor = m[0][0]*m[1][1] - m[0][1]*m[1][0];
+  if(m[0][0] <= 0.0 || minor <= 0.0 || determinant <= 0.0) { //Sylvester's criterion
+    TraceLog(LOG_ERROR, "ATTITUDE: The inertia tensor is not positive definite");
+    return false;
+  }
+  for(int r = 0; r < 3; r++) {
+    for(int c = 0; c < 3; c++) propagator->inverse_inertia[r][c] = cofactor[c][r] / determinant; //Adjugate over determinant
+  }
+
+  const double *q = command->attitude;
+  double norm = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  if(norm == 0.0) {
+    TraceLog(LOG_ERROR, "ATTITUDE: \"Attitude Quaternion\" is zero");
+    return false;
+  }
+  for(int k = 0; k < 4; k++) propagator->state[k] = q[k] / norm;
+  memcpy(propagator->state + 4, command->angular_velocity, 3*sizeof(double));
+
+  const double *w = command->angular_velocity;
+  double rate = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+  if(command->integration_step > 0.0) propagator->step = command->integration_step;
+  else propagator->step = (rate > 0.0) ? LC_PROPAGATOR_STEP_ANGLE / rate : INFINITY;
+
+  TraceLog(LOG_INFO, "ATTITUDE: Propagating %d epochs from %g s, |w| %g rad/s, RK4 step %g s", command->data_points, command->initial_epoch, rate, propagator->step);
+  return true;
+}
+
+void LCAttitudeDerivative(const LightCurvePropagator *propagator, const double state[7], double derivative[7])
+{
+  const double *q = state;
+  const double *w = state + 4;
+
+  derivative[0] = 0.5*(w[0]*q[1] + w[1]*q[2] + w[2]*q[3]);  //-1/2 (0, w) q
+  derivative[1] = -0.5*(q[0]*w[0] + w[1]*q[3] - w[2]*q[2]);
+  derivative[2] = -0.5*(q[0]*w[1] + w[2]*q[1] - w[0]*q[3]);
+  derivative[3] = -0.5*(q[0]*w[2] + w[0]*q[2] - w[1]*q[1]);
+
+  double h[3];                            //Body angular momentum I w
+  for(int r = 0; r < 3; r++) h[r] = propagator->inertia[r][0]*w[0] + propagator->inertia[r][1]*w[1] + propagator->inertia[r][2]*w[2];
+  double torque[3] = { h[1]*w[2] - h[2]*w[1], h[2]*w[0] - h[0]*w[2], h[0]*w[1] - h[1]*w[0] }; //(I w) x w
+  for(int r = 0; r < 3; r++) derivative[4 + r] = propagator->inverse_inertia[r][0]*torque[0] + propagator->inverse_inertia[r][1]*torque[1] + propagator->inverse_inertia[r][2]*torque[2];
+}
+
+// Advances (or rewinds) the state to epoch in equal RK4 steps no longer than propagator->step. Sorted epochs
+// cost one pass over the interval in total.
+void PropagateAttitude(LightCurvePropagator *propagator, double epoch)
+{
+  double interval = epoch - propagator->epoch;
+  if(interval == 0.0) return;
+
+  double substeps = isinf(propagator->step) ? 1.0 : ceil(fabs(interval) / propagator->step);
+  long count = (long) substeps;
+  double h = interval / count;
+  double *y = propagator->state;
+
+  for(long s = 0; s < count; s++) {
+    double k1[7], k2[7], k3[7], k4[7], t[7];
+    LCAttitudeDerivative(propagator, y, k1);
+    for(int k = 0; k < 7; k++) t[k] = y[k] + 0.5*h*k1[k];
+    LCAttitudeDerivative(propagator, t, k2);
+    for(int k = 0; k < 7; k++) t[k] = y[k] + 0.5*h*k2[k];
+    LCAttitudeDerivative(propagator, t, k3);
+    for(int k = 0; k < 7; k++) t[k] = y[k] + h*k3[k];
+    LCAttitudeDerivative(propagator, t, k4);
+    for(int k = 0; k < 7; k++) y[k] += h/6.0*(k1[k] + 2.0*k2[k] + 2.0*k3[k] + k4[k]);
+
+    double norm = sqrt(y[0]*y[0] + y[1]*y[1] + y[2]*y[2] + y[3]*y[3]); //Keep the quaternion on the unit sphere
+    for(int k = 0; k < 4; k++) y[k] /= norm;
+  }
+
+  propagator->steps += count;
+  propagator->epoch = epoch;
+}
+
+// Body-frame sun and viewer vectors of data points [first, first + count) into propagator->sun_vectors/viewer_vectors
+void PropagateAttitudeBatch(LightCurvePropagator *propagator, int first, int count)
+{
+  const LightCurveCommand *command = propagator->command;
+
+  for(int i = 0; i < count; i++) {
+    PropagateAttitude(propagator, command->epochs[first + i]);
+    memcpy(propagator->quaternions + 4*i, propagator->state, 4*sizeof(double));
+
+    const double *sun = (command->inertial_sun_vectors) ? command->inertial_sun_vectors + 3*(first + i) : command->inertial_sun;
+    const double *viewer = (command->inertial_viewer_vectors) ? command->inertial_viewer_vectors + 3*(first + i) : command->inertial_viewer;
+    memcpy(propagator->sun_vectors + 3*i, sun, 3*sizeof(double));
+    memcpy(propagator->viewer_vectors + 3*i, viewer, 3*sizeof(double));
+  }
+  RotateInertialToBody(propagator->quaternions, propagator->sun_vectors, propagator->viewer_vectors, propagator->sun_vectors, propagator->viewer_vectors, count);
+}
+
+// Propagates every epoch up front and turns the command into an ObjectBody one, for the CPU paths (--query) that
+// read the whole geometry array instead of batches
+bool MaterializePropagatedGeometry(LightCurveCommand *command)
+{
+  size_t n = (size_t) command->data_points;
+  double *geometry = (double *) malloc(7*n*sizeof(double));   //Body sun, body viewer, epochs
+  LightCurvePropagator *propagator = (LightCurvePropagator *) malloc(sizeof(LightCurvePropagator));
+  if(geometry == NULL || propagator == NULL || !InitPropagator(propagator, command)) {
+    if(geometry == NULL || propagator == NULL) TraceLog(LOG_ERROR, "ATTITUDE: Could not allocate %zu propagated data points", n);
+    free(geometry);
+    free(propagator);
+    return false;
+  }
+
+  for(size_t first = 0; first < n; first += MAX_INSTANCES) {
+    int count = (n - first < MAX_INSTANCES) ? (int) (n - first) : MAX_INSTANCES;
+    PropagateAttitudeBatch(propagator, (int) first, count);
+    memcpy(geometry + 3*first, propagator->sun_vectors, 3*count*sizeof(double));
+    memcpy(geometry + 3*(n + first), propagator->viewer_vectors, 3*count*sizeof(double));
+  }
+  memcpy(geometry + 6*n, command->epochs, n*sizeof(double));
+  LogPropagatorStatistics(propagator);
+  free(propagator);
+
+  free(command->owned_data);              //Held the epochs and inertial vectors
+  command->owned_data = geometry;
+  command->sun_vectors = geometry;
+  command->viewer_vectors = geometry + 3*n;
+  command->epochs = geometry + 6*n;
+  command->inertial_sun_vectors = NULL;
+  command->inertial_viewer_vectors = NULL;
+  command->reference_frame = LC_FRAME_OBJECT_BODY;
+  return true;
+}
+
+void LogPropagatorStatistics(const LightCurvePropagator *propagator)
+{
+  if(propagator == NULL) return;
+  const double *w = propagator->state + 4;
+  TraceLog(LOG_INFO, "ATTITUDE: %ld RK4 steps, final epoch %g s, |w| %g rad/s", propagator->steps, propagator->epoch, sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]));
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <raylib.h>
+
+//----------------------------------------------------------------------------------
+// Geometry deduplication
+//
+// Each (sun, viewer) pair is reduced to a key -- signed zeros folded, and with reciprocity the lexicographically
+// smaller vector first -- and looked up here. Only the first point of every key is rendered, in its own
+// orientation; later ones take its final values (after any refinement) without touching the GPU.
+//
+// Reciprocity (the integral of (n.sun)(n.viewer) over the lit and visible surface does not change when sun and
+// viewer swap) only holds in the continuum: tile projection, shadow map resolution and shadow bias differ between
+// the two orders, so a swapped duplicate gets values within the rendering error, not identical ones. It is opt-in
+// for that reason, as is deduplication itself (the default is Off). The lit area channel is the viewer's projected
+// lit area, which is not reciprocal at all, so requesting it falls back to exact matching.
+//
+// The table starts small and doubles as geometries arrive. Once it holds LC_DEDUP_MAX_GEOMETRIES new geometries
+// render without being remembered.
+//----------------------------------------------------------------------------------
+#define LC_DEDUP_MAX_GEOMETRIES  (1 << 18)
+#define LC_DEDUP_MIN_GEOMETRIES  (1 << 10)
+
+typedef struct {
+  double sun[3];                          // Canonical geometry
+  double viewer[3];
+  int representative;                     // Data point being rendered for this geometry, -1 once values are final
+  int first_follower;                     // Data points waiting on the representative, chained by the refiner, -1: none
+  float values[LC_MAX_CHANNELS];
+} LCGeometryEntry;
+
+typedef struct {
+  int mode;                               // LC_DEDUP_*
+  int *slots;                             // Entry index per hash slot, -1: empty; twice the capacity, a power of two
+  LCGeometryEntry *entries;
+  int entry_count;
+  int capacity;
+  long points;                            // Statistics for LogGeometryStatistics()
+  long duplicates;
+  long swapped;
+} LightCurveGeometryTable;
+
+bool InitGeometryTable(LightCurveGeometryTable *table, int mode, unsigned int channel_mask);
+void UnloadGeometryTable(LightCurveGeometryTable *table);
+void CanonicalizeGeometry(LightCurveGeometryTable *table, const double sun[3], const double viewer[3], double key_sun[3], double key_viewer[3]);
+int FindGeometry(LightCurveGeometryTable *table, const double sun[3], const double viewer[3], bool *created);
+void LogGeometryStatistics(const LightCurveGeometryTable *table);
+int LCGeometrySlot(const LightCurveGeometryTable *table, const double sun[3], const double viewer[3]);
+bool LCGrowGeometryTable(LightCurveGeometryTable *table);
+
+bool InitGeometryTable(LightCurveGeometryTable *table, int mode, unsigned int channel_mask)
+{
+  memset(table, 0, sizeof(LightCurveGeometryTable));
+  table->mode = mode;
+  if(mode == LC_DEDUP_OFF) return true;
+
+  if(mode == LC_DEDUP_RECIPROCAL && (channel_mask & LC_CHANNEL_LIT_AREA)) {
+    TraceLog(LOG_INFO, "DEDUP: The lit area channel is not reciprocal, only identical geometries are merged");
+    table->mode = LC_DEDUP_EXACT;
+  }
+
+  if(!LCGrowGeometryTable(table)) {
+    TraceLog(LOG_WARNING, "DEDUP: Could not allocate the geometry table, deduplication is off");
+    UnloadGeometryTable(table);
+    return false;
+  }
+  return true;
+}
+
+void UnloadGeometryTable(LightCurveGeometryTable *table)
+{
+  free(table->slots);
+  free(table->entries);
+  table->slots = NULL;
+  table->entries = NULL;
+  table->capacity = 0;
+  table->mode = LC_DEDUP_OFF;
+}
+
+// The key a geometry is looked up by. With reciprocity both orders share one key; the point itself is still
+// rendered as given.
+void CanonicalizeGeometry(LightCurveGeometryTable *table, const double sun[3], const double viewer[3], double key_sun[3], double key_viewer[3])
+{
+  for(int k = 0; k < 3; k++) {
+    key_sun[k] = sun[k] + 0.0;            //-0.0 -> +0.0 so signed zeros match
+    key_viewer[k] = viewer[k] + 0.0;
+  }
+  table->points++;
+  if(table->mode != LC_DEDUP_RECIPROCAL) return;
+
+  int order = 0;
+  for(int k = 0; k < 3 && order == 0; k++) order = (key_sun[k] < key_viewer[k]) ? -1 : (key_sun[k] > key_viewer[k]) ? 1 : 0;
+  if(order <= 0) return;
+
+  for(int k = 0; k < 3; k++) {
+    double swap = key_sun[k];
+    key_sun[k] = key_viewer[k];
+    key_viewer[k] = swap;
+  }
+  table->swapped++;
+}
+
+// Entry of a geometry key, added with *created set if it is new. -1 when it is new and the table is full.
+int FindGeometry(LightCurveGeometryTable *table, const double sun[3], const double viewer[3], bool *created)
+{
+  *created = false;
+  int slot = LCGeometrySlot(table, sun, viewer);
+  if(table->slots[slot] != -1) {
+    table->duplicates++;
+    return table->slots[slot];
+  }
+
+  if(table->entry_count == table->capacity) {
+    if(!LCGrowGeometryTable(table)) return -1;
+    slot = LCGeometrySlot(table, sun, viewer);
+  }
+
+  int e = table->entry_count++;
+  table->slots[slot] = e;
+  memcpy(table->entries[e].sun, sun, 3*sizeof(double));
+  memcpy(table->entries[e].viewer, viewer, 3*sizeof(double));
+  table->entries[e].representative = -1;
+  table->entries[e].first_follower = -1;
+  *created = true;
+  return e;
+}
+
+void LogGeometryStatistics(const LightCurveGeometryTable *table)
+{
+  if(table->mode == LC_DEDUP_OFF || table->points == 0) return;
+  TraceLog(LOG_INFO, "DEDUP: %ld of %ld data points were duplicates and skipped rendering (%.1f%%), %ld keyed in swapped order",
+           table->duplicates, table->points, 100.0 * table->duplicates / table->points, table->swapped);
+  if(table->entry_count == LC_DEDUP_MAX_GEOMETRIES) TraceLog(LOG_INFO, "DEDUP: The table filled up, later geometries were not deduplicated");
+}
+
+// Slot holding the key, or the empty slot where it would go
+int LCGeometrySlot(const LightCurveGeometryTable *table, const double sun[3], const double viewer[3])
+{
+  uint64_t bits[6];
+  memcpy(bits, sun, 3*sizeof(double));
+  memcpy(bits + 3, viewer, 3*sizeof(double));
+  uint64_t hash = 14695981039346656037ull;
+  for(int k = 0; k < 6; k++) {
+    hash ^= bits[k];
+    hash *= 1099511628211ull;
+  }
+
+  int mask = 2*table->capacity - 1;
+  int slot = (int) (hash ^ (hash >> 32)) & mask;
+  while(table->slots[slot] != -1) {
+    const LCGeometryEntry *entry = &table->entries[table->slots[slot]];
+    if(memcmp(entry->sun, sun, 3*sizeof(double)) == 0 && memcmp(entry->viewer, viewer, 3*sizeof(double)) == 0) break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+bool LCGrowGeometryTable(LightCurveGeometryTable *table) //Doubles the capacity and rehashes, false when full or out of memory
+{
+  int capacity = (table->capacity == 0) ? LC_DEDUP_MIN_GEOMETRIES : 2*table->capacity;
+  if(capacity > LC_DEDUP_MAX_GEOMETRIES) return false;
+
+  LCGeometryEntry *entries = (LCGeometryEntry *) realloc(table->entries, capacity*sizeof(LCGeometryEntry));
+  if(entries == NULL) return false;
+  table->entries = entries;
+  int *slots = (int *) malloc(2*capacity*sizeof(int));
+  if(slots == NULL) return false;
+
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  memset(table->slots, 0xff, 2*capacity*sizeof(int)); //-1: empty slot
+  for(int e = 0; e < table->entry_count; e++) table->slots[LCGeometrySlot(table, table->entries[e].sun, table->entries[e].viewer)] = e;
+  return true;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+#include <raymath.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define LC_FRAMES_AVX
+#endif
+
+//----------------------------------------------------------------------------------
+// Frame packets
+//
+// The per-instance constants of a frame -- sun and viewer positions, tile offsets moved into each camera's plane,
+// the light and viewer MVPs and the biased shadow matrix -- only depend on the batch and the pass's grid, so they
+// are computed for the whole batch into a packet as soon as the batch is known, and the instance loop only uploads
+// uniforms and draws. This happens on the GL thread: the next batch is only decided once the current frame's
+// results are read back (refinement and deduplication feed into it), so another thread could not start on it any
+// earlier, and a full batch takes a few microseconds at most.
+//
+// The constants are computed in closed form rather than through MatrixLookAt(), MatrixOrtho() and two
+// MatrixMultiply() per camera: the MVP of an orthographic camera looking at its target is the look-at basis with
+// the tile offset added to its translation, each row scaled by the projection, and the bias only halves the first
+// three rows and adds 1/2 to their translation. The products raymath would form with its zero entries are skipped,
+// the rest is evaluated in the same order, so the matrices match CalculateMVPFromCamera() and
+// CalculateMVPBFromMVP() bit for bit (to a float ulp where the compiler fuses multiply-adds, e.g. -march=native).
+// Positions and offsets are stored one array per axis and the kernel runs across instances, 8 lanes at a time with
+// AVX. On x86 with GCC or clang the kernel is always compiled for AVX, without extra flags, and used when the CPU
+// reports it at run time; CPUs without it compute the same matrices through raymath one instance at a time. Other
+// targets run the kernel one lane wide.
+//
+// The light and viewer MVPs are stored column-major, as MatrixToFloatV() lays them out, so the whole batch goes to
+// the depth and lighting shaders as one vec4 array each. The shadow matrix stays a per-draw uniform: a cached map
+// brings its own, found while the frame draws.
+//----------------------------------------------------------------------------------
+#if defined(LC_FRAMES_AVX)
+  #define LC_FRAME_LANES         8
+  #define LC_FRAME_TARGET        __attribute__((target("avx")))
+  typedef __m256 LCLane;
+  #define LCLaneLoad(p)          _mm256_loadu_ps(p)
+  #define LCLaneStore(p, a)      _mm256_storeu_ps(p, a)
+  #define LCLaneSet(x)           _mm256_set1_ps(x)
+  #define LCLaneAdd(a, b)        _mm256_add_ps(a, b)
+  #define LCLaneSub(a, b)        _mm256_sub_ps(a, b)
+  #define LCLaneMul(a, b)        _mm256_mul_ps(a, b)
+  #define LCLaneDiv(a, b)        _mm256_div_ps(a, b)
+  #define LCLaneSqrt(a)          _mm256_sqrt_ps(a)
+  #define LCLaneNonZero(a)       _mm256_blendv_ps(a, _mm256_set1_ps(1.0f), _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_EQ_OQ))
+#else
+  #define LC_FRAME_LANES         1
+  #define LC_FRAME_TARGET
+  typedef float LCLane;
+  #define LCLaneLoad(p)          (*(p))
+  #define LCLaneStore(p, a)      (*(p) = (a))
+  #define LCLaneSet(x)           (x)
+  #define LCLaneAdd(a, b)        ((a) + (b))
+  #define LCLaneSub(a, b)        ((a) - (b))
+  #define LCLaneMul(a, b)        ((a) * (b))
+  #define LCLaneDiv(a, b)        ((a) / (b))
+  #define LCLaneSqrt(a)          sqrtf(a)
+  #define LCLaneNonZero(a)       (((a) == 0.0f) ? 1.0f : (a))
+#endif
+
+#define LC_FRAME_CAPACITY        ((MAX_INSTANCES + LC_FRAME_LANES - 1) / LC_FRAME_LANES * LC_FRAME_LANES) // Whole lane blocks
+
+typedef struct {
+  Vector3 sun;                            // Light camera position
+  Vector3 viewer;                         // Viewer camera position
+  Vector3 viewer_transform;               // Tile offset in the viewer camera's plane, the model's translation
+  Vector3 light_transform;                // Same tile in the light camera's plane
+  Matrix mvp_light_bias;                  // Light MVP taken to [0, 1] texture coordinates
+} LCInstanceConstants;
+
+typedef struct {
+  Camera viewer_camera;                   // Pass cameras; positions are set per instance from the batch
+  Camera light_camera;
+  int count;                              // Instances the batch fills
+  int grid_instances;                     // Tiles GenerateTranslations() lays out for the pass
+  float sun[3][LC_FRAME_CAPACITY];        // Batch positions, one array per axis; lanes past count are computed, never read
+  float viewer[3][LC_FRAME_CAPACITY];
+  LCInstanceConstants instances[MAX_INSTANCES];
+  float light_mvps[MAX_INSTANCES][16];    // Column-major, uniform vec4 light_mvps[4 * MAX_MODELS] of the depth shader
+  float viewer_mvps[MAX_INSTANCES][16];   // Same for viewer_mvps of the lighting shader
+} LCFramePacket;
+
+typedef struct {
+  LCLane mvp[16];                         // One instance per lane, in the memory order of raymath's Matrix (m0, m4, m8, m12, m1, ...)
+  LCLane bias[16];                        // CalculateMVPBFromMVP()
+  LCLane plane[3];                        // TransformOffsetToCameraPlane()
+} LCCameraLanes;
+
+void PrepareFramePacket(LCFramePacket *packet);
+void CalculateInstanceConstants(LCFramePacket *packet, float offsets[3][LC_FRAME_CAPACITY], int first);
+void LCCalculateCameraLanes(LCCameraLanes *lanes, Camera cam, float eye[3][LC_FRAME_CAPACITY], float offsets[3][LC_FRAME_CAPACITY], int first);
+void LCStoreMatrixLanes(float *matrix, size_t stride, LCLane rows[16], int count);
+void LCCalculateInstanceConstantsScalar(LCFramePacket *packet, Vector3 *offsets);
+bool LCFrameKernelSupported(void);
+
+void PrepareFramePacket(LCFramePacket *packet) //The instance loop's CPU work for the whole batch
+{
+  Vector3 mesh_offsets[MAX_INSTANCES];
+  GenerateTranslations(mesh_offsets, packet->viewer_camera, packet->grid_instances); //Depends on the pass's fovy only
+  if(!LCFrameKernelSupported()) {
+    LCCalculateInstanceConstantsScalar(packet, mesh_offsets);
+    return;
+  }
+
+  float offsets[3][LC_FRAME_CAPACITY] = { 0 };
+  for(int instance = 0; instance < packet->count; instance++) {
+    offsets[0][instance] = mesh_offsets[instance].x;
+    offsets[1][instance] = mesh_offsets[instance].y;
+    offsets[2][instance] = mesh_offsets[instance].z;
+  }
+
+  for(int first = 0; first < packet->count; first += LC_FRAME_LANES) CalculateInstanceConstants(packet, offsets, first);
+}
+
+LC_FRAME_TARGET void CalculateInstanceConstants(LCFramePacket *packet, float offsets[3][LC_FRAME_CAPACITY], int first) //One lane block of instances
+{
+  static const int column_major[16] = { 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 }; //Matrix field of m0, m1, m2, ...
+
+  LCCameraLanes light, viewer;
+  LCCalculateCameraLanes(&light, packet->light_camera, packet->sun, offsets, first);
+  LCCalculateCameraLanes(&viewer, packet->viewer_camera, packet->viewer, offsets, first);
+
+  int count = (packet->count - first < LC_FRAME_LANES) ? packet->count - first : LC_FRAME_LANES;
+  LCInstanceConstants *constants = &packet->instances[first];
+  LCLane light_columns[16], viewer_columns[16];
+  for(int k = 0; k < 16; k++) {
+    light_columns[k] = light.mvp[column_major[k]];
+    viewer_columns[k] = viewer.mvp[column_major[k]];
+  }
+  LCStoreMatrixLanes(&constants->mvp_light_bias.m0, sizeof(LCInstanceConstants), light.bias, count);
+  LCStoreMatrixLanes(packet->light_mvps[first], sizeof(packet->light_mvps[0]), light_columns, count);
+  LCStoreMatrixLanes(packet->viewer_mvps[first], sizeof(packet->viewer_mvps[0]), viewer_columns, count);
+
+  float planes[6][LC_FRAME_LANES];
+  for(int k = 0; k < 3; k++) {
+    LCLaneStore(planes[k], light.plane[k]);
+    LCLaneStore(planes[3 + k], viewer.plane[k]);
+  }
+  for(int lane = 0; lane < count; lane++) {
+    int instance = first + lane;
+    constants[lane].sun = (Vector3) { packet->sun[0][instance], packet->sun[1][instance], packet->sun[2][instance] };
+    constants[lane].viewer = (Vector3) { packet->viewer[0][instance], packet->viewer[1][instance], packet->viewer[2][instance] };
+    constants[lane].light_transform = (Vector3) { planes[0][lane], planes[1][lane], planes[2][lane] };
+    constants[lane].viewer_transform = (Vector3) { planes[3][lane], planes[4][lane], planes[5][lane] };
+  }
+}
+
+// MVP of cam placed at each eye, CalculateMVPFromCamera() in closed form, and the offsets in each camera's plane
+LC_FRAME_TARGET void LCCalculateCameraLanes(LCCameraLanes *lanes, Camera cam, float eye[3][LC_FRAME_CAPACITY], float offsets[3][LC_FRAME_CAPACITY], int first)
+{
+  float top;
+  float right;
+  CalculateRightAndTop(cam, &right, &top);
+  Matrix proj = MatrixOrtho(-right, right, -top, top, 0.01, 1000.0);
+
+  LCLane ex = LCLaneLoad(&eye[0][first]), ey = LCLaneLoad(&eye[1][first]), ez = LCLaneLoad(&eye[2][first]);
+  LCLane ox = LCLaneLoad(&offsets[0][first]), oy = LCLaneLoad(&offsets[1][first]), oz = LCLaneLoad(&offsets[2][first]);
+  LCLane ux = LCLaneSet(cam.up.x), uy = LCLaneSet(cam.up.y), uz = LCLaneSet(cam.up.z);
+  LCLane one = LCLaneSet(1.0f), zero = LCLaneSet(0.0f);
+
+  //Look-at basis, as MatrixLookAt()
+  LCLane zx = LCLaneSub(ex, LCLaneSet(cam.target.x)), zy = LCLaneSub(ey, LCLaneSet(cam.target.y)), zz = LCLaneSub(ez, LCLaneSet(cam.target.z));
+  LCLane inverse = LCLaneDiv(one, LCLaneNonZero(LCLaneSqrt(LCLaneAdd(LCLaneAdd(LCLaneMul(zx, zx), LCLaneMul(zy, zy)), LCLaneMul(zz, zz)))));
+  zx = LCLaneMul(zx, inverse); zy = LCLaneMul(zy, inverse); zz = LCLaneMul(zz, inverse);
+
+  LCLane xx = LCLaneSub(LCLaneMul(uy, zz), LCLaneMul(uz, zy));
+  LCLane xy = LCLaneSub(LCLaneMul(uz, zx), LCLaneMul(ux, zz));
+  LCLane xz = LCLaneSub(LCLaneMul(ux, zy), LCLaneMul(uy, zx));
+  inverse = LCLaneDiv(one, LCLaneNonZero(LCLaneSqrt(LCLaneAdd(LCLaneAdd(LCLaneMul(xx, xx), LCLaneMul(xy, xy)), LCLaneMul(xz, xz)))));
+  xx = LCLaneMul(xx, inverse); xy = LCLaneMul(xy, inverse); xz = LCLaneMul(xz, inverse);
+
+  LCLane yx = LCLaneSub(LCLaneMul(zy, xz), LCLaneMul(zz, xy));
+  LCLane yy = LCLaneSub(LCLaneMul(zz, xx), LCLaneMul(zx, xz));
+  LCLane yz = LCLaneSub(LCLaneMul(zx, xy), LCLaneMul(zy, xx));
+
+  //Translation of the look-at matrix plus the tile offset
+  LCLane tx = LCLaneSub(ox, LCLaneAdd(LCLaneAdd(LCLaneMul(xx, ex), LCLaneMul(xy, ey)), LCLaneMul(xz, ez)));
+  LCLane ty = LCLaneSub(oy, LCLaneAdd(LCLaneAdd(LCLaneMul(yx, ex), LCLaneMul(yy, ey)), LCLaneMul(yz, ez)));
+  LCLane tz = LCLaneSub(oz, LCLaneAdd(LCLaneAdd(LCLaneMul(zx, ex), LCLaneMul(zy, ey)), LCLaneMul(zz, ez)));
+
+  //Rows scaled by the orthographic projection
+  LCLane sx = LCLaneSet(proj.m0), sy = LCLaneSet(proj.m5), sz = LCLaneSet(proj.m10);
+  LCLane mvp[16] = { LCLaneMul(xx, sx), LCLaneMul(xy, sx), LCLaneMul(xz, sx), LCLaneMul(tx, sx),
+                     LCLaneMul(yx, sy), LCLaneMul(yy, sy), LCLaneMul(yz, sy), LCLaneMul(ty, sy),
+                     LCLaneMul(zx, sz), LCLaneMul(zy, sz), LCLaneMul(zz, sz), LCLaneAdd(LCLaneMul(tz, sz), LCLaneSet(proj.m14)),
+                     zero, zero, zero, one };
+  memcpy(lanes->mvp, mvp, sizeof(mvp));
+
+  //Bias: rows halved and their translations moved by 1/2, the last row kept
+  LCLane half = LCLaneSet(0.5f);
+  for(int k = 0; k < 16; k++) {
+    if(k >= 12) lanes->bias[k] = mvp[k];
+    else if(k % 4 == 3) lanes->bias[k] = LCLaneAdd(LCLaneMul(mvp[k], half), half);
+    else lanes->bias[k] = LCLaneMul(mvp[k], half);
+  }
+
+  //Offset in the plane normal to the camera position, as TransformOffsetToCameraPlane()
+  inverse = LCLaneDiv(one, LCLaneSqrt(LCLaneAdd(LCLaneAdd(LCLaneMul(ex, ex), LCLaneMul(ey, ey)), LCLaneMul(ez, ez))));
+  LCLane nx = LCLaneMul(ex, inverse), ny = LCLaneMul(ey, inverse), nz = LCLaneMul(ez, inverse);
+  LCLane bx = LCLaneSub(LCLaneMul(uy, nz), LCLaneMul(uz, ny));
+  LCLane by = LCLaneSub(LCLaneMul(uz, nx), LCLaneMul(ux, nz));
+  LCLane bz = LCLaneSub(LCLaneMul(ux, ny), LCLaneMul(uy, nx));
+  lanes->plane[0] = LCLaneAdd(LCLaneAdd(LCLaneMul(bx, ox), LCLaneMul(ux, oy)), LCLaneMul(nx, oz));
+  lanes->plane[1] = LCLaneAdd(LCLaneAdd(LCLaneMul(by, ox), LCLaneMul(uy, oy)), LCLaneMul(ny, oz));
+  lanes->plane[2] = LCLaneAdd(LCLaneAdd(LCLaneMul(bz, ox), LCLaneMul(uz, oy)), LCLaneMul(nz, oz));
+}
+
+// Transposes a lane block of 16-float matrices into the first count instances, stride bytes apart
+LC_FRAME_TARGET void LCStoreMatrixLanes(float *matrix, size_t stride, LCLane rows[16], int count)
+{
+#if defined(LC_FRAMES_AVX)
+  for(int half = 0; half < 2; half++) {                 //Two 8x8 transposes: matrix floats 0-7, then 8-15
+    LCLane *r = rows + 8 * half;
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 columns[8] = { _mm256_permute2f128_ps(u0, u4, 0x20), _mm256_permute2f128_ps(u1, u5, 0x20),
+                          _mm256_permute2f128_ps(u2, u6, 0x20), _mm256_permute2f128_ps(u3, u7, 0x20),
+                          _mm256_permute2f128_ps(u0, u4, 0x31), _mm256_permute2f128_ps(u1, u5, 0x31),
+                          _mm256_permute2f128_ps(u2, u6, 0x31), _mm256_permute2f128_ps(u3, u7, 0x31) };
+    for(int lane = 0; lane < count; lane++) _mm256_storeu_ps((float *) ((char *) matrix + lane * stride) + 8 * half, columns[lane]);
+  }
+#else
+  for(int lane = 0; lane < count; lane++) {             //A single lane
+    for(int k = 0; k < 16; k++) ((float *) ((char *) matrix + lane * stride))[k] = rows[k];
+  }
+#endif
+}
+
+// The kernel's results through raymath, for CPUs without AVX
+void LCCalculateInstanceConstantsScalar(LCFramePacket *packet, Vector3 *offsets)
+{
+  Camera light_camera = packet->light_camera, viewer_camera = packet->viewer_camera;
+  for(int instance = 0; instance < packet->count; instance++) {
+    LCInstanceConstants *constants = &packet->instances[instance];
+    constants->sun = (Vector3) { packet->sun[0][instance], packet->sun[1][instance], packet->sun[2][instance] };
+    constants->viewer = (Vector3) { packet->viewer[0][instance], packet->viewer[1][instance], packet->viewer[2][instance] };
+    light_camera.position = constants->sun;
+    viewer_camera.position = constants->viewer;
+    constants->light_transform = TransformOffsetToCameraPlane(light_camera, offsets[instance]);
+    constants->viewer_transform = TransformOffsetToCameraPlane(viewer_camera, offsets[instance]);
+
+    Matrix mvp_light = CalculateMVPFromCamera(light_camera, offsets[instance]);
+    Matrix mvp_viewer = CalculateMVPFromCamera(viewer_camera, offsets[instance]);
+    constants->mvp_light_bias = CalculateMVPBFromMVP(mvp_light);
+    memcpy(packet->light_mvps[instance], MatrixToFloatV(mvp_light).v, sizeof(packet->light_mvps[0]));
+    memcpy(packet->viewer_mvps[instance], MatrixToFloatV(mvp_viewer).v, sizeof(packet->viewer_mvps[0]));
+  }
+}
+
+bool LCFrameKernelSupported(void)
+{
+#if defined(LC_FRAMES_AVX)
+  static int supported = -1;                            //Checked once
+  if(supported < 0) supported = __builtin_cpu_supports("avx") ? 1 : 0;
+  return supported == 1;
+#else
+  return true;
+#endif
+}
@@ -0,0 +1,1084 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <raylib.h>
+#include <raymath.h>
+
+#if defined(_WIN32)
+  #define LC_NO_POSIX
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#ifndef MAX_FNAME_LENGTH
+  #define MAX_FNAME_LENGTH       100
+#endif
+#define LC_MAX_NUMBER_LENGTH     64     // Longest numeric token handed to the strtod fallback
+#define LC_PIPE_BUFFER_SIZE      (1 << 16)
+#define LC_PIPE_RECORD_SIZE      (6 * sizeof(double))   // Binary stdin record: sun xyz, viewer xyz
+#define LC_PIPE_INERTIAL_RECORD_SIZE (10 * sizeof(double)) // ... followed by attitude quaternion wxyz (Reference Frame Inertial)
+#define LC_PIPE_DEFAULT_FLUSH_MS 5                      // Longest a partial batch waits for more geometry
+
+//----------------------------------------------------------------------------------
+// Binary light curve command file (.lccb)
+//
+// Little-endian, laid out so the data arrays can be used straight out of a memory map:
+//   [0, 512)                 LCCBHeader (zero-padded)
+//   [512, 512 + 24N)         sun vectors, N x 3 float64 (x, y, z per data point)
+//   [.., + 24N)              viewer vectors, N x 3 float64
+//   [.., + 8N)               epochs, N float64 (only if LCCB_FLAG_EPOCHS is set)
+//   [.., + 32N)              attitude quaternions, N x 4 float64 (w, x, y, z; only if reference_frame is
+//                            LC_FRAME_INERTIAL, in which case the sun and viewer vectors are inertial)
+//----------------------------------------------------------------------------------
+#define LCCB_MAGIC               "LCCB"
+#define LCCB_VERSION             1
+#define LCCB_HEADER_SIZE         512
+#define LCCB_NAME_LENGTH         128    // Header field size; names themselves are limited to MAX_FNAME_LENGTH - 1 bytes
+#define LCCB_FLAG_EPOCHS         (1u << 0)
+
+#define LC_FRAME_OBJECT_BODY     0      // Sun and viewer vectors are given in the model's body frame
+#define LC_FRAME_INERTIAL        1      // Inertial vectors plus a per-point attitude quaternion, rotated on load
+#define LC_FRAME_PROPAGATED      2      // Inertial vectors per epoch, attitude integrated from initial conditions (text only)
+#define LC_FRAME_VECTOR_LENGTH   2.0    // Rotated vectors are rescaled to this distance, well inside the cameras' depth range
+
+#if defined(__GNUC__) || defined(__clang__)
+  typedef double LCDouble4 __attribute__((vector_size(32)));  // AVX / paired SSE2 through the compiler's vector extensions
+#endif
+
+//----------------------------------------------------------------------------------
+// Binary light curve results file (.lcrb)
+//
+//   [0, 64)                  LCRBHeader (zero-padded)
+//   [64, ..)                 one record per data point, in data point order: `channels` values of
+//                            `sample_size` bytes each, channel order following the LC_CHANNEL_* bits
+//
+// Records are appended as each frame finishes, so (file size - header_size) / record size is the
+// number of data points completed so far.
+//----------------------------------------------------------------------------------
+#define LCRB_MAGIC               "LCRB"
+#define LCRB_VERSION             1
+#define LCRB_HEADER_SIZE         64
+#define LC_RESULTS_BUFFER_SIZE   (1 << 16)
+
+#define LC_CHANNEL_IRRADIANCE    (1u << 0)   // Always written
+#define LC_CHANNEL_LIT_AREA      (1u << 1)   // Projected area that is both lit and visible
+#define LC_MAX_CHANNELS          2
+
+#define LC_SHADOW_DEFAULT_MB     0      // Shadow map cache budget when a text command file does not set one: off
+
+#define LC_DEDUP_OFF             0      // Render every data point
+#define LC_DEDUP_EXACT           1      // Render each distinct (sun, viewer) pair once
+#define LC_DEDUP_RECIPROCAL      2      // ... and treat (viewer, sun) as the same pair
+
+#define LC_TARGET_RGBA8          0      // Lighting through minify passes in 8-bit colour, the readback quantized to 1/255
+#define LC_TARGET_RGBA32F        1      // ... in float colour, read back unquantized
+#define LC_MAX_MSAA_SAMPLES      16     // Lighting pass samples per pixel, 0: single-sampled
+
+typedef struct {
+  char magic[4];                          // "LCRB"
+  uint32_t version;                       // LCRB_VERSION
+  uint32_t header_size;                   // Byte offset of the first record
+  uint32_t channel_count;
+  uint32_t channel_mask;                  // LC_CHANNEL_*
+  uint32_t sample_size;                   // 4 (float32) or 8 (float64)
+  uint64_t data_points;                   // Expected total, the file may hold fewer while being written
+} LCRBHeader;
+
+typedef struct {
+  char magic[4];                          // "LCCB"
+  uint32_t version;                       // LCCB_VERSION
+  uint32_t header_size;                   // Byte offset of the first data array
+  uint32_t flags;                         // LCCB_FLAG_*
+  int32_t instances;
+  int32_t square_dimensions;
+  int32_t frame_rate;
+  int32_t reference_frame;                // LC_FRAME_*
+  uint64_t data_points;
+  char model_file[LCCB_NAME_LENGTH];      // NUL-terminated
+  char results_file[LCCB_NAME_LENGTH];    // NUL-terminated
+  int32_t results_precision;              // 32 or 64 bit .lcrb samples, 0 selects 32
+  uint32_t results_channels;              // LC_CHANNEL_* mask, 0 selects irradiance only
+  float lod_tolerance;                    // Relative light curve error allowed from mesh simplification, 0 renders the full mesh
+  float refine_tolerance;                 // Estimated relative error that re-renders a point at a finer tile size, 0 disables
+  float shadow_cache_mb;                  // Shadow map cache budget, 0 disables
+  float shadow_cache_tolerance;           // Degrees between sun directions that may share a shadow map, 0: identical vectors only
+  uint32_t dedup_mode;                    // LC_DEDUP_*
+  uint32_t render_target;                 // LC_TARGET_*
+  uint32_t msaa_samples;                  // 0 (or 1): no multisampling
+} LCCBHeader;
+
+// Everything the renderer needs from a command file, independent of the on-disk format
+typedef struct {
+  char model_name[MAX_FNAME_LENGTH];
+  char results_file[MAX_FNAME_LENGTH];
+  int instances;
+  int screen_pixels;
+  int frame_rate;
+  int reference_frame;
+  int data_points;
+  int results_precision;                  // 32 or 64
+  unsigned int results_channels;          // LC_CHANNEL_* mask
+  float lod_tolerance;                    // 0: always the full-resolution mesh
+  float refine_tolerance;                 // 0: every point at the tile size "Square Dimensions" and "Instances" give
+  float shadow_cache_mb;                  // 0: render the depth pass for every point
+  float shadow_cache_tolerance;           // Degrees, 0: identical sun vectors only
+  int dedup_mode;                         // LC_DEDUP_*
+  int render_target;                      // LC_TARGET_*
+  int msaa_samples;                       // 0: single-sampled lighting pass
+  const double *sun_vectors;              // data_points x 3, row-major
+  const double *viewer_vectors;           // data_points x 3, row-major
+  const double *epochs;                   // data_points, NULL when the file carries none
+
+  // LC_FRAME_PROPAGATED: sun_vectors and viewer_vectors are NULL, a LightCurvePropagator generates them per batch
+  double attitude[4];                     // Inertial-to-body quaternion (w, x, y, z) at initial_epoch, as in LC_FRAME_INERTIAL
+  double angular_velocity[3];             // Body frame, rad/s, at initial_epoch
+  double inertia[6];                      // Body frame tensor entries Ixx, Iyy, Izz, Ixy, Ixz, Iyz
+  double initial_epoch;                   // Seconds, on the epochs' time scale
+  double integration_step;                // Seconds per RK4 step, 0: LC_PROPAGATOR_STEP_ANGLE at the initial rate
+  double inertial_sun[3];                 // Shared by every epoch when the data lines carry epochs only
+  double inertial_viewer[3];
+  const double *inertial_sun_vectors;     // data_points x 3, NULL: inertial_sun for every epoch
+  const double *inertial_viewer_vectors;
+
+  void *mapped_data;                      // Backing memory map (binary files)
+  size_t mapped_size;
+  double *owned_data;                     // Backing heap buffer (text files)
+} LightCurveCommand;
+
+// Incremental writer for .lcr (text) and .lcrb (binary) results, or indexed records on a pipe
+typedef struct {
+  FILE *file;
+  bool binary;
+  bool indexed;                           // Prefix each record with its data point index (pipe mode)
+  int sample_size;
+  int channel_count;
+  unsigned int channel_mask;
+  int points_written;
+  float *capture;                         // Non-NULL: results are stored here (points x channel_count) instead of written
+} LightCurveResultsWriter;
+
+// Geometry records arriving on a pipe (stdin), packed into instance batches
+typedef struct {
+  int fd;
+  bool binary;                            // 48 byte float64 records instead of text lines (80 bytes for inertial input)
+  int reference_frame;                    // LC_FRAME_*, inertial records carry a quaternion rotated away per batch
+  int flush_ms;                           // Deadline for a partial batch, measured from its first record
+  bool eof;
+  int line;                               // Text line counter for error messages
+  size_t start;                           // Unconsumed bytes are buffer[start, length)
+  size_t length;
+  char buffer[LC_PIPE_BUFFER_SIZE];
+  double sun_vectors[3 * MAX_INSTANCES];  // Current batch, row-major like LightCurveCommand
+  double viewer_vectors[3 * MAX_INSTANCES];
+  double quaternions[4 * MAX_INSTANCES];  // Attitude of each record in the batch (inertial input only)
+} LightCurveGeometryPipe;
+
+// Line-oriented cursor over a (not necessarily NUL-terminated) text buffer
+typedef struct {
+  const char *cur;
+  const char *end;
+  int line;                               // 1-based number of the line last returned
+  const char *filename;                   // For error messages
+} LCTextCursor;
+
+const void *MapFileReadOnly(const char *filename, size_t *size);
+void UnmapFile(const void *data, size_t size);
+bool LoadLightCurveCommand(const char *filename, LightCurveCommand *command);
+bool LoadLightCurveCommandBinary(const char *filename, LightCurveCommand *command);
+bool LoadLightCurveCommandText(const char *filename, LightCurveCommand *command, bool header_only);
+bool LoadLightCurveCommandHeader(const char *filename, LightCurveCommand *command);
+bool ParseLightCurveCommandText(const char *text, size_t size, const char *filename, LightCurveCommand *command, bool header_only);
+bool LCNextLine(LCTextCursor *cursor, const char **line, const char **line_end);
+const char *LCSkipSpace(const char *p, const char *end);
+bool LCMatchKey(const char *line, const char *line_end, const char *key, const char **value);
+bool LCParseDouble(const char **cursor, const char *end, double *value);
+bool LCParseInt(const char *p, const char *end, int *value);
+int LCParseDoubleList(const char *p, const char *end, double *values, int max_count);
+bool LCCopyValue(const char *p, const char *end, char *dst, int dst_size);
+bool LCParseChannels(const char *p, const char *end, unsigned int *channels);
+void UnloadLightCurveCommand(LightCurveCommand *command);
+bool OpenLightCurveResults(LightCurveResultsWriter *writer, const char *filename, int data_points, int precision, unsigned int channels);
+void OpenLightCurveResultsStream(LightCurveResultsWriter *writer, FILE *stream, bool binary, int precision, unsigned int channels);
+void OpenLightCurveResultsCapture(LightCurveResultsWriter *writer, float *values, unsigned int channels);
+void WriteLightCurveResultsBatch(LightCurveResultsWriter *writer, const float *values, int count);
+void CloseLightCurveResults(LightCurveResultsWriter *writer);
+void InitGeometryPipe(LightCurveGeometryPipe *pipe, int fd, bool binary, int flush_ms, int reference_frame);
+int ReadGeometryBatch(LightCurveGeometryPipe *pipe, int max_count);
+bool LCPipeTakeRecord(LightCurveGeometryPipe *pipe, int slot);
+double LCMonotonicMs(void);
+void TraceLogToStderr(int logLevel, const char *text, va_list args);
+Vector3 Vector3FromDoubles(const double *v);
+void RotateInertialToBody(const double *quaternions, const double *sun_in, const double *viewer_in, double *sun_out, double *viewer_out, int count);
+void LCRotateInertialPoint(const double *q, const double *sun_in, const double *viewer_in, double *sun_out, double *viewer_out);
+
+const void *MapFileReadOnly(const char *filename, size_t *size) //Maps a whole file into memory, returns NULL on failure
+{
+  *size = 0;
+#if defined(LC_NO_POSIX)
+  unsigned int bytes_read = 0;
+  unsigned char *data = LoadFileData(filename, &bytes_read);
+  *size = bytes_read;
+  return data;
+#else
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return NULL;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+
+  void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); //The mapping keeps its own reference to the file
+
+  if(data == MAP_FAILED) return NULL;
+  madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+  *size = (size_t) st.st_size;
+  return data;
+#endif
+}
+
+void UnmapFile(const void *data, size_t size)
+{
+  if(data == NULL) return;
+#if defined(LC_NO_POSIX)
+  UnloadFileData((unsigned char *) data);
+#else
+  munmap((void *) data, size);
+#endif
+}
+
+bool LoadLightCurveCommand(const char *filename, LightCurveCommand *command) //Dispatches on the file extension
+{
+  memset(command, 0, sizeof(LightCurveCommand));
+
+  if(IsFileExtension(filename, ".lccb")) return LoadLightCurveCommandBinary(filename, command);
+  return LoadLightCurveCommandText(filename, command, false);
+}
+
+bool LoadLightCurveCommandHeader(const char *filename, LightCurveCommand *command) //Job settings only, geometry comes from elsewhere (pipe mode)
+{
+  memset(command, 0, sizeof(LightCurveCommand));
+
+  if(IsFileExtension(filename, ".lccb")) return LoadLightCurveCommandBinary(filename, command);
+  return LoadLightCurveCommandText(filename, command, true);
+}
+
+bool LoadLightCurveCommandBinary(const char *filename, LightCurveCommand *command)
+{
+  size_t size;
+  const unsigned char *data = MapFileReadOnly(filename, &size);
+
+  if(data == NULL) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] Failed to open command file", filename);
+    return false;
+  }
+
+  LCCBHeader header;
+  if(size < LCCB_HEADER_SIZE) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] File is smaller than its header", filename);
+    UnmapFile(data, size);
+    return false;
+  }
+  memcpy(&header, data, sizeof(LCCBHeader));
+
+  if(memcmp(header.magic, LCCB_MAGIC, 4) != 0 || header.version != LCCB_VERSION || header.header_size < LCCB_HEADER_SIZE || header.header_size % 8 != 0) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] Not a version %d .lccb file", filename, LCCB_VERSION);
+    UnmapFile(data, size);
+    return false;
+  }
+
+  if(header.reference_frame != LC_FRAME_OBJECT_BODY && header.reference_frame != LC_FRAME_INERTIAL) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] Reference frame %d is not supported in .lccb files", filename, header.reference_frame);
+    UnmapFile(data, size);
+    return false;
+  }
+
+  uint64_t n = header.data_points;
+  uint64_t doubles_per_point = ((header.flags & LCCB_FLAG_EPOCHS) ? 7 : 6) + ((header.reference_frame == LC_FRAME_INERTIAL) ? 4 : 0);
+  if(n == 0 || n > INT32_MAX || header.instances < 1 || header.instances > MAX_INSTANCES || size < header.header_size + n * doubles_per_point * sizeof(double)) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] Header does not match file size (%llu data points)", filename, (unsigned long long) n);
+    UnmapFile(data, size);
+    return false;
+  }
+
+  size_t model_length = strnlen(header.model_file, LCCB_NAME_LENGTH);
+  size_t results_length = strnlen(header.results_file, LCCB_NAME_LENGTH);
+  if(model_length == 0 || model_length >= MAX_FNAME_LENGTH || results_length == 0 || results_length >= MAX_FNAME_LENGTH) {
+    TraceLog(LOG_ERROR, "LCCB: [%s] Model and results file names must be 1 to %d bytes", filename, MAX_FNAME_LENGTH - 1);
+    UnmapFile(data, size);
+    return false;
+  }
+  memcpy(command->model_name, header.model_file, model_length + 1);
+  memcpy(command->results_file, header.results_file, results_length + 1);
+
+  command->instances = header.instances;
+  command->screen_pixels = header.square_dimensions;
+  command->frame_rate = header.frame_rate;
+  command->reference_frame = header.reference_frame;
+  command->data_points = (int) n;
+  command->results_precision = (header.results_precision == 64) ? 64 : 32;
+  command->results_channels = header.results_channels | LC_CHANNEL_IRRADIANCE;
+  command->lod_tolerance = (header.lod_tolerance > 0.0f) ? header.lod_tolerance : 0.0f;
+  command->refine_tolerance = (header.refine_tolerance > 0.0f) ? header.refine_tolerance : 0.0f;
+  command->shadow_cache_mb = (header.shadow_cache_mb > 0.0f) ? header.shadow_cache_mb : 0.0f;
+  command->shadow_cache_tolerance = (header.shadow_cache_tolerance > 0.0f) ? header.shadow_cache_tolerance : 0.0f;
+  command->dedup_mode = (header.dedup_mode <= LC_DEDUP_RECIPROCAL) ? (int) header.dedup_mode : LC_DEDUP_OFF;
+  command->render_target = (header.render_target == LC_TARGET_RGBA32F) ? LC_TARGET_RGBA32F : LC_TARGET_RGBA8;
+  command->msaa_samples = (header.msaa_samples > 1 && header.msaa_samples <= LC_MAX_MSAA_SAMPLES) ? (int) header.msaa_samples : 0;
+
+  const double *arrays = (const double *) (data + header.header_size);
+  command->sun_vectors = arrays;
+  command->viewer_vectors = arrays + 3 * n;
+  command->epochs = (header.flags & LCCB_FLAG_EPOCHS) ? arrays + 6 * n : NULL;
+
+  command->mapped_data = (void *) data;
+  command->mapped_size = size;
+
+  if(header.reference_frame == LC_FRAME_INERTIAL) { //Body-frame copy of the vectors, epochs stay in the map
+    const double *quaternions = arrays + ((header.flags & LCCB_FLAG_EPOCHS) ? 7 : 6) * n;
+    command->owned_data = malloc(6 * n * sizeof(double));
+    if(command->owned_data == NULL) {
+      TraceLog(LOG_ERROR, "LCCB: [%s] Could not allocate %llu data points", filename, (unsigned long long) n);
+      UnloadLightCurveCommand(command);
+      return false;
+    }
+    RotateInertialToBody(quaternions, command->sun_vectors, command->viewer_vectors, command->owned_data, command->owned_data + 3 * n, (int) n);
+    command->sun_vectors = command->owned_data;
+    command->viewer_vectors = command->owned_data + 3 * n;
+  }
+
+  TraceLog(LOG_INFO, "LCCB: [%s] Mapped %d data points for model %s", filename, command->data_points, command->model_name);
+  return true;
+}
+
+bool LoadLightCurveCommandText(const char *filename, LightCurveCommand *command, bool header_only)
+{
+  size_t size;
+  const char *text = MapFileReadOnly(filename, &size);
+
+  if(text == NULL) {
+    TraceLog(LOG_ERROR, "LCC: [%s] Failed to open command file", filename);
+    return false;
+  }
+
+  bool success = ParseLightCurveCommandText(text, size, filename, command, header_only);
+  UnmapFile(text, size); //Everything the renderer needs has been copied out
+
+  if(success && header_only) TraceLog(LOG_INFO, "LCC: [%s] Parsed header for model %s", filename, command->model_name);
+  else if(success) TraceLog(LOG_INFO, "LCC: [%s] Parsed %d data points for model %s", filename, command->data_points, command->model_name);
+  return success;
+}
+
+// Single pass over the buffer. Header keys may come in any order and numbers may have any width or exponent
+// format; the only allocation is the output array sized from "Data Points". With header_only the data section
+// is not read and "Data Points" is optional.
+bool ParseLightCurveCommandText(const char *text, size_t size, const char *filename, LightCurveCommand *command, bool header_only)
+{
+  LCTextCursor cursor = { text, text + size, 0, filename };
+  const char *line, *line_end, *value;
+  bool in_header = false, in_data = false, in_skipped_section = false, seen_header = false;
+  int data_index = 0;
+  int values_per_point = 0;               //Numbers per data line, 0 until "Format" or "End header" picks the frame's default
+  const char *format_name = NULL;
+  int inertia_values = 0;
+  bool have_inertial_sun = false, have_inertial_viewer = false;
+  double epoch_step = 0.0;                //> 0: evenly spaced epochs, no data section
+
+  command->data_points = -1;
+  command->instances = -1;
+  command->screen_pixels = -1;
+  command->reference_frame = LC_FRAME_OBJECT_BODY;
+  command->results_precision = 32;
+  command->results_channels = LC_CHANNEL_IRRADIANCE;
+  command->lod_tolerance = 0.0f;
+  command->refine_tolerance = 0.0f;
+  command->shadow_cache_mb = LC_SHADOW_DEFAULT_MB;
+  command->shadow_cache_tolerance = 0.0f;
+  command->dedup_mode = LC_DEDUP_OFF;
+  command->attitude[0] = 1.0;
+
+  #define LC_FAIL(...) do { TraceLog(LOG_ERROR, __VA_ARGS__); free(command->owned_data); command->owned_data = NULL; return false; } while(0)
+
+  while(LCNextLine(&cursor, &line, &line_end)) {
+    line = LCSkipSpace(line, line_end);
+    while(line_end > line && isspace((unsigned char) line_end[-1])) line_end--;
+    if(line == line_end) continue;
+
+    if(in_data) {
+      if(LCMatchKey(line, line_end, "End data", &value)) {
+        in_data = false;
+        continue;
+      }
+      if(data_index == command->data_points) LC_FAIL("LCC: [%s:%d] More data lines than the %d declared in \"Data Points\"", filename, cursor.line, command->data_points);
+
+      size_t n = (size_t) command->data_points;
+      int epoch_values = (command->reference_frame == LC_FRAME_PROPAGATED) ? 1 : 0; //Epoch first, then any vectors
+      size_t vector_values = (values_per_point - epoch_values >= 6) ? 6 : 0;
+      double *sun = command->owned_data + 3 * data_index;
+      double *viewer = command->owned_data + 3 * (n + data_index);
+      double *epoch = command->owned_data + vector_values * n + data_index;     //Propagated frame only
+      double *quaternion = command->owned_data + 6 * n + 4 * data_index;       //Inertial frame only
+      const char *p = line;
+      for(int k = 0; k < values_per_point; k++) {
+        p = LCSkipSpace(p, line_end);
+        int j = k - epoch_values;
+        double *target = (j < 0) ? epoch : (j < 3) ? &sun[j] : (j < 6) ? &viewer[j - 3] : &quaternion[j - 6];
+        if(!LCParseDouble(&p, line_end, target)) LC_FAIL("LCC: [%s:%d] Expected %d numbers (%s), value %d is missing or malformed", filename, cursor.line, values_per_point, format_name, k + 1);
+      }
+      if(LCSkipSpace(p, line_end) != line_end) LC_FAIL("LCC: [%s:%d] Unexpected trailing text after %d values", filename, cursor.line, values_per_point);
+      data_index++;
+    }
+    else if(in_header) {
+      if(LCMatchKey(line, line_end, "End header", &value)) {
+        in_header = false;
+        if(command->model_name[0] == '\0') LC_FAIL("LCC: [%s] Header is missing \"Model File\"", filename);
+        if(command->results_file[0] == '\0') LC_FAIL("LCC: [%s] Header is missing \"Expected .lcr Name\"", filename);
+        if(command->instances < 1 || command->instances > MAX_INSTANCES) LC_FAIL("LCC: [%s] \"Instances\" must be set to 1..%d", filename, MAX_INSTANCES);
+        if(command->screen_pixels < 1) LC_FAIL("LCC: [%s] Header is missing \"Square Dimensions\"", filename);
+        if(values_per_point == 0) {
+          static const int default_values[] = { 6, 10, 1 };  //Indexed by LC_FRAME_*
+          static const char *default_formats[] = { "SunXYZViewerXYZ", "SunXYZViewerXYZQuatWXYZ", "Epoch" };
+          values_per_point = default_values[command->reference_frame];
+          format_name = default_formats[command->reference_frame];
+        }
+        bool format_matches = (command->reference_frame == LC_FRAME_OBJECT_BODY) ? values_per_point == 6 :
+                              (command->reference_frame == LC_FRAME_INERTIAL) ? values_per_point == 10 : (values_per_point == 1 || values_per_point == 7);
+        if(!format_matches) LC_FAIL("LCC: [%s] \"Format %s\" does not apply to this \"Reference Frame\"", filename, format_name);
+        if(command->reference_frame == LC_FRAME_PROPAGATED) {
+          if(inertia_values == 0) LC_FAIL("LCC: [%s] \"Reference Frame Propagated\" needs \"Inertia Tensor\"", filename);
+          if(values_per_point == 1 && !(have_inertial_sun && have_inertial_viewer)) LC_FAIL("LCC: [%s] \"Format Epoch\" needs \"Inertial Sun\" and \"Inertial Viewer\"", filename);
+          if(epoch_step > 0.0 && values_per_point != 1) LC_FAIL("LCC: [%s] \"Epoch Step\" replaces the data section and needs \"Format Epoch\"", filename);
+        }
+        else if(epoch_step > 0.0 || inertia_values > 0) {
+          TraceLog(LOG_WARNING, "LCC: [%s] Attitude propagation keys are ignored outside \"Reference Frame Propagated\"", filename);
+        }
+        if(header_only) return true;
+        if(command->data_points < 1) LC_FAIL("LCC: [%s] Header is missing \"Data Points\"", filename);
+        command->owned_data = malloc(values_per_point * (size_t) command->data_points * sizeof(double));
+        if(command->owned_data == NULL) LC_FAIL("LCC: [%s] Could not allocate %d data points", filename, command->data_points);
+        if(command->reference_frame == LC_FRAME_PROPAGATED && epoch_step > 0.0) {
+          for(int i = 0; i < command->data_points; i++) command->owned_data[i] = command->initial_epoch + i * epoch_step;
+          data_index = command->data_points;  //Any data lines are now surplus
+        }
+      }
+      else if(LCMatchKey(line, line_end, "Model File", &value)) {
+        if(!LCCopyValue(value, line_end, command->model_name, MAX_FNAME_LENGTH)) LC_FAIL("LCC: [%s:%d] Model file name is empty or too long", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Expected .lcr Name", &value)) {
+        if(!LCCopyValue(value, line_end, command->results_file, MAX_FNAME_LENGTH)) LC_FAIL("LCC: [%s:%d] Results file name is empty or too long", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Instances", &value)) {
+        if(!LCParseInt(value, line_end, &command->instances)) LC_FAIL("LCC: [%s:%d] \"Instances\" expects an integer", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Square Dimensions", &value)) {
+        if(!LCParseInt(value, line_end, &command->screen_pixels)) LC_FAIL("LCC: [%s:%d] \"Square Dimensions\" expects an integer", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Data Points", &value)) {
+        if(!LCParseInt(value, line_end, &command->data_points)) LC_FAIL("LCC: [%s:%d] \"Data Points\" expects an integer", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Target Framerate", &value)) {
+        if(!LCParseInt(value, line_end, &command->frame_rate)) LC_FAIL("LCC: [%s:%d] \"Target Framerate\" expects an integer", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Output Precision", &value)) {
+        if(!LCParseInt(value, line_end, &command->results_precision) || (command->results_precision != 32 && command->results_precision != 64)) LC_FAIL("LCC: [%s:%d] \"Output Precision\" must be 32 or 64", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Output Channels", &value)) {
+        if(!LCParseChannels(value, line_end, &command->results_channels)) LC_FAIL("LCC: [%s:%d] \"Output Channels\" expects a list of Irradiance, LitArea", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "LOD Tolerance", &value)) {
+        double tolerance;
+        if(!LCParseDouble(&value, line_end, &tolerance) || LCSkipSpace(value, line_end) != line_end || tolerance < 0.0) LC_FAIL("LCC: [%s:%d] \"LOD Tolerance\" expects a non-negative number", filename, cursor.line);
+        command->lod_tolerance = (float) tolerance;
+      }
+      else if(LCMatchKey(line, line_end, "Refine Tolerance", &value)) {
+        double tolerance;
+        if(!LCParseDouble(&value, line_end, &tolerance) || LCSkipSpace(value, line_end) != line_end || tolerance < 0.0) LC_FAIL("LCC: [%s:%d] \"Refine Tolerance\" expects a non-negative number", filename, cursor.line);
+        command->refine_tolerance = (float) tolerance;
+      }
+      else if(LCMatchKey(line, line_end, "Shadow Cache MB", &value)) {
+        double budget;
+        if(!LCParseDouble(&value, line_end, &budget) || LCSkipSpace(value, line_end) != line_end || budget < 0.0) LC_FAIL("LCC: [%s:%d] \"Shadow Cache MB\" expects a non-negative number", filename, cursor.line);
+        command->shadow_cache_mb = (float) budget;
+      }
+      else if(LCMatchKey(line, line_end, "Shadow Cache Tolerance", &value)) {
+        double tolerance;
+        if(!LCParseDouble(&value, line_end, &tolerance) || LCSkipSpace(value, line_end) != line_end || tolerance < 0.0) LC_FAIL("LCC: [%s:%d] \"Shadow Cache Tolerance\" expects a non-negative angle in degrees", filename, cursor.line);
+        command->shadow_cache_tolerance = (float) tolerance;
+      }
+      else if(LCMatchKey(line, line_end, "Deduplicate", &value)) {
+        const char *rest;
+        if(LCMatchKey(value, line_end, "Off", &rest) && rest == line_end) command->dedup_mode = LC_DEDUP_OFF;
+        else if(LCMatchKey(value, line_end, "Exact", &rest) && rest == line_end) command->dedup_mode = LC_DEDUP_EXACT;
+        else if(LCMatchKey(value, line_end, "Reciprocal", &rest) && rest == line_end) command->dedup_mode = LC_DEDUP_RECIPROCAL;
+        else LC_FAIL("LCC: [%s:%d] \"Deduplicate\" expects Off, Exact or Reciprocal", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Render Target", &value)) {
+        const char *rest;
+        if(LCMatchKey(value, line_end, "RGBA8", &rest) && rest == line_end) command->render_target = LC_TARGET_RGBA8;
+        else if(LCMatchKey(value, line_end, "RGBA32F", &rest) && rest == line_end) command->render_target = LC_TARGET_RGBA32F;
+        else LC_FAIL("LCC: [%s:%d] \"Render Target\" expects RGBA8 or RGBA32F", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "MSAA Samples", &value)) {
+        int samples;
+        if(!LCParseInt(value, line_end, &samples) || samples < 0 || samples > LC_MAX_MSAA_SAMPLES) LC_FAIL("LCC: [%s:%d] \"MSAA Samples\" expects an integer from 0 to %d", filename, cursor.line, LC_MAX_MSAA_SAMPLES);
+        command->msaa_samples = (samples > 1) ? samples : 0;
+      }
+      else if(LCMatchKey(line, line_end, "Format", &value)) {
+        const char *rest;
+        static const char *formats[] = { "SunXYZViewerXYZ", "SunXYZViewerXYZQuatWXYZ", "Epoch", "EpochSunXYZViewerXYZ" };
+        static const int format_values[] = { 6, 10, 1, 7 };
+        values_per_point = 0;
+        for(int f = 0; f < 4 && values_per_point == 0; f++) {
+          if(LCMatchKey(value, line_end, formats[f], &rest) && rest == line_end) {
+            values_per_point = format_values[f];
+            format_name = formats[f];
+          }
+        }
+        if(values_per_point == 0) LC_FAIL("LCC: [%s:%d] Unsupported data format (expected SunXYZViewerXYZ, SunXYZViewerXYZQuatWXYZ, Epoch or EpochSunXYZViewerXYZ)", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Reference Frame", &value)) {
+        const char *rest;
+        if(LCMatchKey(value, line_end, "ObjectBody", &rest) && rest == line_end) command->reference_frame = LC_FRAME_OBJECT_BODY;
+        else if(LCMatchKey(value, line_end, "Inertial", &rest) && rest == line_end) command->reference_frame = LC_FRAME_INERTIAL;
+        else if(LCMatchKey(value, line_end, "Propagated", &rest) && rest == line_end) command->reference_frame = LC_FRAME_PROPAGATED;
+        else LC_FAIL("LCC: [%s:%d] Unsupported reference frame (expected ObjectBody, Inertial or Propagated)", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Attitude Quaternion", &value)) {
+        if(LCParseDoubleList(value, line_end, command->attitude, 4) != 4) LC_FAIL("LCC: [%s:%d] \"Attitude Quaternion\" expects 4 numbers (w x y z)", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Angular Velocity", &value)) {
+        if(LCParseDoubleList(value, line_end, command->angular_velocity, 3) != 3) LC_FAIL("LCC: [%s:%d] \"Angular Velocity\" expects 3 numbers (body frame, rad/s)", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Inertia Tensor", &value)) {
+        inertia_values = LCParseDoubleList(value, line_end, command->inertia, 6);
+        if(inertia_values != 3 && inertia_values != 6) LC_FAIL("LCC: [%s:%d] \"Inertia Tensor\" expects Ixx Iyy Izz [Ixy Ixz Iyz]", filename, cursor.line);
+        if(inertia_values == 3) command->inertia[3] = command->inertia[4] = command->inertia[5] = 0.0;
+      }
+      else if(LCMatchKey(line, line_end, "Initial Epoch", &value)) {
+        if(LCParseDoubleList(value, line_end, &command->initial_epoch, 1) != 1) LC_FAIL("LCC: [%s:%d] \"Initial Epoch\" expects a number of seconds", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Epoch Step", &value)) {
+        if(LCParseDoubleList(value, line_end, &epoch_step, 1) != 1 || epoch_step <= 0.0) LC_FAIL("LCC: [%s:%d] \"Epoch Step\" expects a positive number of seconds", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Integration Step", &value)) {
+        if(LCParseDoubleList(value, line_end, &command->integration_step, 1) != 1 || command->integration_step < 0.0) LC_FAIL("LCC: [%s:%d] \"Integration Step\" expects a non-negative number of seconds", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Inertial Sun", &value)) {
+        have_inertial_sun = LCParseDoubleList(value, line_end, command->inertial_sun, 3) == 3;
+        if(!have_inertial_sun) LC_FAIL("LCC: [%s:%d] \"Inertial Sun\" expects 3 numbers", filename, cursor.line);
+      }
+      else if(LCMatchKey(line, line_end, "Inertial Viewer", &value)) {
+        have_inertial_viewer = LCParseDoubleList(value, line_end, command->inertial_viewer, 3) == 3;
+        if(!have_inertial_viewer) LC_FAIL("LCC: [%s:%d] \"Inertial Viewer\" expects 3 numbers", filename, cursor.line);
+      }
+      else {
+        TraceLog(LOG_WARNING, "LCC: [%s:%d] Unknown header key ignored: %.*s", filename, cursor.line, (int) (line_end - line), line);
+      }
+    }
+    else if(in_skipped_section) {
+      if(LCMatchKey(line, line_end, "End", &value)) in_skipped_section = false;
+    }
+    else if(LCMatchKey(line, line_end, "Begin header", &value)) {
+      in_header = true;
+      seen_header = true;
+    }
+    else if(LCMatchKey(line, line_end, "Begin data", &value)) {
+      if(!seen_header || in_header) LC_FAIL("LCC: [%s:%d] \"Begin data\" before a complete header", filename, cursor.line);
+      in_data = true;
+    }
+    else if(LCMatchKey(line, line_end, "Begin", &value)) {
+      in_skipped_section = true; //Sections the engine does not consume (e.g. model augmentation)
+    }
+  }
+
+  if(in_header || !seen_header) LC_FAIL("LCC: [%s] Missing \"Begin header\"/\"End header\" block", filename);
+  if(data_index != command->data_points) LC_FAIL("LCC: [%s:%d] Found %d data lines, header declares %d", filename, cursor.line, data_index, command->data_points);
+
+  #undef LC_FAIL
+
+  if(command->reference_frame == LC_FRAME_INERTIAL) { //Rotate in place, then drop the quaternions
+    size_t n = (size_t) command->data_points;
+    RotateInertialToBody(command->owned_data + 6 * n, command->owned_data, command->owned_data + 3 * n, command->owned_data, command->owned_data + 3 * n, command->data_points);
+    double *shrunk = realloc(command->owned_data, 6 * n * sizeof(double));
+    if(shrunk != NULL) command->owned_data = shrunk;
+  }
+
+  if(command->reference_frame == LC_FRAME_PROPAGATED) { //Inertial vectors (if any) first, then the epochs
+    size_t n = (size_t) command->data_points;
+    bool per_epoch_vectors = values_per_point == 7;
+    command->inertial_sun_vectors = (per_epoch_vectors) ? command->owned_data : NULL;
+    command->inertial_viewer_vectors = (per_epoch_vectors) ? command->owned_data + 3 * n : NULL;
+    command->epochs = command->owned_data + ((per_epoch_vectors) ? 6 * n : 0);
+    return true;
+  }
+
+  command->sun_vectors = command->owned_data;
+  command->viewer_vectors = command->owned_data + 3 * (size_t) command->data_points;
+  return true;
+}
+
+bool LCNextLine(LCTextCursor *cursor, const char **line, const char **line_end) //Returns the next line without its terminator
+{
+  if(cursor->cur >= cursor->end) return false;
+
+  const char *newline = memchr(cursor->cur, '\n', cursor->end - cursor->cur);
+  *line = cursor->cur;
+  *line_end = newline ? newline : cursor->end;
+  cursor->cur = newline ? newline + 1 : cursor->end;
+  cursor->line++;
+  return true;
+}
+
+const char *LCSkipSpace(const char *p, const char *end)
+{
+  while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == ',')) p++;
+  return p;
+}
+
+bool LCMatchKey(const char *line, const char *line_end, const char *key, const char **value) //Key must be followed by whitespace or the end of the line
+{
+  size_t length = strlen(key);
+  if((size_t) (line_end - line) < length || memcmp(line, key, length) != 0) return false;
+  if(line + length < line_end && !isspace((unsigned char) line[length])) return false;
+
+  *value = LCSkipSpace(line + length, line_end);
+  return true;
+}
+
+bool LCParseDouble(const char **cursor, const char *end, double *value) //strtod-equivalent without NUL termination or allocation
+{
+  static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  const char *start = *cursor;
+  const char *p = start;
+  bool negative = false;
+  bool truncated = false;
+  bool any_digits = false;
+  uint64_t mantissa = 0;
+  int significant_digits = 0;
+  int exponent = 0;
+
+  if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+  for(; p < end && *p >= '0' && *p <= '9'; p++) {
+    any_digits = true;
+    if(significant_digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+      if(mantissa != 0) significant_digits++;
+    }
+    else {
+      exponent++;
+      truncated = true;
+    }
+  }
+
+  if(p < end && *p == '.') {
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      any_digits = true;
+      if(significant_digits < 19) {
+        mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+        if(mantissa != 0) significant_digits++;
+        exponent--;
+      }
+      else truncated = true;
+    }
+  }
+
+  if(!any_digits) return false;
+
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool exponent_negative = false;
+    int explicit_exponent = 0;
+    if(p < end && (*p == '-' || *p == '+')) exponent_negative = (*p++ == '-');
+    if(p >= end || *p < '0' || *p > '9') return false;
+    for(; p < end && *p >= '0' && *p <= '9'; p++) {
+      if(explicit_exponent < 100000) explicit_exponent = explicit_exponent * 10 + (*p - '0');
+    }
+    exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+  }
+
+  if(p < end && !isspace((unsigned char) *p) && *p != ',') return false; //e.g. "1.5abc"
+
+  if(!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+    //Both operands are exact doubles, so a single multiply/divide is correctly rounded
+    double result = (double) mantissa;
+    result = (exponent < 0) ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+    *value = negative ? -result : result;
+  }
+  else {
+    char buffer[LC_MAX_NUMBER_LENGTH];
+    size_t length = (size_t) (p - start);
+    if(length >= LC_MAX_NUMBER_LENGTH) return false;
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    *value = strtod(buffer, NULL);
+  }
+
+  *cursor = p;
+  return true;
+}
+
+bool LCParseInt(const char *p, const char *end, int *value)
+{
+  double parsed;
+  if(!LCParseDouble(&p, end, &parsed) || LCSkipSpace(p, end) != end) return false;
+  if(parsed != (double) (int) parsed) return false;
+
+  *value = (int) parsed;
+  return true;
+}
+
+int LCParseDoubleList(const char *p, const char *end, double *values, int max_count) //Whitespace-separated numbers, -1 if malformed or too many
+{
+  int count = 0;
+  for(p = LCSkipSpace(p, end); p < end; p = LCSkipSpace(p, end)) {
+    if(count == max_count || !LCParseDouble(&p, end, &values[count])) return -1;
+    count++;
+  }
+  return count;
+}
+
+bool LCCopyValue(const char *p, const char *end, char *dst, int dst_size) //Copies a trimmed header value
+{
+  while(end > p && isspace((unsigned char) end[-1])) end--;
+  int length = (int) (end - p);
+  if(length == 0 || length >= dst_size) return false;
+
+  memcpy(dst, p, length);
+  dst[length] = '\0';
+  return true;
+}
+
+bool LCParseChannels(const char *p, const char *end, unsigned int *channels) //Space-separated channel names
+{
+  const char *rest;
+  *channels = LC_CHANNEL_IRRADIANCE;
+
+  for(p = LCSkipSpace(p, end); p < end; p = LCSkipSpace(rest, end)) {
+    if(LCMatchKey(p, end, "Irradiance", &rest)) *channels |= LC_CHANNEL_IRRADIANCE;
+    else if(LCMatchKey(p, end, "LitArea", &rest)) *channels |= LC_CHANNEL_LIT_AREA;
+    else return false;
+  }
+  return true;
+}
+
+void UnloadLightCurveCommand(LightCurveCommand *command)
+{
+  UnmapFile(command->mapped_data, command->mapped_size);
+  free(command->owned_data);
+  memset(command, 0, sizeof(LightCurveCommand));
+}
+
+Vector3 Vector3FromDoubles(const double *v) //Reads one row of a row-major float64 vector array
+{
+  return (Vector3) { (float) v[0], (float) v[1], (float) v[2] };
+}
+
+bool OpenLightCurveResults(LightCurveResultsWriter *writer, const char *filename, int data_points, int precision, unsigned int channels) //Truncates any previous results
+{
+  bool binary = IsFileExtension(filename, ".lcrb");
+  FILE *file = fopen(filename, binary ? "wb" : "w");
+  if(file == NULL) {
+    TraceLog(LOG_ERROR, "LCR: [%s] Failed to open results file", filename);
+    return false;
+  }
+  OpenLightCurveResultsStream(writer, file, binary, precision, channels);
+  writer->indexed = false;
+
+  if(writer->binary) {
+    unsigned char header_bytes[LCRB_HEADER_SIZE] = { 0 };
+    LCRBHeader header = { { 'L', 'C', 'R', 'B' }, LCRB_VERSION, LCRB_HEADER_SIZE, (uint32_t) writer->channel_count,
+      writer->channel_mask, (uint32_t) writer->sample_size, (uint64_t) data_points };
+    memcpy(header_bytes, &header, sizeof(LCRBHeader));
+    fwrite(header_bytes, 1, LCRB_HEADER_SIZE, writer->file);
+  }
+  fflush(writer->file);
+  return true;
+}
+
+// Pipe mode: no file header, every record is prefixed by its data point index
+// (text: "index value...", binary: uint64 index followed by the samples)
+void OpenLightCurveResultsStream(LightCurveResultsWriter *writer, FILE *stream, bool binary, int precision, unsigned int channels)
+{
+  memset(writer, 0, sizeof(LightCurveResultsWriter));
+  writer->file = stream;
+  writer->binary = binary;
+  writer->indexed = true;
+  writer->sample_size = (precision == 64) ? 8 : 4;
+  writer->channel_mask = channels | LC_CHANNEL_IRRADIANCE;
+  for(unsigned int bits = writer->channel_mask; bits != 0; bits &= bits - 1) writer->channel_count++;
+
+  setvbuf(writer->file, NULL, _IOFBF, LC_RESULTS_BUFFER_SIZE);
+}
+
+// Results kept in memory for the caller (LUT bakes, spot checks), values must hold every data point
+void OpenLightCurveResultsCapture(LightCurveResultsWriter *writer, float *values, unsigned int channels)
+{
+  memset(writer, 0, sizeof(LightCurveResultsWriter));
+  writer->capture = values;
+  writer->sample_size = 4;
+  writer->channel_mask = channels | LC_CHANNEL_IRRADIANCE;
+  for(unsigned int bits = writer->channel_mask; bits != 0; bits &= bits - 1) writer->channel_count++;
+}
+
+void WriteLightCurveResultsBatch(LightCurveResultsWriter *writer, const float *values, int count) //values is count x channel_count, flushed once per batch
+{
+  if(writer->capture != NULL) {
+    memcpy(writer->capture + (size_t) writer->points_written * writer->channel_count, values, (size_t) count * writer->channel_count * sizeof(float));
+    writer->points_written += count;
+    return;
+  }
+
+  if(writer->binary && writer->indexed) {
+    for(int i = 0; i < count; i++) {
+      uint64_t index = (uint64_t) (writer->points_written + i);
+      fwrite(&index, sizeof(uint64_t), 1, writer->file);
+      for(int c = 0; c < writer->channel_count; c++) {
+        float sample32 = values[i * writer->channel_count + c];
+        double sample64 = sample32;
+        fwrite((writer->sample_size == 4) ? (void *) &sample32 : (void *) &sample64, writer->sample_size, 1, writer->file);
+      }
+    }
+  }
+  else if(writer->binary) {
+    if(writer->sample_size == 4) {
+      fwrite(values, sizeof(float), (size_t) count * writer->channel_count, writer->file);
+    }
+    else {
+      for(int i = 0; i < count * writer->channel_count; i++) {
+        double sample = values[i];
+        fwrite(&sample, sizeof(double), 1, writer->file);
+      }
+    }
+  }
+  else {
+    for(int i = 0; i < count; i++) {
+      if(writer->indexed) fprintf(writer->file, "%d ", writer->points_written + i);
+      for(int c = 0; c < writer->channel_count; c++) {
+        fprintf(writer->file, (c + 1 < writer->channel_count) ? "%.9g " : "%.9g\n", values[i * writer->channel_count + c]);
+      }
+    }
+  }
+
+  fflush(writer->file); //Readers (and a crash) see every completed batch
+  writer->points_written += count;
+}
+
+void CloseLightCurveResults(LightCurveResultsWriter *writer)
+{
+  if(writer->indexed) fflush(writer->file); //Pipe streams are not ours to close
+  else if(writer->file != NULL) fclose(writer->file);
+  writer->file = NULL;
+}
+
+void InitGeometryPipe(LightCurveGeometryPipe *pipe, int fd, bool binary, int flush_ms, int reference_frame)
+{
+  memset(pipe, 0, sizeof(LightCurveGeometryPipe));
+  pipe->fd = fd;
+  pipe->binary = binary;
+  pipe->flush_ms = flush_ms;
+  pipe->reference_frame = reference_frame;
+}
+
+// Blocks until the first record of a batch arrives, then keeps packing records until the batch is full,
+// the flush deadline passes or the stream ends. Returns the number of records in the batch, 0 at end of stream.
+int ReadGeometryBatch(LightCurveGeometryPipe *pipe, int max_count)
+{
+#if defined(LC_NO_POSIX)
+  TraceLog(LOG_ERROR, "PIPE: Pipe mode is not supported on this platform");
+  return 0;
+#else
+  int count = 0;
+  double deadline = 0.0;
+
+  while(count < max_count) {
+    if(LCPipeTakeRecord(pipe, count)) {
+      if(count++ == 0) deadline = LCMonotonicMs() + pipe->flush_ms;
+      continue;
+    }
+    if(pipe->eof) break;
+
+    int timeout = -1;
+    if(count > 0) {
+      double remaining = deadline - LCMonotonicMs();
+      if(remaining <= 0.0) break;
+      timeout = (int) remaining + 1;
+    }
+
+    struct pollfd pfd = { pipe->fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout);
+    if(ready == 0) break;                                  //Deadline reached with a partial batch
+    if(ready < 0 && errno == EINTR) continue;
+
+    if(pipe->start > 0) {                                  //Keep the unconsumed tail at the front of the buffer
+      memmove(pipe->buffer, pipe->buffer + pipe->start, pipe->length - pipe->start);
+      pipe->length -= pipe->start;
+      pipe->start = 0;
+    }
+    if(pipe->length == LC_PIPE_BUFFER_SIZE) {
+      TraceLog(LOG_WARNING, "PIPE: Line %d exceeds %d bytes, discarded", pipe->line + 1, LC_PIPE_BUFFER_SIZE);
+      pipe->length = 0;
+    }
+
+    ssize_t bytes = read(pipe->fd, pipe->buffer + pipe->length, LC_PIPE_BUFFER_SIZE - pipe->length);
+    if(bytes < 0 && errno == EINTR) continue;
+    if(bytes <= 0) pipe->eof = true;
+    else pipe->length += (size_t) bytes;
+  }
+
+  if(pipe->reference_frame == LC_FRAME_INERTIAL) RotateInertialToBody(pipe->quaternions, pipe->sun_vectors, pipe->viewer_vectors, pipe->sun_vectors, pipe->viewer_vectors, count);
+  return count;
+#endif
+}
+
+bool LCPipeTakeRecord(LightCurveGeometryPipe *pipe, int slot) //Moves one complete record from the buffer into the batch
+{
+  double *sun = pipe->sun_vectors + 3 * slot;
+  double *viewer = pipe->viewer_vectors + 3 * slot;
+  double *quaternion = pipe->quaternions + 4 * slot;
+  int values = (pipe->reference_frame == LC_FRAME_INERTIAL) ? 10 : 6;
+
+  if(pipe->binary) {
+    size_t record_size = (values == 10) ? LC_PIPE_INERTIAL_RECORD_SIZE : LC_PIPE_RECORD_SIZE;
+    if(pipe->length - pipe->start < record_size) return false;
+
+    double record[10];
+    memcpy(record, pipe->buffer + pipe->start, record_size);
+    memcpy(sun, record, 3 * sizeof(double));
+    memcpy(viewer, record + 3, 3 * sizeof(double));
+    if(values == 10) memcpy(quaternion, record + 6, 4 * sizeof(double));
+    pipe->start += record_size;
+    return true;
+  }
+
+  while(pipe->start < pipe->length) {
+    const char *line = pipe->buffer + pipe->start;
+    const char *end = pipe->buffer + pipe->length;
+    const char *newline = memchr(line, '\n', end - line);
+
+    if(newline == NULL && !pipe->eof) return false;       //Wait for the rest of the line
+    const char *line_end = newline ? newline : end;
+    pipe->start = (size_t) (line_end - pipe->buffer) + (newline ? 1 : 0);
+    pipe->line++;
+
+    const char *p = LCSkipSpace(line, line_end);
+    const char *rest;
+    if(p == line_end) continue;
+    if(LCMatchKey(p, line_end, "End data", &rest)) {
+      pipe->eof = true;                                   //Producer may close the stream explicitly
+      pipe->start = pipe->length;
+      return false;
+    }
+
+    bool valid = true;
+    for(int k = 0; k < values && valid; k++) {
+      p = LCSkipSpace(p, line_end);
+      valid = LCParseDouble(&p, line_end, (k < 3) ? &sun[k] : (k < 6) ? &viewer[k - 3] : &quaternion[k - 6]);
+    }
+    if(valid && LCSkipSpace(p, line_end) == line_end) return true;
+
+    TraceLog(LOG_WARNING, "PIPE: [stdin:%d] Expected %d numbers (%s), line skipped", pipe->line, values, (values == 10) ? "SunXYZViewerXYZQuatWXYZ" : "SunXYZViewerXYZ");
+  }
+  return false;
+}
+
+double LCMonotonicMs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1.0e6;
+}
+
+void TraceLogToStderr(int logLevel, const char *text, va_list args) //Keeps stdout clean for results in pipe mode
+{
+  static const char *levels[] = { "", "TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL", "" };
+  fprintf(stderr, "%s: ", levels[(logLevel >= 0 && logLevel < 8) ? logLevel : 0]);
+  vfprintf(stderr, text, args);
+  fputc('\n', stderr);
+}
+
+// Rotates inertial sun and viewer vectors into the body frame and rescales them to LC_FRAME_VECTOR_LENGTH, since
+// only directions matter to the orthographic cameras and inertial distances would fall outside their depth range.
+// quaternions is count x 4 (w, x, y, z) and takes inertial vectors to body vectors, v_body = q v_inertial q*; it
+// need not be unit length. The outputs may alias the inputs. Zero vectors stay zero, zero quaternions leave the
+// vectors unrotated.
+void RotateInertialToBody(const double *quaternions, const double *sun_in, const double *viewer_in, double *sun_out, double *viewer_out, int count)
+{
+  int i = 0;
+#if defined(__GNUC__) || defined(__clang__)
+  for(; i + 4 <= count; i += 4) {                        //Four points at a time, transposed to one vector per component
+    LCDouble4 w, x, y, z, v[2][3], scale[2], twice_inverse_norm;
+    for(int l = 0; l < 4; l++) {
+      const double *q = quaternions + 4 * (i + l);
+      w[l] = q[0];
+      x[l] = q[1];
+      y[l] = q[2];
+      z[l] = q[3];
+      for(int k = 0; k < 3; k++) {
+        v[0][k][l] = sun_in[3 * (i + l) + k];
+        v[1][k][l] = viewer_in[3 * (i + l) + k];
+      }
+    }
+
+    LCDouble4 norm = w * w + x * x + y * y + z * z;
+    LCDouble4 length[2] = { v[0][0] * v[0][0] + v[0][1] * v[0][1] + v[0][2] * v[0][2], v[1][0] * v[1][0] + v[1][1] * v[1][1] + v[1][2] * v[1][2] };
+    for(int l = 0; l < 4; l++) {                         //Per lane, the vector extensions have no sqrt
+      twice_inverse_norm[l] = (norm[l] > 0.0) ? 2.0 / norm[l] : 0.0;
+      for(int j = 0; j < 2; j++) scale[j][l] = (length[j][l] > 0.0) ? LC_FRAME_VECTOR_LENGTH / sqrt(length[j][l]) : 0.0;
+    }
+
+    for(int j = 0; j < 2; j++) {                         //v' = v + 2/|q|^2 (w (u x v) + u x (u x v)), u = (x, y, z)
+      LCDouble4 tx = y * v[j][2] - z * v[j][1];
+      LCDouble4 ty = z * v[j][0] - x * v[j][2];
+      LCDouble4 tz = x * v[j][1] - y * v[j][0];
+      LCDouble4 rx = v[j][0] + twice_inverse_norm * (w * tx + y * tz - z * ty);
+      LCDouble4 ry = v[j][1] + twice_inverse_norm * (w * ty + z * tx - x * tz);
+      LCDouble4 rz = v[j][2] + twice_inverse_norm * (w * tz + x * ty - y * tx);
+      v[j][0] = rx * scale[j];
+      v[j][1] = ry * scale[j];
+      v[j][2] = rz * scale[j];
+    }
+
+    for(int l = 0; l < 4; l++) {
+      for(int k = 0; k < 3; k++) {
+        sun_out[3 * (i + l) + k] = v[0][k][l];
+        viewer_out[3 * (i + l) + k] = v[1][k][l];
+      }
+    }
+  }
+#endif
+  for(; i < count; i++) LCRotateInertialPoint(quaternions + 4 * i, sun_in + 3 * i, viewer_in + 3 * i, sun_out + 3 * i, viewer_out + 3 * i);
+}
+
+void LCRotateInertialPoint(const double *q, const double *sun_in, const double *viewer_in, double *sun_out, double *viewer_out) //Scalar tail of RotateInertialToBody
+{
+  double norm = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+  double twice_inverse_norm = (norm > 0.0) ? 2.0 / norm : 0.0;
+  const double *in[2] = { sun_in, viewer_in };
+  double *out[2] = { sun_out, viewer_out };
+
+  for(int j = 0; j < 2; j++) {
+    const double *v = in[j];
+    double length = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    double scale = (length > 0.0) ? LC_FRAME_VECTOR_LENGTH / sqrt(length) : 0.0;
+    double t[3] = { q[2] * v[2] - q[3] * v[1], q[3] * v[0] - q[1] * v[2], q[1] * v[1] - q[2] * v[0] };
+    double r[3] = { v[0] + twice_inverse_norm * (q[0] * t[0] + q[2] * t[2] - q[3] * t[1]),
+                    v[1] + twice_inverse_norm * (q[0] * t[1] + q[3] * t[0] - q[1] * t[2]),
+                    v[2] + twice_inverse_norm * (q[0] * t[2] + q[1] * t[1] - q[2] * t[0]) };
+    for(int k = 0; k < 3; k++) out[j][k] = r[k] * scale;
+  }
+}
@@ -4,15 +4,11 @@
 #include <raylib.h>
 #include <raymath.h>
 
-#define HEADER_OFFSET 21
-#define DATA_OFFSET 11
-#define DATA_LINE_LENGTH 66
 #define GLSL_VERSION            330
 
 #define MAX_INSTANCES          25
+#define LC_EDGE_PIXEL_SIGMA    0.29f  // Standard deviation of a boundary pixel's coverage error, uniform over [-1/2, 1/2]
 
-void ReadLightCurveCommandFile(char *filename, char *model_name, int *instances, int *screen_pixels, 
-     Vector3 sun_vectors[], Vector3 viewer_vectors[], int *data_points, char *results_file, int *frame_rate);
 Image LoadImageFromScreenFixed(void);
 void printMatrix(Matrix m);
 Matrix CalculateMVPFromCamera(Camera light_camera, Vector3 offset);
@@ -20,92 +16,17 @@ Matrix CalculateMVPBFromMVP(Matrix mvp_light);
 void SaveScreen(char fname[]);
 float CalculateCameraArea(Camera cam);
 float CalculateMeshScaleFactor(Mesh mesh, Camera cam, int instances); //Finds the factor required to scale all vertices down to fit the model in a unit cube
+float CalculateMeshBoundingRadius(Mesh mesh);
+float CalculateScaleFactorFromRadius(float bounding_radius, Camera cam, int instances);
 Mesh ApplyMeshScaleFactor(Mesh mesh, float sf);
 Vector3 TransformOffsetToCameraPlane(Camera cam, Vector3 offset);
 void GenerateTranslations(Vector3 *mesh_offsets, Camera cam, int instances);
 void CalculateRightAndTop(Camera cam, float *right, float *top);
 void InitializeViewerCamera(Camera *cam);
-void GetLCShaderLocations(Shader *depthShader, Shader *lighting_shader, Shader *brightness_shader, Shader *light_curve_shader, Shader *min_shader, int depth_light_mvp_locs[], int lighting_light_mvp_locs[], int instances);
-void CalculateLightCurveValues(float lightCurveFunction[], RenderTexture2D minifiedLightCurveTex, RenderTexture2D brightnessTex, float clipping_area, int instances, float scale_factor);
+void GetLCShaderLocations(Shader *depthShader, Shader *lighting_shader, Shader *brightness_shader, Shader *light_curve_shader, Shader *min_shader, int *depth_light_mvps_loc, int *lighting_viewer_mvps_loc);
+void CalculateLightCurveValues(float lightCurveFunction[], float litAreaFunction[], float relativeErrorFunction[], RenderTexture2D minifiedLightCurveTex, float clipping_area, int instances, float scale_factor);
+void ReduceLightCurveImage(float lightCurveFunction[], float litAreaFunction[], float relativeErrorFunction[], Image light_curve_image, float clipping_area, int instances, float scale_factor);
 void printVector3(Vector3 vec, const char name[]);
-void WriteLightCurveResults(char results_file[], float light_curve_results[], int data_points);
-void ClearLightCurveResults(char results_file[]);
-
-void ReadLightCurveCommandFile(char *filename, char *model_name, int *instances, int *screen_pixels, 
-      Vector3 sun_vectors[], Vector3 viewer_vectors[], int *data_points, char *results_file, int *frame_rate)
-{
-
-  char *file_contents = LoadFileText(filename);
-  int line_count;
-
-  //Header parsing
-  int model_index = TextFindIndex(file_contents, "Model File"); // Find first text occurrence within a string
-  int instances_index = TextFindIndex(file_contents, "Instances"); // Find first text occurrence within a string
-  int dimensions_index = TextFindIndex(file_contents, "Square Dimensions"); // Find first text occurrence within a string
-  int format_index = TextFindIndex(file_contents, "Format "); // Find first text occurrence within a string
-  int reference_frame_index = TextFindIndex(file_contents, "Reference Frame"); // Find first text occurrence within a string
-  int data_points_index = TextFindIndex(file_contents, "Data Points"); // Find first text occurrence within a string
-  int results_file_index = TextFindIndex(file_contents, "Expected .lcr Name"); // Find first text occurrence within a string
-  int frame_rate_index = TextFindIndex(file_contents, "Target Framerate"); // Find first text occurrence within a string
-  
-  int begin_data_index = TextFindIndex(file_contents, "Begin data"); // Find first text occurrence within a string
-
-  char delim[] = "\n";
-
-  char *model_file_name = TextReplace(strtok(file_contents + model_index + HEADER_OFFSET, delim), " ", "");
-  *instances = atoi(strtok(file_contents + instances_index + HEADER_OFFSET, delim));
-  *screen_pixels = atoi(strtok(file_contents + dimensions_index + HEADER_OFFSET, delim));
-  char *format = TextReplace(strtok(file_contents + format_index + HEADER_OFFSET, delim), " ", "");
-  char *reference_frame = TextReplace(strtok(file_contents + reference_frame_index + HEADER_OFFSET, delim), " ", "");
-  *data_points = atoi(strtok(file_contents + data_points_index + HEADER_OFFSET, delim));
-  char *results_file_temp = TextReplace(strtok(file_contents + results_file_index + HEADER_OFFSET, delim), " ", "");
-  *frame_rate = atoi(strtok(file_contents + frame_rate_index + HEADER_OFFSET, delim));
-
-  for(int i = 0; i < strlen(results_file_temp); i++) {
-    results_file[i] = results_file_temp[i];
-  } 
-  
-  for(int i = 0; i < strlen(model_file_name); i++) {
-    model_name[i] = model_file_name[i];
-  }
-
-  printf("%s\n", model_file_name);
-  printf("%d\n", *instances);
-  printf("%s\n", format);
-  printf("%s\n", reference_frame);
-  printf("%s\n", results_file);
-
-  //Sun/viewer data parsing
-  for(int line_num = 0; line_num < *data_points; line_num++) {
-    char *data = strtok(file_contents + begin_data_index + 10 + DATA_LINE_LENGTH * line_num, delim);
-
-    if(line_num > 1) {
-      data = strtok(file_contents + begin_data_index + 10 + (DATA_LINE_LENGTH) * line_num - line_num + 1, delim);
-    }
-
-    data = TextReplace(data, "   ", ",");
-    data = TextReplace(data, "  ", ",");
-    data = TextReplace(data, " ", ",");
-
-    // printf("%s\n", data);
-
-    double sun_vector_x = atof(strtok(data, ","));
-    double sun_vector_y = atof(strtok(NULL, ","));
-    double sun_vector_z = atof(strtok(NULL, ","));
-
-    double viewer_vector_x = atof(strtok(NULL, ","));
-    double viewer_vector_y = atof(strtok(NULL, ","));
-    double viewer_vector_z = atof(strtok(NULL, ","));
-
-    Vector3 sun_vector = {sun_vector_x, sun_vector_y, sun_vector_z};
-    Vector3 viewer_vector = {viewer_vector_x, viewer_vector_y, viewer_vector_z};
-
-    sun_vectors[line_num] = sun_vector;
-    viewer_vectors[line_num] = viewer_vector;
-  }
-
-  return;
-}
 
 // Load image from screen buffer and (screenshot)
 Image LoadImageFromScreenFixed(void)
@@ -176,6 +97,11 @@ void SaveScreen(char fname[]) //Saves the current screen image to a file
 }
 
 float CalculateMeshScaleFactor(Mesh mesh, Camera cam, int instances) //Finds the factor required to scale all vertices down to fit the model in a unit cube
+{
+  return CalculateScaleFactorFromRadius(CalculateMeshBoundingRadius(mesh), cam, instances);
+}
+
+float CalculateMeshBoundingRadius(Mesh mesh) //Largest vertex distance from the model origin
 {
   float largest_disp = 0.0;
   for(int i = 0; i < mesh.vertexCount; i++) {
@@ -184,12 +110,17 @@ float CalculateMeshScaleFactor(Mesh mesh, Camera cam, int instances) //Finds the
 
     if(vertex_disp > largest_disp) largest_disp = vertex_disp;
   }
+  return largest_disp;
+}
+
+float CalculateScaleFactorFromRadius(float bounding_radius, Camera cam, int instances)
+{
   int grid_width = (int) ceil(sqrt(instances));  
   float top;
   float right;
   CalculateRightAndTop(cam, &right, &top);
 
-  return (largest_disp / top) * grid_width;
+  return (bounding_radius / top) * grid_width;
 }
 
 Mesh ApplyMeshScaleFactor(Mesh mesh, float sf)
@@ -227,7 +158,7 @@ void GenerateTranslations(Vector3 *mesh_offsets, Camera cam, int instances)
   int index = 0;
   for(int i = 0; i < square_below; i++) {
     for(int j = 0; j < square_below; j++) {
-      Vector3 absolute_offset = {-right * (square_below - 1.0) + i * (square_below + (4.0 - square_below)), -top * (square_below - 1.0) + j * (square_below + (4.0 - square_below)), 0.0};
+      Vector3 absolute_offset = {-right * (square_below - 1.0) + i * 2.0 * right, -top * (square_below - 1.0) + j * 2.0 * top, 0.0}; //Tile centres for any fovy
 
       mesh_offsets[index] = Vector3Scale(absolute_offset, 1.0 / (float) square_below);
       index++;
@@ -245,57 +176,65 @@ void InitializeViewerCamera(Camera *cam)
     cam->projection = CAMERA_ORTHOGRAPHIC;             // Camera mode type
 }
 
-void GetLCShaderLocations(Shader *depthShader, Shader *lighting_shader, Shader *brightness_shader, Shader *light_curve_shader, Shader *min_shader, int depth_light_mvp_locs[], int lighting_light_mvp_locs[], int instances) {
+void GetLCShaderLocations(Shader *depthShader, Shader *lighting_shader, Shader *brightness_shader, Shader *light_curve_shader, Shader *min_shader, int *depth_light_mvps_loc, int *lighting_viewer_mvps_loc) {
     depthShader->locs[0] = GetShaderLocation(*depthShader, "viewPos");           //Location of the viewer position uniform for the depth shader
     depthShader->locs[1] = GetShaderLocation(*depthShader, "light_mvp");         //Location of the light MVP matrix uniform for the depth shader
     depthShader->locs[2] = GetShaderLocation(*depthShader, "lightPos");          //Location of the light position uniform for the depth shader
     depthShader->locs[3] = GetShaderLocation(*depthShader, "model_id");          //Location of the model id uniform for the depth shader
 
-    for (int i = 0; i < instances; i++)
-    {
-      const char *matName = TextFormat("light_mvps[%d].mat\0", i);
-      depth_light_mvp_locs[i] = GetShaderLocation(*depthShader, matName);
-    }
+    *depth_light_mvps_loc = GetShaderLocation(*depthShader, "light_mvps");  //Location of the light MVP array, one upload per frame
 
     lighting_shader->locs[0] = GetShaderLocation(*lighting_shader, "viewPos");   //Location of the viewer position uniform for the lighting shader
     lighting_shader->locs[1] = GetShaderLocation(*lighting_shader, "lightPos");  //Location of the light position uniform for the lighting shader
     lighting_shader->locs[2] = GetShaderLocation(*lighting_shader, "depthTex");  //Location of the depth texture uniform for the lighting shader
-    lighting_shader->locs[3] = GetShaderLocation(*lighting_shader, "mvp_from_script"); //Location of the light MVP matrix uniform for the lighting shader
+    *lighting_viewer_mvps_loc = GetShaderLocation(*lighting_shader, "viewer_mvps"); //Location of the viewer MVP array for the lighting shader
     lighting_shader->locs[4] = GetShaderLocation(*lighting_shader, "model_id");  //Location of the light MVP matrix uniform for the lighting shader
     lighting_shader->locs[5] = GetShaderLocation(*lighting_shader, "light_mvp");
     lighting_shader->locs[6] = GetShaderLocation(*lighting_shader, "grid_width");
     
     min_shader->locs[0] = GetShaderLocation(*min_shader, "grid_width");
+}
 
-    // for (int i = 0; i < instances; i++)
-    // {
-    //   const char *matName = TextFormat("light_mvps[%d].mat\0", i);
-    //   lighting_light_mvp_locs[i] = GetShaderLocation(*lighting_shader, matName);
-    // }
+// relativeErrorFunction (may be NULL) estimates the rasterization error of each value from the lit-boundary pixels
+// the brightness pass marks in blue: each is covered to within half a pixel, so sigma * sqrt(boundary) / lit
+void CalculateLightCurveValues(float lightCurveFunction[], float litAreaFunction[], float relativeErrorFunction[], RenderTexture2D minifiedLightCurveTex, float clipping_area, int instances, float scale_factor) {
+    Image light_curve_image = LoadImageFromTexture(minifiedLightCurveTex.texture);
+    ReduceLightCurveImage(lightCurveFunction, litAreaFunction, relativeErrorFunction, light_curve_image, clipping_area, instances, scale_factor);
+    UnloadImage(light_curve_image);
 }
 
-void CalculateLightCurveValues(float lightCurveFunction[], RenderTexture2D minifiedLightCurveTex, RenderTexture2D brightnessTex, float clipping_area, int instances, float scale_factor) {
+// The CPU half of CalculateLightCurveValues() on an already read back minified image (no GL, see LightCurveBench.c)
+void ReduceLightCurveImage(float lightCurveFunction[], float litAreaFunction[], float relativeErrorFunction[], Image light_curve_image, float clipping_area, int instances, float scale_factor) {
     int gridWidth = (int) ceil(sqrt(instances));
 
-    Image light_curve_image = LoadImageFromTexture(minifiedLightCurveTex.texture);
-    int total_pixels = brightnessTex.texture.width * brightnessTex.texture.height;
-
     float instance_total_irrad_est[MAX_INSTANCES];
+    float instance_lit_area_est[MAX_INSTANCES];
+    float instance_relative_error_est[MAX_INSTANCES];
 
     int grid_pixel_height = light_curve_image.height / gridWidth;
+    bool float_pixels = light_curve_image.format == PIXELFORMAT_UNCOMPRESSED_R32G32B32A32; //Render Target RGBA32F: no 1/255 quantization
     
     //CALCULATING SHADED LC VALUES
-    for(int col = 0; col < light_curve_image.width; col++) {
+    for(int col = 0; col < gridWidth; col++) { //The texture may be wider when a pass uses a coarser grid than it was sized for
       for(int row_instance = 0; row_instance < gridWidth; row_instance++) {
         float lit_pixels = 0.0;
+        float boundary_pixels = 0.0;
         float lighting_factor = 0.0;
 
         for(int row_instance_pixel = row_instance * grid_pixel_height; row_instance_pixel < (row_instance + 1) * grid_pixel_height; row_instance_pixel++) {
-          Color pix_color = GetImageColor(light_curve_image, col, row_instance_pixel);
+          float pix[3];
+          if(float_pixels) memcpy(pix, (const float *) light_curve_image.data + 4 * (row_instance_pixel * light_curve_image.width + col), sizeof(pix));
+          else {
+            Color pix_color = GetImageColor(light_curve_image, col, row_instance_pixel);
+            pix[0] = (float) pix_color.r / 255.0f;
+            pix[1] = (float) pix_color.g / 255.0f;
+            pix[2] = (float) pix_color.b / 255.0f;
+          }
           
-          if((float) pix_color.g > 0.0) { //for all lit rows
-            lit_pixels += (float) pix_color.g / 255.0 * grid_pixel_height; //number of lit pixels in row
-            lighting_factor += (float) pix_color.r / 255.0 * grid_pixel_height; //Represents the average irrad of each row * the fraction of lit pixels on that row
+          if(pix[1] > 0.0f) { //for all lit rows
+            lit_pixels += pix[1] * grid_pixel_height; //number of lit pixels in row
+            boundary_pixels += pix[2] * grid_pixel_height; //number of those on the lit region's edge
+            lighting_factor += pix[0] * grid_pixel_height; //Represents the average irrad of each row * the fraction of lit pixels on that row
           }
         }
         float fraction_of_pixels_lit = 1 / pow((double) grid_pixel_height, 2.0);
@@ -304,13 +243,15 @@ void CalculateLightCurveValues(float lightCurveFunction[], RenderTexture2D minif
         float apparent_model_lit_area_unscaled = apparent_model_lit_area_scaled * scale_factor * scale_factor;//removing the mesh scale factor
         
         instance_total_irrad_est[row_instance + gridWidth * col] = lighting_factor * apparent_model_lit_area_unscaled / PI;
+        instance_lit_area_est[row_instance + gridWidth * col] = lit_pixels * apparent_model_lit_area_unscaled; //Projected area that is both lit and visible
+        instance_relative_error_est[row_instance + gridWidth * col] = (lit_pixels > 0.0) ? LC_EDGE_PIXEL_SIGMA * sqrtf(boundary_pixels) / lit_pixels : 0.0;
       }
     }
-  
-    UnloadImage(light_curve_image);
 
     for(int i = 0; i < instances; i++) {
       lightCurveFunction[i] = instance_total_irrad_est[i];
+      if(litAreaFunction != NULL) litAreaFunction[i] = instance_lit_area_est[i];
+      if(relativeErrorFunction != NULL) relativeErrorFunction[i] = instance_relative_error_est[i];
     }
 }
 
@@ -318,20 +259,3 @@ void printVector3(Vector3 vec, const char name[])
 {
   printf("%s: %.4f, %.4f, %.4f\n", name, vec.x, vec.y, vec.z);
 }
-
-void WriteLightCurveResults(char results_file[], float light_curve_results[], int data_points)
-{
-  FILE *fptr;
-  fptr = fopen(results_file, "w");
-
-  for(int i = 0; i < data_points; i++) {    
-    fprintf(fptr, "%f\n", light_curve_results[i]);
-  }
-
-  fclose(fptr);
-}
-
-void ClearLightCurveResults(char results_file[])
-{
-  remove(results_file);
-}
\ No newline at end of file
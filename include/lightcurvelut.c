@@ -0,0 +1,754 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <raylib.h>
+
+//----------------------------------------------------------------------------------
+// Light curve lookup tables (.lclt)
+//
+// A bake renders the irradiance channel once for every pair of body-frame directions on a HEALPix ring grid
+// (12 nside^2 equal-area pixels per sphere). Sun and viewer are reciprocal (see lightcurvededup.c), so only
+// pairs with sun pixel <= viewer pixel are rendered and stored. A query interpolates each sphere from the four
+// surrounding pixel centres (the HEALPix ring interpolation) and blends the 4 x 4 table entries, without the GPU.
+//
+// Little-endian:
+//   [0, 256)                 LCLUTHeader (zero-padded)
+//   [256, ..)                float32 irradiance for sun pixel s, viewer pixel v >= s, rows in order of s
+//----------------------------------------------------------------------------------
+#define LCLT_MAGIC               "LCLT"
+#define LCLT_VERSION             1
+#define LCLT_HEADER_SIZE         256
+#define LC_LUT_DEFAULT_NSIDE     8      // 768 directions per sphere, 295296 renders
+#define LC_LUT_MAX_NSIDE         16     // 3072 directions per sphere, 4.7 M renders
+#define LC_LUT_VECTOR_LENGTH     2.0    // Bake vectors sit at the distance the MATLAB scripts use
+#define LC_LUT_QUERY_CHUNK       4096   // Points interpolated per results batch
+
+//----------------------------------------------------------------------------------
+// Spherical-harmonic surrogates (.lcsh)
+//
+// Least-squares fit of a baked table to value = y(sun)^T C y(viewer), with y the real spherical harmonics up to
+// a degree L ((L + 1)^2 functions). The table is a full tensor grid, so the fit separates into
+// C = A^-1 Y^T F Y A^-1 with A = Y^T Y, and reciprocity makes C symmetric. Degree 4 is a 2.5 KB surrogate whose
+// evaluation is one short matrix-vector dot product per query.
+//
+//   [0, 256)                 LCSHHeader (zero-padded)
+//   [256, ..)                float32 C, (L + 1)^2 x (L + 1)^2, row-major
+//----------------------------------------------------------------------------------
+#define LCSH_MAGIC               "LCSH"
+#define LCSH_VERSION             1
+#define LCSH_HEADER_SIZE         256
+#define LC_SH_DEFAULT_DEGREE     4
+#define LC_SH_MAX_DEGREE         8
+#define LC_SH_MAX_FUNCTIONS      ((LC_SH_MAX_DEGREE + 1)*(LC_SH_MAX_DEGREE + 1))
+#define LC_SH_STRIDE(n)          (((n) + 3) & ~3)   // Rows padded to whole vectors
+
+#if defined(__GNUC__) || defined(__clang__)
+  typedef float LCFloat4 __attribute__((vector_size(16)));  // SSE / NEON through the compiler's vector extensions
+#endif
+
+typedef struct {
+  char magic[4];                          // "LCLT"
+  uint32_t version;                       // LCLT_VERSION
+  uint32_t header_size;                   // Byte offset of the table
+  uint32_t nside;
+  uint64_t entry_count;                   // pixel_count (pixel_count + 1) / 2
+  float vector_length;                    // Length of the sun and viewer vectors that were rendered
+  int32_t screen_pixels;                  // Settings of the bake, for reference
+  int32_t instances;
+  float refine_tolerance;
+  char model_file[LCCB_NAME_LENGTH];      // NUL-terminated
+} LCLUTHeader;
+
+typedef struct {
+  int first_pixel;
+  int pixel_count;
+  double theta;                           // Colatitude of the ring's pixel centres
+  bool shifted;                           // Pixel centres sit half a pixel past phi = 0
+} LCHealpixRing;
+
+typedef struct {
+  char magic[4];                          // "LCSH"
+  uint32_t version;                       // LCSH_VERSION
+  uint32_t header_size;                   // Byte offset of the coefficients
+  uint32_t degree;
+  uint32_t function_count;                // (degree + 1)^2
+  uint32_t source_nside;                  // Table the fit was made from
+  float vector_length;
+  float peak;                             // Largest absolute table value
+  float rms_error;                        // Fit residual over the table, relative to peak
+  float max_error;
+  char model_file[LCCB_NAME_LENGTH];      // NUL-terminated
+} LCSHHeader;
+
+typedef struct {
+  int nside;
+  int pixel_count;
+  float *values;                          // pixel_count x pixel_count, symmetric
+  LCHealpixRing rings[4*LC_LUT_MAX_NSIDE]; // Rings 1 .. 4 nside - 1, precomputed for queries
+  int sh_degree;                          // > 0: a surrogate, sh_coefficients replaces values
+  int sh_function_count;
+  float *sh_coefficients;                 // sh_function_count rows of LC_SH_STRIDE(sh_function_count), zero-padded
+  LCLUTHeader header;
+} LightCurveLUT;
+
+void LCHealpixRingInfo(int nside, int ring, LCHealpixRing *info);
+int LCHealpixRingAbove(int nside, double z);
+Vector3 HealpixPixelDirection(int nside, int pixel);
+void InitHealpixRings(int nside, LCHealpixRing *rings);
+void HealpixInterpolationWeights(int nside, const LCHealpixRing *rings, const double direction[3], int pixels[4], float weights[4]);
+bool BuildLUTBakeGeometry(LightCurveCommand *command, int nside);
+bool SaveLightCurveLUT(const char *filename, int nside, const float *entries, const LightCurveCommand *command);
+bool LoadLightCurveLUT(const char *filename, LightCurveLUT *lut);
+void UnloadLightCurveLUT(LightCurveLUT *lut);
+void QueryLightCurveLUT(const LightCurveLUT *lut, const double *sun_vectors, const double *viewer_vectors, int count, float *values);
+bool RunLUTQuery(const LightCurveLUT *lut, const LightCurveCommand *command, LightCurveResultsWriter *writer);
+bool BuildLUTSpotCheck(const LightCurveLUT *lut, LightCurveCommand *command, int count, float **expected);
+void ReportLUTSpotCheck(const float *expected, const float *rendered, int count);
+void RealSphericalHarmonics(int degree, const double direction[3], float *values);
+bool FitSHSurrogate(const LightCurveLUT *lut, int degree, float *coefficients, float *rms_error, float *max_error, float *peak);
+bool BuildSHSurrogate(const char *table_file, const char *surrogate_file, int degree);
+bool LCLoadSHSurrogate(const char *filename, const unsigned char *data, size_t size, LightCurveLUT *lut);
+void LCQuerySHSurrogate(const LightCurveLUT *lut, const double *sun_vectors, const double *viewer_vectors, int count, float *values);
+bool LCCholeskySolve(double *a, int n, double *b, int columns);
+
+// Rings run 1 .. 4 nside - 1 from the north pole, as in HEALPix's RING scheme
+void LCHealpixRingInfo(int nside, int ring, LCHealpixRing *info)
+{
+  int npix = 12*nside*nside;
+  int north_ring = (ring > 2*nside) ? 4*nside - ring : ring;
+
+  if(north_ring < nside) {                //Polar cap
+    double one_minus_z = north_ring*north_ring*4.0/npix;
+    info->theta = atan2(sqrt(one_minus_z*(2.0 - one_minus_z)), 1.0 - one_minus_z);
+    info->pixel_count = 4*north_ring;
+    info->shifted = true;
+    info->first_pixel = 2*north_ring*(north_ring - 1);
+  }
+  else {                                  //Equatorial belt
+    info->theta = acos((2*nside - north_ring)*2.0/(3.0*nside));
+    info->pixel_count = 4*nside;
+    info->shifted = ((north_ring - nside) & 1) == 0;
+    info->first_pixel = 2*nside*(nside - 1) + (north_ring - nside)*4*nside;
+  }
+
+  if(north_ring != ring) {
+    info->theta = PI - info->theta;
+    info->first_pixel = npix - info->first_pixel - info->pixel_count;
+  }
+}
+
+int LCHealpixRingAbove(int nside, double z) //Last ring whose centres are north of z, 0 above the first ring
+{
+  double az = fabs(z);
+  if(az <= 2.0/3.0) return (int) (nside*(2.0 - 1.5*z));
+  int ring = (int) (nside*sqrt(3.0*(1.0 - az)));
+  return (z > 0.0) ? ring : 4*nside - ring - 1;
+}
+
+Vector3 HealpixPixelDirection(int nside, int pixel)
+{
+  int ring = 1;
+  LCHealpixRing info;
+  for(LCHealpixRingInfo(nside, ring, &info); pixel >= info.first_pixel + info.pixel_count; LCHealpixRingInfo(nside, ++ring, &info));
+
+  double phi = (pixel - info.first_pixel + (info.shifted ? 0.5 : 0.0)) * 2.0*PI / info.pixel_count;
+  return (Vector3) { (float) (sin(info.theta)*cos(phi)), (float) (sin(info.theta)*sin(phi)), (float) cos(info.theta) };
+}
+
+void InitHealpixRings(int nside, LCHealpixRing *rings) //rings[r] for r = 1 .. 4 nside - 1
+{
+  for(int r = 1; r < 4*nside; r++) LCHealpixRingInfo(nside, r, &rings[r]);
+}
+
+// Bilinear in (theta, phi) between the two rings around the direction; beyond the first and last ring the
+// missing ring is replaced by the mean of the four polar pixels, as HEALPix's get_interpol does
+void HealpixInterpolationWeights(int nside, const LCHealpixRing *ring_table, const double direction[3], int pixels[4], float weights[4])
+{
+  int npix = 12*nside*nside;
+  double rho = sqrt(direction[0]*direction[0] + direction[1]*direction[1]);
+  double length = sqrt(rho*rho + direction[2]*direction[2]);
+  double theta = atan2(rho, direction[2]);
+  double phi = atan2(direction[1], direction[0]);
+  if(phi < 0.0) phi += 2.0*PI;
+
+  int rings[2] = { LCHealpixRingAbove(nside, (length > 0.0) ? direction[2]/length : 1.0), 0 };
+  rings[1] = rings[0] + 1;
+  double ring_theta[2] = { 0.0, PI };
+  double w[4] = { 0.0 };
+
+  for(int r = 0; r < 2; r++) {
+    if(rings[r] < 1 || rings[r] > 4*nside - 1) continue;
+
+    LCHealpixRing info = ring_table[rings[r]];
+    ring_theta[r] = info.theta;
+
+    double dphi = 2.0*PI / info.pixel_count;
+    double position = phi/dphi - (info.shifted ? 0.5 : 0.0);
+    int left = (int) floor(position);
+    double fraction = position - left;
+    int right = left + 1;
+    if(left < 0) left += info.pixel_count;
+    if(right >= info.pixel_count) right -= info.pixel_count;
+
+    pixels[2*r] = info.first_pixel + left;
+    pixels[2*r + 1] = info.first_pixel + right;
+    w[2*r] = 1.0 - fraction;
+    w[2*r + 1] = fraction;
+  }
+
+  if(rings[0] == 0) {
+    double t = theta / ring_theta[1];
+    double pole = (1.0 - t)*0.25;
+    w[0] = pole;
+    w[1] = pole;
+    w[2] = w[2]*t + pole;
+    w[3] = w[3]*t + pole;
+    pixels[0] = (pixels[2] + 2) & 3;
+    pixels[1] = (pixels[3] + 2) & 3;
+  }
+  else if(rings[1] == 4*nside) {
+    double t = (theta - ring_theta[0]) / (PI - ring_theta[0]);
+    double pole = t*0.25;
+    w[0] = w[0]*(1.0 - t) + pole;
+    w[1] = w[1]*(1.0 - t) + pole;
+    w[2] = pole;
+    w[3] = pole;
+    pixels[2] = ((pixels[0] + 2) & 3) + npix - 4;
+    pixels[3] = ((pixels[1] + 2) & 3) + npix - 4;
+  }
+  else {
+    double t = (theta - ring_theta[0]) / (ring_theta[1] - ring_theta[0]);
+    w[0] *= 1.0 - t;
+    w[1] *= 1.0 - t;
+    w[2] *= t;
+    w[3] *= t;
+  }
+
+  for(int k = 0; k < 4; k++) weights[k] = (float) w[k];
+}
+
+// Replaces the command's geometry with every pixel pair of the bake, in table order
+bool BuildLUTBakeGeometry(LightCurveCommand *command, int nside)
+{
+  int npix = 12*nside*nside;
+  size_t pairs = (size_t) npix*(npix + 1)/2;
+  double *geometry = (double *) malloc(pairs*6*sizeof(double));
+  if(geometry == NULL) {
+    TraceLog(LOG_ERROR, "LUT: Could not allocate %zu bake geometries", pairs);
+    return false;
+  }
+
+  Vector3 *directions = (Vector3 *) malloc(npix*sizeof(Vector3));
+  for(int p = 0; p < npix; p++) directions[p] = Vector3Scale(HealpixPixelDirection(nside, p), (float) LC_LUT_VECTOR_LENGTH);
+
+  double *sun = geometry;
+  double *viewer = geometry + 3*pairs;
+  for(int s = 0; s < npix; s++) {
+    for(int v = s; v < npix; v++) {
+      *sun++ = directions[s].x;
+      *sun++ = directions[s].y;
+      *sun++ = directions[s].z;
+      *viewer++ = directions[v].x;
+      *viewer++ = directions[v].y;
+      *viewer++ = directions[v].z;
+    }
+  }
+  free(directions);
+
+  free(command->owned_data);              //A memory map stays until UnloadLightCurveCommand()
+  command->owned_data = geometry;
+  command->sun_vectors = geometry;
+  command->viewer_vectors = geometry + 3*pairs;
+  command->epochs = NULL;
+  command->data_points = (int) pairs;
+  command->reference_frame = LC_FRAME_OBJECT_BODY; //A propagated command's epochs are gone
+
+  TraceLog(LOG_INFO, "LUT: Baking nside %d, %d directions per sphere, %zu sun/viewer pairs", nside, npix, pairs);
+  return true;
+}
+
+bool SaveLightCurveLUT(const char *filename, int nside, const float *entries, const LightCurveCommand *command)
+{
+  int npix = 12*nside*nside;
+  unsigned char header_bytes[LCLT_HEADER_SIZE] = { 0 };
+  LCLUTHeader header = { { 'L', 'C', 'L', 'T' }, LCLT_VERSION, LCLT_HEADER_SIZE, (uint32_t) nside, (uint64_t) npix*(npix + 1)/2,
+    (float) LC_LUT_VECTOR_LENGTH, command->screen_pixels, command->instances, command->refine_tolerance, { 0 } };
+  strncpy(header.model_file, command->model_name, LCCB_NAME_LENGTH - 1);
+  memcpy(header_bytes, &header, sizeof(LCLUTHeader));
+
+  FILE *file = fopen(filename, "wb");
+  if(file == NULL) {
+    TraceLog(LOG_ERROR, "LUT: [%s] Failed to open table file", filename);
+    return false;
+  }
+  bool written = fwrite(header_bytes, 1, LCLT_HEADER_SIZE, file) == LCLT_HEADER_SIZE &&
+                 fwrite(entries, sizeof(float), header.entry_count, file) == header.entry_count;
+  written = (fclose(file) == 0) && written;
+  if(!written) {
+    TraceLog(LOG_ERROR, "LUT: [%s] Failed to write table", filename);
+    return false;
+  }
+
+  TraceLog(LOG_INFO, "LUT: [%s] %llu entries (%.1f MB) for %s", filename, (unsigned long long) header.entry_count,
+           header.entry_count*sizeof(float) / (1024.0*1024.0), command->model_name);
+  return true;
+}
+
+bool LoadLightCurveLUT(const char *filename, LightCurveLUT *lut)
+{
+  memset(lut, 0, sizeof(LightCurveLUT));
+  size_t size;
+  const unsigned char *data = MapFileReadOnly(filename, &size);
+  if(data == NULL) {
+    TraceLog(LOG_ERROR, "LUT: [%s] Failed to open table file", filename);
+    return false;
+  }
+
+  if(IsFileExtension(filename, ".lcsh")) {
+    bool loaded = LCLoadSHSurrogate(filename, data, size, lut);
+    UnmapFile(data, size);
+    return loaded;
+  }
+
+  LCLUTHeader header;
+  memcpy(&header, data, (size < sizeof(LCLUTHeader)) ? size : sizeof(LCLUTHeader));
+  uint64_t npix = 12ull*header.nside*header.nside;
+  bool valid = size >= LCLT_HEADER_SIZE && memcmp(header.magic, LCLT_MAGIC, 4) == 0 && header.version == LCLT_VERSION &&
+               header.header_size == LCLT_HEADER_SIZE && header.nside >= 1 && header.nside <= LC_LUT_MAX_NSIDE &&
+               header.entry_count == npix*(npix + 1)/2 && size == LCLT_HEADER_SIZE + header.entry_count*sizeof(float);
+  if(valid) lut->values = (float *) malloc(npix*npix*sizeof(float));
+
+  if(!valid || lut->values == NULL) {
+    TraceLog(LOG_ERROR, "LUT: [%s] Not a light curve lookup table, or damaged", filename);
+    UnmapFile(data, size);
+    return false;
+  }
+
+  const float *entries = (const float *) (data + LCLT_HEADER_SIZE);
+  for(uint64_t s = 0; s < npix; s++) {    //Expanded to the full square, a query then needs no ordering of its pixels
+    for(uint64_t v = s; v < npix; v++) {
+      float value = *entries++;
+      lut->values[s*npix + v] = value;
+      lut->values[v*npix + s] = value;
+    }
+  }
+
+  lut->nside = (int) header.nside;
+  lut->pixel_count = (int) npix;
+  InitHealpixRings(lut->nside, lut->rings);
+  lut->header = header;
+  lut->header.model_file[LCCB_NAME_LENGTH - 1] = '\0';
+  UnmapFile(data, size);
+
+  TraceLog(LOG_INFO, "LUT: [%s] nside %d table of %s (%d px, %d instances)", filename, lut->nside, lut->header.model_file,
+           header.screen_pixels, header.instances);
+  return true;
+}
+
+void UnloadLightCurveLUT(LightCurveLUT *lut)
+{
+  free(lut->values);
+  free(lut->sh_coefficients);
+  lut->values = NULL;
+  lut->sh_coefficients = NULL;
+}
+
+// Row-major sun and viewer vectors, any length. Writes count irradiance values.
+void QueryLightCurveLUT(const LightCurveLUT *lut, const double *sun_vectors, const double *viewer_vectors, int count, float *values)
+{
+  if(lut->sh_coefficients != NULL) {
+    LCQuerySHSurrogate(lut, sun_vectors, viewer_vectors, count, values);
+    return;
+  }
+
+  for(int i = 0; i < count; i++) {
+    int sun_pixels[4], viewer_pixels[4];
+    float sun_weights[4], viewer_weights[4];
+    HealpixInterpolationWeights(lut->nside, lut->rings, sun_vectors + 3*i, sun_pixels, sun_weights);
+    HealpixInterpolationWeights(lut->nside, lut->rings, viewer_vectors + 3*i, viewer_pixels, viewer_weights);
+
+#if defined(__GNUC__) || defined(__clang__)
+    LCFloat4 sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int a = 0; a < 4; a++) {          //One table row per sun pixel, its four viewer entries side by side
+      const float *row = lut->values + (size_t) sun_pixels[a]*lut->pixel_count;
+      LCFloat4 entries = { row[viewer_pixels[0]], row[viewer_pixels[1]], row[viewer_pixels[2]], row[viewer_pixels[3]] };
+      sum += sun_weights[a]*entries;
+    }
+    LCFloat4 weights = { viewer_weights[0], viewer_weights[1], viewer_weights[2], viewer_weights[3] };
+    sum *= weights;
+    values[i] = sum[0] + sum[1] + sum[2] + sum[3];
+#else
+    float value = 0.0f;
+    for(int a = 0; a < 4; a++) {
+      const float *row = lut->values + (size_t) sun_pixels[a]*lut->pixel_count;
+      for(int b = 0; b < 4; b++) value += sun_weights[a]*viewer_weights[b]*row[viewer_pixels[b]];
+    }
+    values[i] = value;
+#endif
+  }
+}
+
+// Interpolates every data point of a command file into its results file, in chunks
+bool RunLUTQuery(const LightCurveLUT *lut, const LightCurveCommand *command, LightCurveResultsWriter *writer)
+{
+  if(strcmp(lut->header.model_file, command->model_name) != 0) {
+    TraceLog(LOG_WARNING, "LUT: Table was baked from %s, the command file names %s", lut->header.model_file, command->model_name);
+  }
+
+  float values[LC_LUT_QUERY_CHUNK];
+  double start = LCMonotonicMs();
+  for(int first = 0; first < command->data_points; first += LC_LUT_QUERY_CHUNK) {
+    int count = (command->data_points - first < LC_LUT_QUERY_CHUNK) ? command->data_points - first : LC_LUT_QUERY_CHUNK;
+    QueryLightCurveLUT(lut, command->sun_vectors + 3*first, command->viewer_vectors + 3*first, count, values);
+    WriteLightCurveResultsBatch(writer, values, count);
+  }
+  double elapsed = LCMonotonicMs() - start;
+
+  TraceLog(LOG_INFO, "LUT: %d data points interpolated in %.1f ms (%.2f M points/s, including output)", command->data_points, elapsed,
+           (elapsed > 0.0) ? command->data_points / (elapsed * 1000.0) : 0.0);
+  return true;
+}
+
+// Keeps count evenly spaced data points of the command for rendering and returns their interpolated values
+bool BuildLUTSpotCheck(const LightCurveLUT *lut, LightCurveCommand *command, int count, float **expected)
+{
+  if(count > command->data_points) count = command->data_points;
+  double *geometry = (double *) malloc((size_t) count*6*sizeof(double));
+  *expected = (float *) malloc((size_t) count*sizeof(float));
+  if(count <= 0 || geometry == NULL || *expected == NULL) {
+    free(geometry);
+    free(*expected);
+    *expected = NULL;
+    return false;
+  }
+
+  for(int i = 0; i < count; i++) {
+    size_t point = (size_t) ((i + 0.5) * command->data_points / count);
+    memcpy(geometry + 3*i, command->sun_vectors + 3*point, 3*sizeof(double));
+    memcpy(geometry + 3*(count + i), command->viewer_vectors + 3*point, 3*sizeof(double));
+  }
+  QueryLightCurveLUT(lut, geometry, geometry + 3*count, count, *expected);
+
+  free(command->owned_data);
+  command->owned_data = geometry;
+  command->sun_vectors = geometry;
+  command->viewer_vectors = geometry + 3*count;
+  command->epochs = NULL;
+  command->data_points = count;
+  return true;
+}
+
+void ReportLUTSpotCheck(const float *expected, const float *rendered, int count)
+{
+  double peak = 0.0;
+  for(int i = 0; i < count; i++) peak = fmax(peak, fabs(rendered[i]));
+
+  double squares = 0.0, worst = 0.0, bias = 0.0;
+  int worst_index = 0;
+  for(int i = 0; i < count; i++) {
+    double error = expected[i] - rendered[i];
+    squares += error*error;
+    bias += error;
+    if(fabs(error) > worst) {
+      worst = fabs(error);
+      worst_index = i;
+    }
+  }
+
+  //Relative to the brightest rendered point: near-dark geometries would dominate a per-point relative error
+  double scale = (peak > 0.0) ? peak : 1.0;
+  TraceLog(LOG_INFO, "LUT: Spot check of %d renders: RMS error %.3e, max %.3e (point %d), bias %.3e, relative to peak %.3e",
+           count, sqrt(squares/count)/scale, worst/scale, worst_index, bias/count/scale, peak);
+}
+
+// Orthonormal real spherical harmonics Y_lm at index l^2 + l + m, without the Condon-Shortley phase. Works on the
+// Cartesian direction: sin^m(theta) cos(m phi) and sin^m(theta) sin(m phi) are Re and Im of (x + iy)^m.
+void RealSphericalHarmonics(int degree, const double direction[3], float *values)
+{
+  double length = sqrt(direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2]);
+  double x = (length > 0.0) ? direction[0]/length : 0.0;
+  double y = (length > 0.0) ? direction[1]/length : 0.0;
+  double z = (length > 0.0) ? direction[2]/length : 1.0;
+
+  double re = 1.0, im = 0.0;              //(x + iy)^m
+  double diagonal = 1.0;                  //(2m - 1)!!, the reduced Legendre function Q_m^m
+  for(int m = 0; m <= degree; m++) {
+    double q_previous = 0.0, q = diagonal; //Q_l^m = P_l^m / sin^m(theta), recurrence over l
+    double factorial_ratio = 1.0;         //(l - m)! / (l + m)!
+    for(int k = 1; k <= 2*m; k++) factorial_ratio /= k;
+
+    for(int l = m; l <= degree; l++) {
+      if(l > m) {
+        double q_next = (l == m + 1) ? z*(2*m + 1)*q : ((2*l - 1)*z*q - (l + m - 1)*q_previous)/(l - m);
+        q_previous = q;
+        q = q_next;
+        factorial_ratio *= (double) (l - m)/(l + m);
+      }
+
+      double k_lm = sqrt((2*l + 1)/(4.0*PI)*factorial_ratio);
+      if(m == 0) values[l*l + l] = (float) (k_lm*q);
+      else {
+        values[l*l + l + m] = (float) (sqrt(2.0)*k_lm*q*re);
+        values[l*l + l - m] = (float) (sqrt(2.0)*k_lm*q*im);
+      }
+    }
+
+    double next_re = re*x - im*y;
+    im = re*y + im*x;
+    re = next_re;
+    diagonal *= 2*m + 1;
+  }
+}
+
+// In place: overwrites b (n x columns, row-major) with a^-1 b, a (n x n, symmetric positive definite) with its factor
+bool LCCholeskySolve(double *a, int n, double *b, int columns)
+{
+  for(int j = 0; j < n; j++) {
+    double d = a[j*n + j];
+    for(int k = 0; k < j; k++) d -= a[j*n + k]*a[j*n + k];
+    if(d <= 0.0) return false;
+    a[j*n + j] = sqrt(d);
+    for(int i = j + 1; i < n; i++) {
+      double sum = a[i*n + j];
+      for(int k = 0; k < j; k++) sum -= a[i*n + k]*a[j*n + k];
+      a[i*n + j] = sum / a[j*n + j];
+    }
+  }
+
+  for(int c = 0; c < columns; c++) {
+    for(int i = 0; i < n; i++) {          //L y = b
+      double sum = b[i*columns + c];
+      for(int k = 0; k < i; k++) sum -= a[i*n + k]*b[k*columns + c];
+      b[i*columns + c] = sum / a[i*n + i];
+    }
+    for(int i = n - 1; i >= 0; i--) {     //L^T x = y
+      double sum = b[i*columns + c];
+      for(int k = i + 1; k < n; k++) sum -= a[k*n + i]*b[k*columns + c];
+      b[i*columns + c] = sum / a[i*n + i];
+    }
+  }
+  return true;
+}
+
+// coefficients is function_count^2, row-major. Errors are over every table entry, relative to the peak.
+bool FitSHSurrogate(const LightCurveLUT *lut, int degree, float *coefficients, float *rms_error, float *max_error, float *peak)
+{
+  int n = (degree + 1)*(degree + 1);
+  int npix = lut->pixel_count;
+  float *basis = (float *) malloc((size_t) npix*n*sizeof(float));     //Y, npix x n
+  double *projected = (double *) calloc((size_t) npix*n, sizeof(double)); //F Y, then Y C
+  double *gram = (double *) calloc((size_t) n*n, sizeof(double));
+  double *solution = (double *) calloc((size_t) n*n, sizeof(double));
+  bool fitted = basis != NULL && projected != NULL && gram != NULL && solution != NULL;
+
+  if(fitted) {
+    for(int p = 0; p < npix; p++) {
+      Vector3 d = HealpixPixelDirection(lut->nside, p);
+      double direction[3] = { d.x, d.y, d.z };
+      RealSphericalHarmonics(degree, direction, basis + (size_t) p*n);
+    }
+
+    for(int i = 0; i < npix; i++) {
+      const float *row = lut->values + (size_t) i*npix;
+      double *target = projected + (size_t) i*n;
+      for(int j = 0; j < npix; j++) {
+        const float *y = basis + (size_t) j*n;
+        for(int b = 0; b < n; b++) target[b] += row[j]*y[b];
+      }
+    }
+
+    for(int p = 0; p < npix; p++) {
+      const float *y = basis + (size_t) p*n;
+      for(int a = 0; a < n; a++) {
+        for(int b = 0; b < n; b++) {
+          gram[a*n + b] += y[a]*y[b];
+          solution[a*n + b] += y[a]*projected[(size_t) p*n + b]; //Y^T F Y
+        }
+      }
+    }
+
+    //C = A^-1 (Y^T F Y) A^-1: solve from the left, transpose (everything is symmetric up to rounding), solve again
+    double *factor = (double *) malloc((size_t) n*n*sizeof(double));
+    fitted = factor != NULL;
+    if(fitted) {
+      memcpy(factor, gram, (size_t) n*n*sizeof(double));
+      fitted = LCCholeskySolve(factor, n, solution, n);
+    }
+    if(fitted) {
+      for(int a = 0; a < n; a++) {
+        for(int b = a + 1; b < n; b++) {
+          double swap = solution[a*n + b];
+          solution[a*n + b] = solution[b*n + a];
+          solution[b*n + a] = swap;
+        }
+      }
+      memcpy(factor, gram, (size_t) n*n*sizeof(double));
+      fitted = LCCholeskySolve(factor, n, solution, n);
+    }
+    free(factor);
+  }
+
+  if(!fitted) {
+    TraceLog(LOG_ERROR, "SH: Degree %d fit failed on an nside %d table (out of memory, or too few directions)", degree, lut->nside);
+  }
+  else {
+    for(int a = 0; a < n; a++) {
+      for(int b = 0; b < n; b++) coefficients[a*n + b] = (float) (0.5*(solution[a*n + b] + solution[b*n + a]));
+    }
+
+    memset(projected, 0, (size_t) npix*n*sizeof(double)); //Y C
+    for(int p = 0; p < npix; p++) {
+      for(int a = 0; a < n; a++) {
+        for(int b = 0; b < n; b++) projected[(size_t) p*n + b] += basis[(size_t) p*n + a]*coefficients[a*n + b];
+      }
+    }
+
+    double squares = 0.0, worst = 0.0, largest = 0.0;
+    for(int i = 0; i < npix; i++) {
+      for(int j = i; j < npix; j++) {
+        double fit = 0.0;
+        for(int b = 0; b < n; b++) fit += projected[(size_t) i*n + b]*basis[(size_t) j*n + b];
+        double value = lut->values[(size_t) i*npix + j];
+        double error = fit - value;
+        squares += error*error;
+        worst = fmax(worst, fabs(error));
+        largest = fmax(largest, fabs(value));
+      }
+    }
+    double scale = (largest > 0.0) ? largest : 1.0;
+    *peak = (float) largest;
+    *rms_error = (float) (sqrt(squares / ((double) npix*(npix + 1)/2)) / scale);
+    *max_error = (float) (worst / scale);
+
+    //Share of the coefficient energy by degree: how quickly the expansion converges
+    char energy_text[256] = { 0 };
+    double energy[LC_SH_MAX_DEGREE + 1] = { 0.0 }, total = 0.0;
+    for(int a = 0; a < n; a++) {
+      for(int b = 0; b < n; b++) {
+        int la = (int) sqrt((double) a), lb = (int) sqrt((double) b);
+        double c2 = (double) coefficients[a*n + b]*coefficients[a*n + b];
+        energy[(la > lb) ? la : lb] += c2;
+        total += c2;
+      }
+    }
+    for(int l = 0; l <= degree; l++) {
+      int used = (int) strlen(energy_text);
+      snprintf(energy_text + used, sizeof(energy_text) - used, "%s%.2e", (l > 0) ? " " : "", (total > 0.0) ? energy[l]/total : 0.0);
+    }
+    TraceLog(LOG_INFO, "SH: Degree %d, %d coefficients: truncation error RMS %.3e, max %.3e of peak %.3e; energy by degree %s",
+             degree, n*n, *rms_error, *max_error, *peak, energy_text);
+  }
+
+  free(basis);
+  free(projected);
+  free(gram);
+  free(solution);
+  return fitted;
+}
+
+bool BuildSHSurrogate(const char *table_file, const char *surrogate_file, int degree)
+{
+  if(degree < 1 || degree > LC_SH_MAX_DEGREE) {
+    TraceLog(LOG_ERROR, "SH: --sh-degree must be between 1 and %d", LC_SH_MAX_DEGREE);
+    return false;
+  }
+
+  LightCurveLUT lut;
+  if(!LoadLightCurveLUT(table_file, &lut)) return false;
+  if(lut.sh_coefficients != NULL || (degree + 1)*(degree + 1) > lut.pixel_count / 4) {
+    TraceLog(LOG_ERROR, "SH: [%s] Needs a baked table with at least 4 directions per fitted function", table_file);
+    UnloadLightCurveLUT(&lut);
+    return false;
+  }
+
+  int n = (degree + 1)*(degree + 1);
+  float *coefficients = (float *) malloc((size_t) n*n*sizeof(float));
+  float rms_error = 0.0f, max_error = 0.0f, peak = 0.0f;
+  bool built = coefficients != NULL && FitSHSurrogate(&lut, degree, coefficients, &rms_error, &max_error, &peak);
+
+  if(built) {
+    unsigned char header_bytes[LCSH_HEADER_SIZE] = { 0 };
+    LCSHHeader header = { { 'L', 'C', 'S', 'H' }, LCSH_VERSION, LCSH_HEADER_SIZE, (uint32_t) degree, (uint32_t) n, (uint32_t) lut.nside,
+      lut.header.vector_length, peak, rms_error, max_error, { 0 } };
+    memcpy(header.model_file, lut.header.model_file, LCCB_NAME_LENGTH);
+    memcpy(header_bytes, &header, sizeof(LCSHHeader));
+
+    FILE *file = fopen(surrogate_file, "wb");
+    built = file != NULL && fwrite(header_bytes, 1, LCSH_HEADER_SIZE, file) == LCSH_HEADER_SIZE &&
+            fwrite(coefficients, sizeof(float), (size_t) n*n, file) == (size_t) n*n;
+    if(file != NULL) built = (fclose(file) == 0) && built;
+    if(!built) TraceLog(LOG_ERROR, "SH: [%s] Failed to write surrogate", surrogate_file);
+    else TraceLog(LOG_INFO, "SH: [%s] %zu bytes for %s", surrogate_file, LCSH_HEADER_SIZE + (size_t) n*n*sizeof(float), header.model_file);
+  }
+
+  free(coefficients);
+  UnloadLightCurveLUT(&lut);
+  return built;
+}
+
+bool LCLoadSHSurrogate(const char *filename, const unsigned char *data, size_t size, LightCurveLUT *lut)
+{
+  LCSHHeader header;
+  memcpy(&header, data, (size < sizeof(LCSHHeader)) ? size : sizeof(LCSHHeader));
+  int n = (int) ((header.degree + 1)*(header.degree + 1));
+  bool valid = size >= LCSH_HEADER_SIZE && memcmp(header.magic, LCSH_MAGIC, 4) == 0 && header.version == LCSH_VERSION &&
+               header.header_size == LCSH_HEADER_SIZE && header.degree >= 1 && header.degree <= LC_SH_MAX_DEGREE &&
+               header.function_count == (uint32_t) n && size == LCSH_HEADER_SIZE + (size_t) n*n*sizeof(float);
+  if(valid) lut->sh_coefficients = (float *) calloc((size_t) n*LC_SH_STRIDE(n), sizeof(float));
+
+  if(!valid || lut->sh_coefficients == NULL) {
+    TraceLog(LOG_ERROR, "LUT: [%s] Not a spherical-harmonic surrogate, or damaged", filename);
+    return false;
+  }
+
+  const float *coefficients = (const float *) (data + LCSH_HEADER_SIZE);
+  for(int a = 0; a < n; a++) memcpy(lut->sh_coefficients + (size_t) a*LC_SH_STRIDE(n), coefficients + (size_t) a*n, n*sizeof(float));
+
+  lut->sh_degree = (int) header.degree;
+  lut->sh_function_count = n;
+  memcpy(lut->header.model_file, header.model_file, LCCB_NAME_LENGTH);
+  lut->header.model_file[LCCB_NAME_LENGTH - 1] = '\0';
+  lut->header.vector_length = header.vector_length;
+
+  TraceLog(LOG_INFO, "LUT: [%s] Degree %d surrogate of %s, fit error RMS %.3e, max %.3e of peak %.3e", filename, lut->sh_degree,
+           lut->header.model_file, header.rms_error, header.max_error, header.peak);
+  return true;
+}
+
+void LCQuerySHSurrogate(const LightCurveLUT *lut, const double *sun_vectors, const double *viewer_vectors, int count, float *values)
+{
+  int n = lut->sh_function_count;
+  int stride = LC_SH_STRIDE(n);
+  float sun_basis[LC_SH_STRIDE(LC_SH_MAX_FUNCTIONS)] = { 0.0f };
+  float viewer_basis[LC_SH_STRIDE(LC_SH_MAX_FUNCTIONS)] = { 0.0f }; //Padding stays zero
+
+  for(int i = 0; i < count; i++) {
+    RealSphericalHarmonics(lut->sh_degree, sun_vectors + 3*i, sun_basis);
+    RealSphericalHarmonics(lut->sh_degree, viewer_vectors + 3*i, viewer_basis);
+
+#if defined(__GNUC__) || defined(__clang__)
+    LCFloat4 sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int a = 0; a < n; a++) {
+      const float *row = lut->sh_coefficients + (size_t) a*stride;
+      LCFloat4 row_sum = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for(int b = 0; b < stride; b += 4) {
+        LCFloat4 c, y;
+        memcpy(&c, row + b, sizeof(LCFloat4));
+        memcpy(&y, viewer_basis + b, sizeof(LCFloat4));
+        row_sum += c*y;
+      }
+      sum += sun_basis[a]*row_sum;
+    }
+    values[i] = sum[0] + sum[1] + sum[2] + sum[3];
+#else
+    float value = 0.0f;
+    for(int a = 0; a < n; a++) {
+      const float *row = lut->sh_coefficients + (size_t) a*stride;
+      for(int b = 0; b < n; b++) value += sun_basis[a]*row[b]*viewer_basis[b];
+    }
+    values[i] = value;
+#endif
+  }
+}
@@ -0,0 +1,1309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <raylib.h>
+#include <raymath.h>
+#include <rlgl.h>
+
+#if defined(__APPLE__)
+  #define GL_SILENCE_DEPRECATION
+  #include <OpenGL/gl3.h>
+#elif defined(_WIN32)
+  __declspec(dllimport) void __stdcall glDrawElements(unsigned int mode, int count, unsigned int type, const void *indices);
+#else
+  #include <GL/gl.h>
+#endif
+
+#ifndef MAX_MATERIAL_MAPS
+  #define MAX_MATERIAL_MAPS      12     // Must match the raylib build (rmodels.c)
+#endif
+#define LC_GL_UNSIGNED_INT       0x1405
+#define LC_VERTEX_CACHE_SIZE     32     // Post-transform cache entries assumed by the triangle ordering and ACMR report
+#define LC_MAX_MATERIALS         32     // Must match MAX_MATERIALS in base_shadowing.vs
+#define LC_MATERIAL_NONE         255    // Material ID past the table: reflectance 1.0, same as an untagged vertex
+#define LC_FNV_OFFSET            14695981039346656037ull
+
+#define LC_MESH_CACHE_DIR        "models/.lccache"
+
+#define LC_LOD_MAX_LEVELS        12
+#define LC_LOD_MIN_TRIANGLES     256    // Simplification stops before going below this
+#define LC_LOD_PROBE_COUNT       128    // Sun/viewer pairs the predicted light curve error is measured over
+#define LC_LOD_MAX_PIXEL_ERROR   0.5f   // Surface deviation, in tile pixels, a selected level may have
+#define LC_LOD_BOUNDARY_WEIGHT   100.0  // Quadric weight holding open edges and material seams in place
+#define LC_LOD_MIN_FLIP_COSINE   0.2f   // A collapse may not turn a surviving facet by more than ~78 degrees
+#define LC_LOD_CREASE_COSINE     0.5f   // Simplified levels smooth normals across edges sharper than 60 degrees only
+
+//----------------------------------------------------------------------------------
+// Preprocessed mesh cache (.lcmesh)
+//
+// Keyed by a hash of the OBJ and MTL file contents, so an edited model simply misses the cache.
+// Holds the level-of-detail chain of merged, welded, cache-ordered meshes, so a hit skips the OBJ parse,
+// the preparation and the simplification. Only the level selected for the run is read past the tables.
+//   [0, 64)                  LCMeshCacheHeader (zero-padded)
+//   [64, + 24L)              LCMeshLevelInfo per level, full resolution first
+//   [.., + 4M)               material reflectance table, M float32
+//   then per level:
+//   [.., + 12V)              positions, V x 3 float32, unscaled model units
+//   [.., + 12V)              normals, V x 3 float32
+//   [.., + 4I)               indices, I uint32 triangle list
+//   [.., + V)                material IDs, V uint8, zero-padded to a multiple of 4
+//----------------------------------------------------------------------------------
+#define LC_MESH_CACHE_MAGIC      "LCMC"
+#define LC_MESH_CACHE_VERSION    4
+#define LC_MESH_CACHE_HEADER     64
+
+typedef struct {
+  char magic[4];                          // "LCMC"
+  uint32_t version;                       // LC_MESH_CACHE_VERSION
+  uint32_t header_size;                   // Byte offset of the level table
+  uint32_t level_count;
+  uint64_t source_hash;                   // HashModelSources() of the OBJ and its MTL files
+  uint32_t material_count;
+  float bounding_radius;                  // CalculateMeshBoundingRadius() of the unscaled mesh
+} LCMeshCacheHeader;
+
+typedef struct {
+  uint32_t vertex_count;
+  uint32_t index_count;
+  float geometric_error;                  // Worst RMS plane distance of any collapse so far, unscaled model units
+  float photometric_error;                // RMS facet-sum light curve change from level 0, relative to its mean
+  float acmr_welded;                      // ACMR before OptimizeVertexCache()
+  float acmr_optimized;                   // ACMR after OptimizeVertexCache()
+} LCMeshLevelInfo;
+
+typedef struct {
+  Model model;                            // meshes[0] holds the merged VAO: positions, normals, material ID in colour.r
+  unsigned int index_vbo;                 // 32-bit triangle list bound to that VAO (0: plain raylib meshes, use DrawMesh)
+  int index_count;
+  int lod_level;                          // Level of the simplification chain in use, 0 is full resolution
+  int material_count;
+  float reflectance[LC_MAX_MATERIALS];    // Diffuse reflectance per material ID, see SetMaterialReflectance()
+} LightCurveModel;
+
+typedef struct {
+  float *positions;                       // MemAlloc'd, handed to the raylib mesh on upload
+  float *normals;
+  unsigned char *material_ids;
+  uint32_t *indices;
+  int vertex_count;
+  int index_count;
+  int material_count;
+  float reflectance[LC_MAX_MATERIALS];
+  float acmr_welded;
+  float acmr_optimized;
+  float geometric_error;                  // See LCMeshLevelInfo
+  float photometric_error;
+} LCPreparedMesh;
+
+typedef struct {
+  LCPreparedMesh levels[LC_LOD_MAX_LEVELS]; // Full resolution first, about half the triangles per level after that
+  int level_count;
+} LCMeshChain;
+
+typedef struct {
+  int *slots;                             // Open-addressed hash of output vertex indices, -1 when empty
+  int slot_count;
+  float *positions;                       // Output arrays, sized for the worst case of nothing welding
+  float *normals;
+  unsigned char *material_ids;
+  int vertex_count;
+} LCWeldTable;
+
+typedef struct {
+  float cost;                             // Area-weighted squared plane distance at target
+  float target[3];
+  int v0, v1;                             // v1 collapses onto v0
+  unsigned int version0, version1;        // Vertex versions the cost was computed for, stale entries are skipped
+} LCCollapse;
+
+// Quadric error metric edge collapse (Garland & Heckbert 1997) on the position-welded mesh
+typedef struct {
+  int vertex_count;
+  float *positions;
+  unsigned char *material_ids;
+  double *quadrics;                       // 11 per vertex: upper triangle of the 4x4 plane quadric, then the facet area it holds
+  unsigned int *versions;
+  bool *vertex_removed;
+  int **vertex_triangles;                 // Triangles around each vertex, removed ones are dropped lazily
+  int *vertex_triangle_counts;
+  int *vertex_triangle_capacities;
+  int *marks;                             // Neighbourhood scratch for the link test
+  int mark;
+  int triangle_count;
+  int live_triangles;
+  int *triangles;
+  bool *triangle_removed;
+  LCCollapse *heap;                       // Binary min-heap on cost
+  int heap_count;
+  int heap_capacity;
+  float max_error;                        // Worst RMS plane distance collapsed so far
+} LCSimplifier;
+
+uint64_t HashFileContents(const unsigned char *data, size_t size);
+uint64_t HashBytes(uint64_t hash, const unsigned char *data, size_t size);
+uint64_t HashModelSources(const char *filename, const unsigned char *obj_data, size_t obj_size);
+LightCurveModel LoadLightCurveModel(const char *filename, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor);
+LightCurveModel BuildLightCurveModel(Model model, const char *name, const char *cache_file, uint64_t source_hash, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor);
+void UnloadLightCurveModel(LightCurveModel lc_model);
+void DrawLightCurveModel(LightCurveModel lc_model, Material material, Matrix transform);
+void SetMaterialReflectance(LightCurveModel lc_model, Shader shader);
+LightCurveModel UploadLightCurveModel(float *positions, const float *normals, const unsigned char *material_ids, int vertex_count, const uint32_t *indices, int index_count);
+bool LoadMeshCache(const char *cache_file, uint64_t source_hash, Camera cam, int instances, int tile_pixels, float lod_tolerance, LightCurveModel *lc_model, float *mesh_scale_factor);
+void SaveMeshCache(const char *cache_file, uint64_t source_hash, const LCMeshChain *chain, float bounding_radius);
+size_t MeshLevelSize(LCMeshLevelInfo level);
+LCMeshLevelInfo MeshLevelInfo(const LCPreparedMesh *prepared);
+bool PrepareLightCurveMesh(Model model, LCPreparedMesh *prepared);
+void UnloadPreparedMesh(LCPreparedMesh *prepared);
+bool InitWeldTable(LCWeldTable *weld, int corner_count, float *positions, float *normals, unsigned char *material_ids);
+uint32_t WeldCorner(LCWeldTable *weld, float corner[6], unsigned char material_id);
+int WeldMeshVertices(Model model, float *positions, float *normals, unsigned char *material_ids, uint32_t *indices);
+void OptimizeVertexCache(uint32_t *indices, int index_count, int vertex_count, int cache_size);
+void ReorderVerticesByFirstUse(float *positions, float *normals, unsigned char *material_ids, uint32_t *indices, int index_count, int vertex_count);
+float CalculateACMR(const uint32_t *indices, int index_count, int vertex_count, int cache_size);
+void BuildMeshLevels(LCMeshChain *chain);
+int SelectMeshLevel(const LCMeshLevelInfo *levels, int level_count, float bounding_radius, int tile_pixels, float lod_tolerance);
+void CalculateFacetSumCurve(const LCPreparedMesh *mesh, double curve[LC_LOD_PROBE_COUNT]);
+Vector3 LCFibonacciDirection(int i, int n);
+bool InitSimplifier(LCSimplifier *simplifier, const LCPreparedMesh *source);
+void UnloadSimplifier(LCSimplifier *simplifier);
+void SimplifyToTriangleCount(LCSimplifier *simplifier, int target_triangles);
+bool SnapshotSimplifier(const LCSimplifier *simplifier, const LCPreparedMesh *source, LCPreparedMesh *level);
+void LCAddPlaneQuadric(double *quadric, Vector3 normal, float d, double weight, double area);
+double LCQuadricError(const double *quadric, const float *point);
+void LCEvaluateCollapse(LCSimplifier *simplifier, int v0, int v1, LCCollapse *collapse);
+bool LCApplyCollapse(LCSimplifier *simplifier, LCCollapse collapse);
+void LCPushCollapse(LCSimplifier *simplifier, int v0, int v1);
+LCCollapse LCPopCollapse(LCSimplifier *simplifier);
+
+uint64_t HashFileContents(const unsigned char *data, size_t size) //64-bit FNV-1a
+{
+  return HashBytes(LC_FNV_OFFSET, data, size);
+}
+
+uint64_t HashBytes(uint64_t hash, const unsigned char *data, size_t size) //Continues an FNV-1a hash
+{
+  for(size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// The OBJ plus every mtllib it names (resolved next to the OBJ, as tinyobj does), so a reflectance edit re-keys too
+uint64_t HashModelSources(const char *filename, const unsigned char *obj_data, size_t obj_size)
+{
+  uint64_t hash = HashFileContents(obj_data, obj_size);
+
+  char directory[MAX_FNAME_LENGTH + 64];
+  snprintf(directory, sizeof(directory), "%s", GetDirectoryPath(filename));
+
+  const char *end = (const char *) obj_data + obj_size;
+  for(const char *line = (const char *) obj_data; line < end; ) {
+    const char *line_end = memchr(line, '\n', end - line);
+    if(line_end == NULL) line_end = end;
+
+    const char *c = line;
+    while(c < line_end && (*c == ' ' || *c == '\t')) c++;
+    if(line_end - c > 7 && strncmp(c, "mtllib", 6) == 0 && (c[6] == ' ' || c[6] == '\t')) {
+      c += 7;
+      while(c < line_end && (*c == ' ' || *c == '\t')) c++;
+      const char *name_end = line_end;
+      while(name_end > c && (name_end[-1] == '\r' || name_end[-1] == ' ' || name_end[-1] == '\t')) name_end--;
+
+      char mtl_file[2*MAX_FNAME_LENGTH + 64];
+      snprintf(mtl_file, sizeof(mtl_file), "%s/%.*s", directory, (int) (name_end - c), c);
+
+      size_t mtl_size;
+      const unsigned char *mtl_data = MapFileReadOnly(mtl_file, &mtl_size);
+      if(mtl_data != NULL) {
+        hash = HashBytes(hash, mtl_data, mtl_size);
+        UnmapFile(mtl_data, mtl_size);
+      }
+    }
+    line = line_end + 1;
+  }
+  return hash;
+}
+
+// Loads, merges every mesh of the model, prepares, simplifies, scales and uploads it. Only the coarsest level of
+// detail that keeps the predicted error within lod_tolerance at tile_pixels is uploaded. Repeat loads of an unchanged
+// OBJ come from the binary cache: positions are scaled on the way into RAM, the rest goes to the GPU from the map.
+LightCurveModel LoadLightCurveModel(const char *filename, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor)
+{
+  LightCurveModel lc_model = { 0 };
+
+  size_t obj_size;
+  const unsigned char *obj_data = MapFileReadOnly(filename, &obj_size);
+  if(obj_data == NULL) {
+    lc_model.model = LoadModel(filename); //Let raylib report the missing file and fall back
+    *mesh_scale_factor = CalculateMeshScaleFactor(lc_model.model.meshes[0], cam, instances);
+    return lc_model;
+  }
+
+  uint64_t source_hash = HashModelSources(filename, obj_data, obj_size);
+  UnmapFile(obj_data, obj_size);
+
+  char cache_file[MAX_FNAME_LENGTH + 64];
+  snprintf(cache_file, sizeof(cache_file), "%s/%016llx.lcmesh", LC_MESH_CACHE_DIR, (unsigned long long) source_hash);
+
+  if(LoadMeshCache(cache_file, source_hash, cam, instances, tile_pixels, lod_tolerance, &lc_model, mesh_scale_factor)) {
+    TraceLog(LOG_INFO, "MESH: [%s] Loaded from cache %s", filename, cache_file);
+    return lc_model;
+  }
+
+  return BuildLightCurveModel(LoadModel(filename), filename, cache_file, source_hash, cam, instances, tile_pixels, lod_tolerance, mesh_scale_factor);
+}
+
+// The cache miss half of LoadLightCurveModel(), for a model already in RAM (see also LoadProceduralLightCurveModel()).
+// Takes ownership of the model; meshes that were never uploaded are only uploaded if preparation fails.
+LightCurveModel BuildLightCurveModel(Model model, const char *name, const char *cache_file, uint64_t source_hash, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor)
+{
+  LightCurveModel lc_model = { 0 };
+  float bounding_radius = 0.0f;
+  for(int m = 0; m < model.meshCount; m++) bounding_radius = fmaxf(bounding_radius, CalculateMeshBoundingRadius(model.meshes[m]));
+  *mesh_scale_factor = CalculateScaleFactorFromRadius(bounding_radius, cam, instances);
+
+  LCMeshChain chain = { 0 };
+  if(!PrepareLightCurveMesh(model, &chain.levels[0])) {
+    for(int m = 0; m < model.meshCount; m++) { //Draw the meshes as loaded
+      ApplyMeshScaleFactor(model.meshes[m], *mesh_scale_factor);
+      if(model.meshes[m].vaoId == 0) UploadMesh(&model.meshes[m], false);
+      else rlUpdateVertexBuffer(model.meshes[m].vboId[0], model.meshes[m].vertices, model.meshes[m].vertexCount*3*sizeof(float), 0);
+    }
+    lc_model.model = model;
+    return lc_model;
+  }
+  UnloadModel(model);
+
+  LCPreparedMesh *full = &chain.levels[0];
+  TraceLog(LOG_INFO, "MESH: [%s] %d meshes, %d materials merged: %d triangles, %d -> %d vertices, ACMR %.3f -> %.3f (welded) -> %.3f (optimized)",
+           name, model.meshCount, full->material_count, full->index_count/3, full->index_count, full->vertex_count, 3.0f,
+           full->acmr_welded, full->acmr_optimized);
+
+  BuildMeshLevels(&chain);
+  SaveMeshCache(cache_file, source_hash, &chain, bounding_radius);
+
+  LCMeshLevelInfo levels[LC_LOD_MAX_LEVELS];
+  for(int l = 0; l < chain.level_count; l++) levels[l] = MeshLevelInfo(&chain.levels[l]);
+  int level = SelectMeshLevel(levels, chain.level_count, bounding_radius, tile_pixels, lod_tolerance);
+
+  LCPreparedMesh *selected = &chain.levels[level];
+  for(int i = 0; i < selected->vertex_count*3; i++) selected->positions[i] /= *mesh_scale_factor;
+  lc_model = UploadLightCurveModel(selected->positions, selected->normals, selected->material_ids, selected->vertex_count, selected->indices, selected->index_count);
+  lc_model.lod_level = level;
+  lc_model.material_count = selected->material_count;
+  memcpy(lc_model.reflectance, selected->reflectance, sizeof(lc_model.reflectance));
+  selected->positions = NULL;              //Owned by the raylib mesh now
+  for(int l = 0; l < chain.level_count; l++) UnloadPreparedMesh(&chain.levels[l]);
+
+  return lc_model;
+}
+
+void UnloadLightCurveModel(LightCurveModel lc_model)
+{
+  if(lc_model.index_vbo != 0) rlUnloadVertexBuffer(lc_model.index_vbo);
+  UnloadModel(lc_model.model);
+}
+
+// DrawMesh() for the 32-bit index buffer: raylib's Mesh.indices is 16-bit, which caps an indexed mesh
+// at 65535 vertices. Uniform and texture setup mirrors DrawMesh() (GL 3.3, VAO path, no stereo).
+void DrawLightCurveModel(LightCurveModel lc_model, Material material, Matrix transform)
+{
+  Mesh mesh = lc_model.model.meshes[0];
+  if(lc_model.index_vbo == 0) {
+    for(int m = 0; m < lc_model.model.meshCount; m++) DrawMesh(lc_model.model.meshes[m], material, transform);
+    return;
+  }
+
+  rlEnableShader(material.shader.id);
+
+  if(material.shader.locs[SHADER_LOC_COLOR_DIFFUSE] != -1) {
+    float values[4] = { material.maps[MATERIAL_MAP_DIFFUSE].color.r/255.0f, material.maps[MATERIAL_MAP_DIFFUSE].color.g/255.0f,
+                        material.maps[MATERIAL_MAP_DIFFUSE].color.b/255.0f, material.maps[MATERIAL_MAP_DIFFUSE].color.a/255.0f };
+    rlSetUniform(material.shader.locs[SHADER_LOC_COLOR_DIFFUSE], values, SHADER_UNIFORM_VEC4, 1);
+  }
+  if(material.shader.locs[SHADER_LOC_COLOR_SPECULAR] != -1) {
+    float values[4] = { material.maps[MATERIAL_MAP_SPECULAR].color.r/255.0f, material.maps[MATERIAL_MAP_SPECULAR].color.g/255.0f,
+                        material.maps[MATERIAL_MAP_SPECULAR].color.b/255.0f, material.maps[MATERIAL_MAP_SPECULAR].color.a/255.0f };
+    rlSetUniform(material.shader.locs[SHADER_LOC_COLOR_SPECULAR], values, SHADER_UNIFORM_VEC4, 1);
+  }
+
+  Matrix matView = rlGetMatrixModelview();
+  Matrix matProjection = rlGetMatrixProjection();
+  Matrix matModel = MatrixMultiply(transform, rlGetMatrixTransform());
+  Matrix matModelView = MatrixMultiply(matModel, matView);
+
+  if(material.shader.locs[SHADER_LOC_MATRIX_VIEW] != -1) rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_VIEW], matView);
+  if(material.shader.locs[SHADER_LOC_MATRIX_PROJECTION] != -1) rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_PROJECTION], matProjection);
+  if(material.shader.locs[SHADER_LOC_MATRIX_MODEL] != -1) rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_MODEL], transform);
+  if(material.shader.locs[SHADER_LOC_MATRIX_NORMAL] != -1) rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_NORMAL], MatrixTranspose(MatrixInvert(matModel)));
+
+  for(int i = 0; i < MAX_MATERIAL_MAPS; i++) {
+    if(material.maps[i].texture.id > 0) {
+      rlActiveTextureSlot(i);
+      if((i == MATERIAL_MAP_IRRADIANCE) || (i == MATERIAL_MAP_PREFILTER) || (i == MATERIAL_MAP_CUBEMAP)) rlEnableTextureCubemap(material.maps[i].texture.id);
+      else rlEnableTexture(material.maps[i].texture.id);
+      rlSetUniform(material.shader.locs[SHADER_LOC_MAP_DIFFUSE + i], &i, SHADER_UNIFORM_INT, 1);
+    }
+  }
+
+  rlEnableVertexArray(mesh.vaoId);         //Carries the element buffer binding
+  rlSetUniformMatrix(material.shader.locs[SHADER_LOC_MATRIX_MVP], MatrixMultiply(matModelView, matProjection));
+  glDrawElements(RL_TRIANGLES, lc_model.index_count, LC_GL_UNSIGNED_INT, 0);
+
+  for(int i = 0; i < MAX_MATERIAL_MAPS; i++) {
+    rlActiveTextureSlot(i);
+    if((i == MATERIAL_MAP_IRRADIANCE) || (i == MATERIAL_MAP_PREFILTER) || (i == MATERIAL_MAP_CUBEMAP)) rlDisableTextureCubemap();
+    else rlDisableTexture();
+  }
+
+  rlDisableVertexArray();
+  rlDisableShader();
+
+  rlSetMatrixModelview(matView);
+  rlSetMatrixProjection(matProjection);
+}
+
+// Uploads the material table to the lighting shader; vertices carry only the ID
+void SetMaterialReflectance(LightCurveModel lc_model, Shader shader)
+{
+  float reflectance[LC_MAX_MATERIALS];
+  for(int i = 0; i < LC_MAX_MATERIALS; i++) reflectance[i] = (i < lc_model.material_count) ? lc_model.reflectance[i] : 1.0f;
+  SetShaderValueV(shader, GetShaderLocation(shader, "material_reflectance"), reflectance, SHADER_UNIFORM_FLOAT, LC_MAX_MATERIALS);
+}
+
+// Takes ownership of positions (MemAlloc'd); normals, material IDs and indices are only read for the upload
+LightCurveModel UploadLightCurveModel(float *positions, const float *normals, const unsigned char *material_ids, int vertex_count, const uint32_t *indices, int index_count)
+{
+  Mesh mesh = { 0 };
+  mesh.vertexCount = vertex_count;
+  mesh.triangleCount = index_count/3;
+  mesh.vertices = positions;
+  mesh.normals = (float *) normals;
+  mesh.colors = (unsigned char *) MemAlloc(vertex_count*4); //Material ID rides in the colour attribute's red channel
+  for(int v = 0; v < vertex_count; v++) {
+    mesh.colors[v*4 + 0] = material_ids[v];
+    mesh.colors[v*4 + 3] = 255;
+  }
+  UploadMesh(&mesh, false);
+  mesh.normals = NULL;                     //Nothing reads them back
+  MemFree(mesh.colors);
+  mesh.colors = NULL;
+
+  LightCurveModel lc_model = { 0 };
+  lc_model.index_count = index_count;
+  rlEnableVertexArray(mesh.vaoId);         //GL_ELEMENT_ARRAY_BUFFER binding is recorded in the VAO
+  lc_model.index_vbo = rlLoadVertexBufferElement((void *) indices, index_count*sizeof(uint32_t), false);
+  rlDisableVertexArray();
+
+  lc_model.model = LoadModelFromMesh(mesh);
+  return lc_model;
+}
+
+bool LoadMeshCache(const char *cache_file, uint64_t source_hash, Camera cam, int instances, int tile_pixels, float lod_tolerance, LightCurveModel *lc_model, float *mesh_scale_factor)
+{
+  size_t size;
+  const unsigned char *data = MapFileReadOnly(cache_file, &size);
+  if(data == NULL) return false;
+
+  LCMeshCacheHeader header;
+  memcpy(&header, data, (size < sizeof(LCMeshCacheHeader)) ? size : sizeof(LCMeshCacheHeader));
+
+  bool valid = size >= LC_MESH_CACHE_HEADER && memcmp(header.magic, LC_MESH_CACHE_MAGIC, 4) == 0 && header.version == LC_MESH_CACHE_VERSION &&
+               header.header_size == LC_MESH_CACHE_HEADER && header.source_hash == source_hash && header.level_count > 0 &&
+               header.level_count <= LC_LOD_MAX_LEVELS && header.material_count <= LC_MAX_MATERIALS;
+
+  LCMeshLevelInfo levels[LC_LOD_MAX_LEVELS];
+  size_t level_offsets[LC_LOD_MAX_LEVELS] = { 0 };
+  size_t offset = LC_MESH_CACHE_HEADER + header.level_count * sizeof(LCMeshLevelInfo) + header.material_count * sizeof(float);
+  valid = valid && size >= offset;
+  if(valid) memcpy(levels, data + LC_MESH_CACHE_HEADER, header.level_count * sizeof(LCMeshLevelInfo));
+
+  for(uint32_t l = 0; valid && l < header.level_count; l++) {
+    valid = levels[l].vertex_count > 0 && levels[l].index_count > 0 && levels[l].index_count % 3 == 0;
+    level_offsets[l] = offset;
+    offset += MeshLevelSize(levels[l]);
+  }
+  valid = valid && offset == size;
+
+  int level = valid ? SelectMeshLevel(levels, (int) header.level_count, header.bounding_radius, tile_pixels, lod_tolerance) : 0;
+  const float *reflectance = (const float *) (data + LC_MESH_CACHE_HEADER + header.level_count * sizeof(LCMeshLevelInfo));
+  const float *positions = (const float *) (data + level_offsets[level]);
+  const float *normals = positions + 3 * (size_t) levels[level].vertex_count;
+  const uint32_t *indices = (const uint32_t *) (normals + 3 * (size_t) levels[level].vertex_count);
+  const unsigned char *material_ids = (const unsigned char *) (indices + levels[level].index_count);
+
+  for(uint32_t i = 0; valid && i < levels[level].index_count; i++) valid = indices[i] < levels[level].vertex_count; //A bad index would read past the VBO on the GPU
+
+  if(!valid) {
+    TraceLog(LOG_WARNING, "MESH: [%s] Stale or damaged cache entry, rebuilding", cache_file);
+    UnmapFile(data, size);
+    return false;
+  }
+
+  *mesh_scale_factor = CalculateScaleFactorFromRadius(header.bounding_radius, cam, instances);
+
+  uint32_t vertex_count = levels[level].vertex_count;
+  float *scaled_positions = (float *) MemAlloc(vertex_count*3*sizeof(float));
+  for(size_t i = 0; i < (size_t) vertex_count*3; i++) scaled_positions[i] = positions[i] / *mesh_scale_factor;
+
+  *lc_model = UploadLightCurveModel(scaled_positions, normals, material_ids, (int) vertex_count, indices, (int) levels[level].index_count);
+  lc_model->lod_level = level;
+  lc_model->material_count = (int) header.material_count;
+  memcpy(lc_model->reflectance, reflectance, header.material_count * sizeof(float));
+  TraceLog(LOG_INFO, "MESH: %u materials, %u triangles, %u vertices, ACMR %.3f (welded) -> %.3f (optimized)", header.material_count,
+           levels[level].index_count/3, vertex_count, levels[level].acmr_welded, levels[level].acmr_optimized);
+
+  UnmapFile(data, size);
+  return true;
+}
+
+void SaveMeshCache(const char *cache_file, uint64_t source_hash, const LCMeshChain *chain, float bounding_radius) //Best effort, a failed write only costs the next load
+{
+#if !defined(LC_NO_POSIX)
+  mkdir("models", 0755);
+  mkdir(LC_MESH_CACHE_DIR, 0755);
+#endif
+
+  const LCPreparedMesh *full = &chain->levels[0];
+  unsigned char header_bytes[LC_MESH_CACHE_HEADER] = { 0 };
+  LCMeshCacheHeader header = { { 'L', 'C', 'M', 'C' }, LC_MESH_CACHE_VERSION, LC_MESH_CACHE_HEADER, (uint32_t) chain->level_count,
+    source_hash, (uint32_t) full->material_count, bounding_radius };
+  memcpy(header_bytes, &header, sizeof(LCMeshCacheHeader));
+
+  char temp_file[MAX_FNAME_LENGTH + 128];
+  snprintf(temp_file, sizeof(temp_file), "%s.tmp", cache_file);
+
+  FILE *file = fopen(temp_file, "wb");
+  if(file == NULL) {
+    TraceLog(LOG_WARNING, "MESH: [%s] Could not write mesh cache", cache_file);
+    return;
+  }
+
+  bool ok = fwrite(header_bytes, 1, LC_MESH_CACHE_HEADER, file) == LC_MESH_CACHE_HEADER;
+  for(int l = 0; l < chain->level_count; l++) {
+    LCMeshLevelInfo level = MeshLevelInfo(&chain->levels[l]);
+    ok = ok && fwrite(&level, sizeof(LCMeshLevelInfo), 1, file) == 1;
+  }
+  ok = ok && fwrite(full->reflectance, sizeof(float), full->material_count, file) == (size_t) full->material_count;
+
+  for(int l = 0; l < chain->level_count; l++) {
+    const LCPreparedMesh *level = &chain->levels[l];
+    size_t vertex_floats = (size_t) level->vertex_count*3;
+    const unsigned char padding[4] = { 0 };
+    ok = ok && fwrite(level->positions, sizeof(float), vertex_floats, file) == vertex_floats;
+    ok = ok && fwrite(level->normals, sizeof(float), vertex_floats, file) == vertex_floats;
+    ok = ok && fwrite(level->indices, sizeof(uint32_t), level->index_count, file) == (size_t) level->index_count;
+    ok = ok && fwrite(level->material_ids, 1, level->vertex_count, file) == (size_t) level->vertex_count;
+    ok = ok && fwrite(padding, 1, (4 - level->vertex_count % 4) % 4, file) == (size_t) (4 - level->vertex_count % 4) % 4;
+  }
+  ok = (fclose(file) == 0) && ok;
+
+  if(ok && rename(temp_file, cache_file) == 0) TraceLog(LOG_INFO, "MESH: Wrote cache %s", cache_file); //Readers never see a partial file
+  else remove(temp_file);
+}
+
+size_t MeshLevelSize(LCMeshLevelInfo level) //Bytes of one level's arrays in the cache
+{
+  return (size_t) level.vertex_count * 6 * sizeof(float) + (size_t) level.index_count * sizeof(uint32_t) + ((level.vertex_count + 3) & ~3u);
+}
+
+LCMeshLevelInfo MeshLevelInfo(const LCPreparedMesh *prepared)
+{
+  LCMeshLevelInfo level = { (uint32_t) prepared->vertex_count, (uint32_t) prepared->index_count, prepared->geometric_error,
+                            prepared->photometric_error, prepared->acmr_welded, prepared->acmr_optimized };
+  return level;
+}
+
+//----------------------------------------------------------------------------------
+// Mesh preparation: merge meshes -> weld -> triangle order for the post-transform cache -> vertex order for fetch locality
+//
+// tinyobj splits an OBJ into one mesh per material. Merging them into one buffer, with the material as a per-vertex
+// ID into a reflectance table, keeps each pass at one draw call however many parts the model has.
+//----------------------------------------------------------------------------------
+bool PrepareLightCurveMesh(Model model, LCPreparedMesh *prepared)
+{
+  memset(prepared, 0, sizeof(LCPreparedMesh));
+  int index_count = 0;
+  for(int m = 0; m < model.meshCount; m++) {
+    if(model.meshes[m].vertices == NULL) return false;
+    index_count += model.meshes[m].triangleCount*3;
+  }
+  if(index_count == 0) return false;
+
+  prepared->positions = (float *) MemAlloc(index_count*3*sizeof(float)); //Worst case, nothing welds
+  prepared->normals = (float *) malloc(index_count*3*sizeof(float));
+  prepared->material_ids = (unsigned char *) malloc(index_count);
+  prepared->indices = (uint32_t *) malloc(index_count*sizeof(uint32_t));
+  if(prepared->positions == NULL || prepared->normals == NULL || prepared->material_ids == NULL || prepared->indices == NULL) {
+    TraceLog(LOG_WARNING, "MESH: Could not allocate %d vertices for preparation, drawing unindexed", index_count);
+    UnloadPreparedMesh(prepared);
+    return false;
+  }
+
+  prepared->material_count = (model.materialCount < LC_MAX_MATERIALS) ? model.materialCount : LC_MAX_MATERIALS;
+  if(model.materialCount > LC_MAX_MATERIALS) TraceLog(LOG_WARNING, "MESH: %d materials, those past %d render with reflectance 1.0", model.materialCount, LC_MAX_MATERIALS);
+  for(int i = 0; i < prepared->material_count; i++) { //Kd, averaged over RGB: the lighting pass is monochrome
+    Color diffuse = model.materials[i].maps[MATERIAL_MAP_DIFFUSE].color;
+    prepared->reflectance[i] = (diffuse.r + diffuse.g + diffuse.b) / (3.0f * 255.0f);
+  }
+
+  prepared->index_count = index_count;
+  prepared->vertex_count = WeldMeshVertices(model, prepared->positions, prepared->normals, prepared->material_ids, prepared->indices);
+  if(prepared->vertex_count == 0) {
+    UnloadPreparedMesh(prepared);
+    return false;
+  }
+  prepared->acmr_welded = CalculateACMR(prepared->indices, index_count, prepared->vertex_count, LC_VERTEX_CACHE_SIZE);
+
+  OptimizeVertexCache(prepared->indices, index_count, prepared->vertex_count, LC_VERTEX_CACHE_SIZE);
+  ReorderVerticesByFirstUse(prepared->positions, prepared->normals, prepared->material_ids, prepared->indices, index_count, prepared->vertex_count);
+  prepared->acmr_optimized = CalculateACMR(prepared->indices, index_count, prepared->vertex_count, LC_VERTEX_CACHE_SIZE);
+
+  return true;
+}
+
+void UnloadPreparedMesh(LCPreparedMesh *prepared)
+{
+  MemFree(prepared->positions);
+  free(prepared->normals);
+  free(prepared->material_ids);
+  free(prepared->indices);
+  memset(prepared, 0, sizeof(LCPreparedMesh));
+}
+
+bool InitWeldTable(LCWeldTable *weld, int corner_count, float *positions, float *normals, unsigned char *material_ids)
+{
+  weld->slot_count = 1;
+  while(weld->slot_count < 2*corner_count) weld->slot_count <<= 1;
+  weld->slots = (int *) malloc(weld->slot_count*sizeof(int));
+  if(weld->slots == NULL) return false;
+  memset(weld->slots, 0xff, weld->slot_count*sizeof(int)); //-1: empty slot
+
+  weld->positions = positions;
+  weld->normals = normals;
+  weld->material_ids = material_ids;
+  weld->vertex_count = 0;
+  return true;
+}
+
+// Returns the output vertex for a corner (position xyz, normal xyz), adding it if no bit-identical one exists yet
+uint32_t WeldCorner(LCWeldTable *weld, float corner[6], unsigned char material_id)
+{
+  for(int k = 0; k < 6; k++) corner[k] += 0.0f; //-0.0 -> +0.0 so signed zeros weld
+
+  uint32_t bits[6];
+  memcpy(bits, corner, sizeof(bits));
+  uint64_t hash = LC_FNV_OFFSET ^ material_id;
+  for(int k = 0; k < 6; k++) {
+    hash ^= bits[k];
+    hash *= 1099511628211ull;
+  }
+
+  int mask = weld->slot_count - 1;
+  int slot = (int) (hash ^ (hash >> 32)) & mask;
+  while(weld->slots[slot] != -1) {
+    int v = weld->slots[slot];
+    if(weld->material_ids[v] == material_id && memcmp(weld->positions + v*3, corner, 3*sizeof(float)) == 0 &&
+       memcmp(weld->normals + v*3, corner + 3, 3*sizeof(float)) == 0) return (uint32_t) v;
+    slot = (slot + 1) & mask;
+  }
+
+  int v = weld->vertex_count++;
+  weld->slots[slot] = v;
+  memcpy(weld->positions + v*3, corner, 3*sizeof(float));
+  memcpy(weld->normals + v*3, corner + 3, 3*sizeof(float));
+  weld->material_ids[v] = material_id;
+  return (uint32_t) v;
+}
+
+// Merges corners with bit-identical position, normal and material. Corners without a normal get the flat
+// facet normal first, so an OBJ without vn still welds into shared vertices per facet plane.
+int WeldMeshVertices(Model model, float *positions, float *normals, unsigned char *material_ids, uint32_t *indices)
+{
+  int index_count = 0;
+  for(int m = 0; m < model.meshCount; m++) index_count += model.meshes[m].triangleCount*3;
+
+  LCWeldTable weld;
+  if(!InitWeldTable(&weld, index_count, positions, normals, material_ids)) return 0;
+
+  int corner_count = 0;
+  for(int m = 0; m < model.meshCount; m++) {
+    Mesh mesh = model.meshes[m];
+    int material = (model.meshMaterial != NULL) ? model.meshMaterial[m] : 0;
+    unsigned char material_id = (material >= 0 && material < LC_MAX_MATERIALS) ? (unsigned char) material : LC_MATERIAL_NONE;
+
+    for(int t = 0; t < mesh.triangleCount; t++) {
+      float corner[3][6];
+      for(int c = 0; c < 3; c++) {
+        int source = (mesh.indices != NULL) ? mesh.indices[t*3 + c] : t*3 + c;
+        for(int k = 0; k < 3; k++) corner[c][k] = mesh.vertices[source*3 + k];
+        for(int k = 0; k < 3; k++) corner[c][3 + k] = (mesh.normals != NULL) ? mesh.normals[source*3 + k] : 0.0f;
+      }
+
+      Vector3 a = { corner[0][0], corner[0][1], corner[0][2] };
+      Vector3 b = { corner[1][0], corner[1][1], corner[1][2] };
+      Vector3 c = { corner[2][0], corner[2][1], corner[2][2] };
+      Vector3 facet_normal = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(b, a), Vector3Subtract(c, a)));
+
+      for(int v = 0; v < 3; v++) {
+        if(corner[v][3] == 0.0f && corner[v][4] == 0.0f && corner[v][5] == 0.0f) {
+          corner[v][3] = facet_normal.x;
+          corner[v][4] = facet_normal.y;
+          corner[v][5] = facet_normal.z;
+        }
+        indices[corner_count++] = WeldCorner(&weld, corner[v], material_id);
+      }
+    }
+  }
+
+  free(weld.slots);
+  return weld.vertex_count;
+}
+
+// Tipsify (Sander, Nehab & Barczak 2007): fans around the current vertex, then moves to the adjacent
+// vertex that will still be in a cache_size FIFO when its remaining triangles are emitted. Linear time.
+void OptimizeVertexCache(uint32_t *indices, int index_count, int vertex_count, int cache_size)
+{
+  int triangle_count = index_count/3;
+  int *live = (int *) calloc(vertex_count, sizeof(int));              //Triangles not yet emitted, per vertex
+  int *offsets = (int *) calloc(vertex_count + 1, sizeof(int));
+  int *adjacency = (int *) malloc(index_count*sizeof(int));           //Triangles of vertex v: adjacency[offsets[v], offsets[v+1])
+  int *time_stamps = (int *) calloc(vertex_count, sizeof(int));
+  int *dead_end = (int *) malloc(index_count*sizeof(int));
+  int *candidates = (int *) malloc(index_count*sizeof(int));
+  bool *emitted = (bool *) calloc(triangle_count, sizeof(bool));
+  uint32_t *output = (uint32_t *) malloc(index_count*sizeof(uint32_t));
+
+  for(int i = 0; i < index_count; i++) live[indices[i]]++;
+  for(int v = 0; v < vertex_count; v++) offsets[v + 1] = offsets[v] + live[v];
+  for(int i = 0; i < index_count; i++) adjacency[offsets[indices[i]]++] = i/3;
+  for(int v = vertex_count; v > 0; v--) offsets[v] = offsets[v - 1];  //Undo the fill increments
+  offsets[0] = 0;
+
+  int dead_end_top = 0, output_count = 0, cursor = 0;
+  int time_stamp = cache_size + 1;
+  int fanning = 0;
+  while(fanning >= 0) {
+    int candidate_count = 0;
+    for(int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+      int t = adjacency[a];
+      if(emitted[t]) continue;
+      for(int c = 0; c < 3; c++) {
+        int v = (int) indices[t*3 + c];
+        output[output_count++] = (uint32_t) v;
+        dead_end[dead_end_top++] = v;
+        candidates[candidate_count++] = v;
+        live[v]--;
+        if(time_stamp - time_stamps[v] > cache_size) time_stamps[v] = time_stamp++;
+      }
+      emitted[t] = true;
+    }
+
+    int next = -1, best_priority = -1; //Prefer the candidate whose fan still fits in the cache, oldest first
+    for(int i = 0; i < candidate_count; i++) {
+      int v = candidates[i];
+      if(live[v] <= 0) continue;
+      int priority = 0;
+      if(time_stamp - time_stamps[v] + 2*live[v] <= cache_size) priority = time_stamp - time_stamps[v];
+      if(priority > best_priority) {
+        best_priority = priority;
+        next = v;
+      }
+    }
+
+    while(next == -1 && dead_end_top > 0) { //Dead end: back up to a recently used vertex...
+      int v = dead_end[--dead_end_top];
+      if(live[v] > 0) next = v;
+    }
+    while(next == -1 && cursor < vertex_count) { //...or resume the input order
+      if(live[cursor] > 0) next = cursor;
+      cursor++;
+    }
+    fanning = next;
+  }
+
+  memcpy(indices, output, index_count*sizeof(uint32_t));
+
+  free(live);
+  free(offsets);
+  free(adjacency);
+  free(time_stamps);
+  free(dead_end);
+  free(candidates);
+  free(emitted);
+  free(output);
+}
+
+// Renumbers vertices in order of first reference so the vertex fetch walks the VBO forwards
+void ReorderVerticesByFirstUse(float *positions, float *normals, unsigned char *material_ids, uint32_t *indices, int index_count, int vertex_count)
+{
+  int *remap = (int *) malloc(vertex_count*sizeof(int));
+  float *scratch = (float *) malloc(vertex_count*3*sizeof(float));
+  unsigned char *id_scratch = (unsigned char *) malloc(vertex_count);
+  memset(remap, 0xff, vertex_count*sizeof(int));
+
+  int next = 0;
+  for(int i = 0; i < index_count; i++) {
+    if(remap[indices[i]] == -1) remap[indices[i]] = next++;
+    indices[i] = (uint32_t) remap[indices[i]];
+  }
+
+  float *arrays[2] = { positions, normals };
+  for(int a = 0; a < 2; a++) {
+    for(int v = 0; v < vertex_count; v++) {
+      if(remap[v] >= 0) memcpy(scratch + remap[v]*3, arrays[a] + v*3, 3*sizeof(float));
+    }
+    memcpy(arrays[a], scratch, next*3*sizeof(float));
+  }
+  for(int v = 0; v < vertex_count; v++) {
+    if(remap[v] >= 0) id_scratch[remap[v]] = material_ids[v];
+  }
+  memcpy(material_ids, id_scratch, next);
+
+  free(remap);
+  free(scratch);
+  free(id_scratch);
+}
+
+// Average cache miss ratio: vertex shader invocations per triangle through a cache_size FIFO (3.0 = unindexed)
+float CalculateACMR(const uint32_t *indices, int index_count, int vertex_count, int cache_size)
+{
+  if(index_count == 0) return 0.0f;
+
+  int *entered = (int *) malloc(vertex_count*sizeof(int)); //Miss count at which the vertex entered the FIFO
+  for(int v = 0; v < vertex_count; v++) entered[v] = -cache_size - 1;
+
+  int misses = 0;
+  for(int i = 0; i < index_count; i++) {
+    if(misses - entered[indices[i]] > cache_size) entered[indices[i]] = misses++;
+  }
+
+  free(entered);
+  return (float) misses / (index_count/3);
+}
+
+//----------------------------------------------------------------------------------
+// Level of detail
+//
+// Tiles are often only 60-180 px across, so most triangles of a dense model are sub-pixel. BuildMeshLevels()
+// simplifies the full mesh into a chain of about half the triangles per level and records for each level
+//  - geometric_error: the worst RMS plane distance of any collapse, i.e. how far the surface may have moved
+//  - photometric_error: how much the facet-sum light curve (Lambertian, unshadowed) moved over a fixed set of
+//    sun/viewer pairs, which tracks the area-weighted facet normal distribution the light curve depends on
+// SelectMeshLevel() then takes the coarsest level whose photometric error is within the run's tolerance and whose
+// surface deviation stays under half a pixel at the run's tile size, so cost follows pixels rather than source density.
+//----------------------------------------------------------------------------------
+void BuildMeshLevels(LCMeshChain *chain)
+{
+  LCPreparedMesh *full = &chain->levels[0];
+  chain->level_count = 1;
+  if(full->index_count/3 < 2*LC_LOD_MIN_TRIANGLES) return;
+
+  double reference[LC_LOD_PROBE_COUNT], curve[LC_LOD_PROBE_COUNT];
+  CalculateFacetSumCurve(full, reference);
+  double reference_mean = 0.0;
+  for(int i = 0; i < LC_LOD_PROBE_COUNT; i++) reference_mean += reference[i] / LC_LOD_PROBE_COUNT;
+
+  LCSimplifier simplifier;
+  if(!InitSimplifier(&simplifier, full)) {
+    TraceLog(LOG_WARNING, "MESH: Could not allocate the simplifier, no levels of detail");
+    return;
+  }
+
+  int target = full->index_count/3;
+  while(chain->level_count < LC_LOD_MAX_LEVELS && (target /= 2) >= LC_LOD_MIN_TRIANGLES) {
+    int before = simplifier.live_triangles;
+    SimplifyToTriangleCount(&simplifier, target);
+    if(simplifier.live_triangles > before - before/4) break; //Remaining collapses are blocked by the link and flip tests
+
+    LCPreparedMesh *level = &chain->levels[chain->level_count];
+    if(!SnapshotSimplifier(&simplifier, full, level)) break;
+
+    CalculateFacetSumCurve(level, curve);
+    double squared_error = 0.0;
+    for(int i = 0; i < LC_LOD_PROBE_COUNT; i++) squared_error += (curve[i] - reference[i]) * (curve[i] - reference[i]) / LC_LOD_PROBE_COUNT;
+    level->photometric_error = (reference_mean > 0.0) ? (float) (sqrt(squared_error) / reference_mean) : 0.0f;
+
+    TraceLog(LOG_INFO, "MESH: LOD %d: %d triangles, %d vertices, deviation %.3g, facet-sum error %.3g, ACMR %.3f", chain->level_count,
+             level->index_count/3, level->vertex_count, level->geometric_error, level->photometric_error, level->acmr_optimized);
+    chain->level_count++;
+  }
+
+  UnloadSimplifier(&simplifier);
+}
+
+int SelectMeshLevel(const LCMeshLevelInfo *levels, int level_count, float bounding_radius, int tile_pixels, float lod_tolerance)
+{
+  if(lod_tolerance <= 0.0f || bounding_radius <= 0.0f || tile_pixels <= 0) return 0;
+
+  float pixels_per_unit = 0.5f * tile_pixels / bounding_radius; //The scale factor fits the bounding radius into half a tile
+  int selected = 0;
+  for(int l = 1; l < level_count; l++) { //Errors only grow down the chain
+    if(levels[l].photometric_error > lod_tolerance || levels[l].geometric_error * pixels_per_unit > LC_LOD_MAX_PIXEL_ERROR) break;
+    selected = l;
+  }
+
+  float visible_pixels = 0.25f * PI * tile_pixels * tile_pixels; //Disc of the bounding radius, about half the facets face the viewer
+  TraceLog(LOG_INFO, "MESH: LOD %d of %d for %d px tiles: %u triangles, %.2f px per facet, deviation %.2f px, predicted error %.2e (tolerance %.2e)",
+           selected, level_count - 1, tile_pixels, levels[selected].index_count/3, visible_pixels / (0.5f * levels[selected].index_count/3),
+           levels[selected].geometric_error * pixels_per_unit, levels[selected].photometric_error, lod_tolerance);
+  return selected;
+}
+
+// Sum over facets of reflectance * area * max(0, n.s) * max(0, n.v) for LC_LOD_PROBE_COUNT fixed sun/viewer pairs
+void CalculateFacetSumCurve(const LCPreparedMesh *mesh, double curve[LC_LOD_PROBE_COUNT])
+{
+  Vector3 sun[LC_LOD_PROBE_COUNT], viewer[LC_LOD_PROBE_COUNT];
+  for(int i = 0; i < LC_LOD_PROBE_COUNT; i++) {
+    sun[i] = LCFibonacciDirection(i, LC_LOD_PROBE_COUNT);
+    viewer[i] = LCFibonacciDirection((i*37 + 11) % LC_LOD_PROBE_COUNT, LC_LOD_PROBE_COUNT); //37 is coprime to the count: a permutation, all phase angles
+    curve[i] = 0.0;
+  }
+
+  for(int t = 0; t < mesh->index_count/3; t++) {
+    const float *a = mesh->positions + mesh->indices[t*3 + 0]*3;
+    const float *b = mesh->positions + mesh->indices[t*3 + 1]*3;
+    const float *c = mesh->positions + mesh->indices[t*3 + 2]*3;
+    Vector3 n = Vector3CrossProduct((Vector3) { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, (Vector3) { c[0] - a[0], c[1] - a[1], c[2] - a[2] });
+    float length = Vector3Length(n);
+    if(length == 0.0f) continue;
+
+    unsigned char material_id = mesh->material_ids[mesh->indices[t*3]];
+    float weight = ((material_id < mesh->material_count) ? mesh->reflectance[material_id] : 1.0f) / (2.0f * length); //|n| = 2 area
+    for(int i = 0; i < LC_LOD_PROBE_COUNT; i++) {
+      float ns = Vector3DotProduct(n, sun[i]);
+      float nv = Vector3DotProduct(n, viewer[i]);
+      if(ns > 0.0f && nv > 0.0f) curve[i] += weight * ns * nv;
+    }
+  }
+}
+
+Vector3 LCFibonacciDirection(int i, int n) //Near-uniform point i of n on the unit sphere
+{
+  float z = 1.0f - (2.0f*i + 1.0f) / n;
+  float r = sqrtf(1.0f - z*z);
+  float phi = 2.39996323f * i;             //Golden angle
+  return (Vector3) { r * cosf(phi), r * sinf(phi), z };
+}
+
+bool InitSimplifier(LCSimplifier *simplifier, const LCPreparedMesh *source)
+{
+  LCSimplifier *s = simplifier;
+  memset(s, 0, sizeof(LCSimplifier));
+  int source_vertices = source->vertex_count;
+  s->triangle_count = source->index_count/3;
+
+  s->positions = (float *) malloc(source_vertices*3*sizeof(float));
+  s->material_ids = (unsigned char *) malloc(source_vertices);
+  s->triangles = (int *) malloc(source->index_count*sizeof(int));
+  float *unused_normals = (float *) calloc(source_vertices*3, sizeof(float));
+  int *remap = (int *) malloc(source_vertices*sizeof(int));
+  LCWeldTable weld = { 0 };
+  bool ok = s->positions != NULL && s->material_ids != NULL && s->triangles != NULL && unused_normals != NULL && remap != NULL &&
+            InitWeldTable(&weld, source_vertices, s->positions, unused_normals, s->material_ids);
+
+  if(ok) { //Re-weld by position and material only, so facets split by their normals become connected again
+    for(int v = 0; v < source_vertices; v++) {
+      float corner[6] = { source->positions[v*3], source->positions[v*3 + 1], source->positions[v*3 + 2], 0.0f, 0.0f, 0.0f };
+      remap[v] = (int) WeldCorner(&weld, corner, source->material_ids[v]);
+    }
+    for(int i = 0; i < source->index_count; i++) s->triangles[i] = remap[source->indices[i]];
+    s->vertex_count = weld.vertex_count;
+  }
+  free(weld.slots);
+  free(unused_normals);
+  free(remap);
+
+  int vertex_count = s->vertex_count;
+  s->quadrics = (double *) calloc(vertex_count*11, sizeof(double));
+  s->versions = (unsigned int *) calloc(vertex_count, sizeof(unsigned int));
+  s->vertex_removed = (bool *) calloc(vertex_count, sizeof(bool));
+  s->vertex_triangles = (int **) calloc(vertex_count, sizeof(int *));
+  s->vertex_triangle_counts = (int *) calloc(vertex_count, sizeof(int));
+  s->vertex_triangle_capacities = (int *) calloc(vertex_count, sizeof(int));
+  s->marks = (int *) calloc(vertex_count, sizeof(int));
+  s->triangle_removed = (bool *) calloc(s->triangle_count, sizeof(bool));
+  uint64_t *edges = (uint64_t *) malloc(source->index_count*sizeof(uint64_t)); //(min << 32 | max), sorted to find shared edges
+  int *edge_triangles = (int *) malloc(source->index_count*sizeof(int));
+  ok = ok && s->quadrics != NULL && s->versions != NULL && s->vertex_removed != NULL && s->vertex_triangles != NULL &&
+       s->vertex_triangle_counts != NULL && s->vertex_triangle_capacities != NULL && s->marks != NULL && s->triangle_removed != NULL &&
+       edges != NULL && edge_triangles != NULL;
+
+  if(!ok) {
+    free(edges);
+    free(edge_triangles);
+    UnloadSimplifier(s);
+    return false;
+  }
+
+  s->live_triangles = s->triangle_count;
+  for(int t = 0; t < s->triangle_count; t++) {
+    int *tri = s->triangles + t*3;
+    if(tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) { //Collapsed by the position weld
+      s->triangle_removed[t] = true;
+      s->live_triangles--;
+      continue;
+    }
+    for(int k = 0; k < 3; k++) s->vertex_triangle_counts[tri[k]]++;
+  }
+  for(int v = 0; v < vertex_count; v++) {
+    s->vertex_triangle_capacities[v] = s->vertex_triangle_counts[v] + 4;
+    s->vertex_triangles[v] = (int *) malloc(s->vertex_triangle_capacities[v]*sizeof(int));
+    s->vertex_triangle_counts[v] = 0;
+  }
+
+  int edge_count = 0;
+  for(int t = 0; t < s->triangle_count; t++) {
+    if(s->triangle_removed[t]) continue;
+    int *tri = s->triangles + t*3;
+    const float *p[3] = { s->positions + tri[0]*3, s->positions + tri[1]*3, s->positions + tri[2]*3 };
+    Vector3 n = Vector3CrossProduct((Vector3) { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] },
+                                    (Vector3) { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] });
+    float area = 0.5f * Vector3Length(n);
+    n = Vector3Normalize(n);
+    float d = -(n.x*p[0][0] + n.y*p[0][1] + n.z*p[0][2]);
+
+    for(int k = 0; k < 3; k++) {
+      int v = tri[k];
+      s->vertex_triangles[v][s->vertex_triangle_counts[v]++] = t;
+      LCAddPlaneQuadric(s->quadrics + v*11, n, d, area, area);
+
+      int a = tri[k], b = tri[(k + 1) % 3];
+      edges[edge_count] = (a < b) ? ((uint64_t) a << 32 | (uint32_t) b) : ((uint64_t) b << 32 | (uint32_t) a);
+      edge_triangles[edge_count++] = t;
+    }
+  }
+
+  //Sort edge keys with their triangles (radix sort would do, but this runs once per cache miss)
+  int *order = (int *) malloc(edge_count*sizeof(int));
+  for(int i = 0; i < edge_count; i++) order[i] = i;
+  for(int gap = edge_count/2; gap > 0; gap /= 2) { //Shell sort on the edge keys
+    for(int i = gap; i < edge_count; i++) {
+      int moving = order[i], j = i;
+      while(j >= gap && edges[order[j - gap]] > edges[moving]) {
+        order[j] = order[j - gap];
+        j -= gap;
+      }
+      order[j] = moving;
+    }
+  }
+
+  for(int i = 0; i < edge_count; ) {
+    int j = i + 1;
+    while(j < edge_count && edges[order[j]] == edges[order[i]]) j++;
+    int a = (int) (edges[order[i]] >> 32), b = (int) (edges[order[i]] & 0xffffffffu);
+
+    if(j - i == 1) { //Open edge or material seam: a plane through the edge, perpendicular to its facet, keeps it in place
+      int *tri = s->triangles + edge_triangles[order[i]]*3;
+      const float *p[3] = { s->positions + tri[0]*3, s->positions + tri[1]*3, s->positions + tri[2]*3 };
+      Vector3 n = Vector3Normalize(Vector3CrossProduct((Vector3) { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] },
+                                                       (Vector3) { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] }));
+      Vector3 pa = { s->positions[a*3], s->positions[a*3 + 1], s->positions[a*3 + 2] };
+      Vector3 edge = Vector3Subtract((Vector3) { s->positions[b*3], s->positions[b*3 + 1], s->positions[b*3 + 2] }, pa);
+      Vector3 m = Vector3Normalize(Vector3CrossProduct(edge, n));
+      double weight = LC_LOD_BOUNDARY_WEIGHT * Vector3DotProduct(edge, edge);
+      LCAddPlaneQuadric(s->quadrics + a*11, m, -Vector3DotProduct(m, pa), weight, 0.0);
+      LCAddPlaneQuadric(s->quadrics + b*11, m, -Vector3DotProduct(m, pa), weight, 0.0);
+    }
+    LCPushCollapse(s, a, b);
+    i = j;
+  }
+
+  free(order);
+  free(edges);
+  free(edge_triangles);
+  return true;
+}
+
+void UnloadSimplifier(LCSimplifier *simplifier)
+{
+  for(int v = 0; simplifier->vertex_triangles != NULL && v < simplifier->vertex_count; v++) free(simplifier->vertex_triangles[v]);
+  free(simplifier->vertex_triangles);
+  free(simplifier->vertex_triangle_counts);
+  free(simplifier->vertex_triangle_capacities);
+  free(simplifier->positions);
+  free(simplifier->material_ids);
+  free(simplifier->quadrics);
+  free(simplifier->versions);
+  free(simplifier->vertex_removed);
+  free(simplifier->marks);
+  free(simplifier->triangles);
+  free(simplifier->triangle_removed);
+  free(simplifier->heap);
+  memset(simplifier, 0, sizeof(LCSimplifier));
+}
+
+void SimplifyToTriangleCount(LCSimplifier *simplifier, int target_triangles)
+{
+  while(simplifier->live_triangles > target_triangles && simplifier->heap_count > 0) {
+    LCCollapse collapse = LCPopCollapse(simplifier);
+    if(simplifier->vertex_removed[collapse.v0] || simplifier->vertex_removed[collapse.v1] ||
+       simplifier->versions[collapse.v0] != collapse.version0 || simplifier->versions[collapse.v1] != collapse.version1) continue; //Stale
+    LCApplyCollapse(simplifier, collapse);
+  }
+}
+
+// Copies the live triangles out as a prepared mesh, welded and cache-ordered like level 0. Corner normals average
+// the neighbouring facets within the crease angle, so curved surfaces stay smooth and hard edges stay hard.
+bool SnapshotSimplifier(const LCSimplifier *simplifier, const LCPreparedMesh *source, LCPreparedMesh *level)
+{
+  const LCSimplifier *s = simplifier;
+  memset(level, 0, sizeof(LCPreparedMesh));
+  int index_count = s->live_triangles*3;
+
+  level->positions = (float *) MemAlloc(index_count*3*sizeof(float));
+  level->normals = (float *) malloc(index_count*3*sizeof(float));
+  level->material_ids = (unsigned char *) malloc(index_count);
+  level->indices = (uint32_t *) malloc(index_count*sizeof(uint32_t));
+  Vector3 *facet_normals = (Vector3 *) malloc(s->triangle_count*sizeof(Vector3));
+  float *facet_areas = (float *) malloc(s->triangle_count*sizeof(float));
+  LCWeldTable weld = { 0 };
+  if(level->positions == NULL || level->normals == NULL || level->material_ids == NULL || level->indices == NULL || facet_normals == NULL ||
+     facet_areas == NULL || !InitWeldTable(&weld, index_count, level->positions, level->normals, level->material_ids)) {
+    free(facet_normals);
+    free(facet_areas);
+    UnloadPreparedMesh(level);
+    return false;
+  }
+
+  for(int t = 0; t < s->triangle_count; t++) {
+    if(s->triangle_removed[t]) continue;
+    const int *tri = s->triangles + t*3;
+    const float *p[3] = { s->positions + tri[0]*3, s->positions + tri[1]*3, s->positions + tri[2]*3 };
+    Vector3 n = Vector3CrossProduct((Vector3) { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] },
+                                    (Vector3) { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] });
+    facet_areas[t] = 0.5f * Vector3Length(n);
+    facet_normals[t] = Vector3Normalize(n);
+  }
+
+  int corner_count = 0;
+  for(int t = 0; t < s->triangle_count; t++) {
+    if(s->triangle_removed[t]) continue;
+    const int *tri = s->triangles + t*3;
+    for(int k = 0; k < 3; k++) {
+      int v = tri[k];
+      Vector3 n = { 0 };
+      for(int i = 0; i < s->vertex_triangle_counts[v]; i++) { //Same order for every corner of v, so equal sums weld bit-identically
+        int u = s->vertex_triangles[v][i];
+        if(!s->triangle_removed[u] && Vector3DotProduct(facet_normals[u], facet_normals[t]) >= LC_LOD_CREASE_COSINE) {
+          n = Vector3Add(n, Vector3Scale(facet_normals[u], facet_areas[u]));
+        }
+      }
+      n = Vector3Normalize(n);
+
+      float corner[6] = { s->positions[v*3], s->positions[v*3 + 1], s->positions[v*3 + 2], n.x, n.y, n.z };
+      level->indices[corner_count++] = WeldCorner(&weld, corner, s->material_ids[v]);
+    }
+  }
+  free(facet_normals);
+  free(facet_areas);
+  free(weld.slots);
+
+  level->vertex_count = weld.vertex_count;
+  level->index_count = index_count;
+  level->material_count = source->material_count;
+  memcpy(level->reflectance, source->reflectance, sizeof(level->reflectance));
+  level->geometric_error = s->max_error;
+
+  level->acmr_welded = CalculateACMR(level->indices, index_count, level->vertex_count, LC_VERTEX_CACHE_SIZE);
+  OptimizeVertexCache(level->indices, index_count, level->vertex_count, LC_VERTEX_CACHE_SIZE);
+  ReorderVerticesByFirstUse(level->positions, level->normals, level->material_ids, level->indices, index_count, level->vertex_count);
+  level->acmr_optimized = CalculateACMR(level->indices, index_count, level->vertex_count, LC_VERTEX_CACHE_SIZE);
+  return true;
+}
+
+// Quadric layout: aa ab ac ad bb bc bd cc cd dd for the plane ax + by + cz + d = 0, then the facet area behind it
+void LCAddPlaneQuadric(double *quadric, Vector3 normal, float d, double weight, double area)
+{
+  double plane[4] = { normal.x, normal.y, normal.z, d };
+  int k = 0;
+  for(int i = 0; i < 4; i++) {
+    for(int j = i; j < 4; j++) quadric[k++] += weight * plane[i] * plane[j];
+  }
+  quadric[10] += area;
+}
+
+double LCQuadricError(const double *q, const float *point)
+{
+  double x = point[0], y = point[1], z = point[2];
+  return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y + q[7]*z*z + 2*q[8]*z + q[9];
+}
+
+// Cost and target of collapsing v1 onto v0: the quadric minimum when it is well conditioned, else the best of
+// the endpoints and the midpoint
+void LCEvaluateCollapse(LCSimplifier *simplifier, int v0, int v1, LCCollapse *collapse)
+{
+  double q[11];
+  for(int k = 0; k < 11; k++) q[k] = simplifier->quadrics[v0*11 + k] + simplifier->quadrics[v1*11 + k];
+
+  const float *p0 = simplifier->positions + v0*3;
+  const float *p1 = simplifier->positions + v1*3;
+  float candidates[4][3] = { { p0[0], p0[1], p0[2] }, { p1[0], p1[1], p1[2] },
+                             { 0.5f*(p0[0] + p1[0]), 0.5f*(p0[1] + p1[1]), 0.5f*(p0[2] + p1[2]) }, { 0 } };
+  int candidate_count = 3;
+
+  double det = q[0]*(q[4]*q[7] - q[5]*q[5]) - q[1]*(q[1]*q[7] - q[5]*q[2]) + q[2]*(q[1]*q[5] - q[4]*q[2]);
+  double trace = q[0] + q[4] + q[7];
+  if(fabs(det) > 1e-9 * trace*trace*trace) { //Cramer's rule on A x = -b
+    double b[3] = { -q[3], -q[6], -q[8] };
+    double x = (b[0]*(q[4]*q[7] - q[5]*q[5]) - q[1]*(b[1]*q[7] - q[5]*b[2]) + q[2]*(b[1]*q[5] - q[4]*b[2])) / det;
+    double y = (q[0]*(b[1]*q[7] - b[2]*q[5]) - b[0]*(q[1]*q[7] - q[5]*q[2]) + q[2]*(q[1]*b[2] - b[1]*q[2])) / det;
+    double z = (q[0]*(q[4]*b[2] - q[5]*b[1]) - q[1]*(q[1]*b[2] - b[1]*q[2]) + b[0]*(q[1]*q[5] - q[4]*q[2])) / det;
+    float target[3] = { (float) x, (float) y, (float) z };
+    float edge_length = sqrtf((p1[0] - p0[0])*(p1[0] - p0[0]) + (p1[1] - p0[1])*(p1[1] - p0[1]) + (p1[2] - p0[2])*(p1[2] - p0[2]));
+    float from_midpoint = sqrtf((target[0] - candidates[2][0])*(target[0] - candidates[2][0]) + (target[1] - candidates[2][1])*(target[1] - candidates[2][1]) +
+                                (target[2] - candidates[2][2])*(target[2] - candidates[2][2]));
+    if(from_midpoint <= 2.0f*edge_length) memcpy(candidates[candidate_count++], target, sizeof(target)); //Far targets come from near-degenerate quadrics
+  }
+
+  double best = INFINITY;
+  for(int i = 0; i < candidate_count; i++) {
+    double error = LCQuadricError(q, candidates[i]);
+    if(error < best) {
+      best = error;
+      memcpy(collapse->target, candidates[i], sizeof(collapse->target));
+    }
+  }
+
+  collapse->cost = (float) fmax(best, 0.0);
+  collapse->v0 = v0;
+  collapse->v1 = v1;
+  collapse->version0 = simplifier->versions[v0];
+  collapse->version1 = simplifier->versions[v1];
+}
+
+// Rejects collapses that would make the surface non-manifold (link condition) or fold a facet over
+bool LCApplyCollapse(LCSimplifier *simplifier, LCCollapse collapse)
+{
+  LCSimplifier *s = simplifier;
+  int v0 = collapse.v0, v1 = collapse.v1;
+
+  s->mark += 2; //mark: neighbour of v0, mark + 1: neighbour of both
+  for(int i = 0; i < s->vertex_triangle_counts[v0]; i++) {
+    int t = s->vertex_triangles[v0][i];
+    if(s->triangle_removed[t]) continue;
+    for(int k = 0; k < 3; k++) s->marks[s->triangles[t*3 + k]] = s->mark;
+  }
+  int shared_vertices = 0, shared_triangles = 0;
+  for(int i = 0; i < s->vertex_triangle_counts[v1]; i++) {
+    int t = s->vertex_triangles[v1][i];
+    if(s->triangle_removed[t]) continue;
+    const int *tri = s->triangles + t*3;
+    if(tri[0] == v0 || tri[1] == v0 || tri[2] == v0) shared_triangles++;
+    for(int k = 0; k < 3; k++) {
+      int w = tri[k];
+      if(w != v0 && w != v1 && s->marks[w] == s->mark) {
+        s->marks[w] = s->mark + 1;
+        shared_vertices++;
+      }
+    }
+  }
+  if(shared_vertices != shared_triangles) return false;
+
+  int ends[2] = { v0, v1 };
+  for(int e = 0; e < 2; e++) {
+    for(int i = 0; i < s->vertex_triangle_counts[ends[e]]; i++) {
+      int t = s->vertex_triangles[ends[e]][i];
+      const int *tri = s->triangles + t*3;
+      bool has0 = tri[0] == v0 || tri[1] == v0 || tri[2] == v0;
+      bool has1 = tri[0] == v1 || tri[1] == v1 || tri[2] == v1;
+      if(s->triangle_removed[t] || (has0 && has1)) continue;
+
+      float before[3][3], after[3][3];
+      for(int k = 0; k < 3; k++) {
+        memcpy(before[k], s->positions + tri[k]*3, sizeof(before[k]));
+        if(tri[k] == v0 || tri[k] == v1) memcpy(after[k], collapse.target, sizeof(after[k]));
+        else memcpy(after[k], before[k], sizeof(after[k]));
+      }
+      Vector3 n_before = Vector3CrossProduct((Vector3) { before[1][0] - before[0][0], before[1][1] - before[0][1], before[1][2] - before[0][2] },
+                                             (Vector3) { before[2][0] - before[0][0], before[2][1] - before[0][1], before[2][2] - before[0][2] });
+      Vector3 n_after = Vector3CrossProduct((Vector3) { after[1][0] - after[0][0], after[1][1] - after[0][1], after[1][2] - after[0][2] },
+                                            (Vector3) { after[2][0] - after[0][0], after[2][1] - after[0][1], after[2][2] - after[0][2] });
+      float lengths = Vector3Length(n_before) * Vector3Length(n_after);
+      if(lengths == 0.0f || Vector3DotProduct(n_before, n_after) < LC_LOD_MIN_FLIP_COSINE * lengths) return false;
+    }
+  }
+
+  memcpy(s->positions + v0*3, collapse.target, sizeof(collapse.target));
+  for(int k = 0; k < 11; k++) s->quadrics[v0*11 + k] += s->quadrics[v1*11 + k];
+  s->vertex_removed[v1] = true;
+  s->versions[v0]++;
+  double area = s->quadrics[v0*11 + 10];
+  if(area > 0.0) s->max_error = fmaxf(s->max_error, (float) sqrt(collapse.cost / area));
+
+  for(int i = 0; i < s->vertex_triangle_counts[v1]; i++) {
+    int t = s->vertex_triangles[v1][i];
+    if(s->triangle_removed[t]) continue;
+    int *tri = s->triangles + t*3;
+    if(tri[0] == v0 || tri[1] == v0 || tri[2] == v0) {
+      s->triangle_removed[t] = true;
+      s->live_triangles--;
+      continue;
+    }
+    for(int k = 0; k < 3; k++) if(tri[k] == v1) tri[k] = v0;
+
+    if(s->vertex_triangle_counts[v0] == s->vertex_triangle_capacities[v0]) {
+      s->vertex_triangle_capacities[v0] *= 2;
+      s->vertex_triangles[v0] = (int *) realloc(s->vertex_triangles[v0], s->vertex_triangle_capacities[v0]*sizeof(int));
+    }
+    s->vertex_triangles[v0][s->vertex_triangle_counts[v0]++] = t;
+  }
+  free(s->vertex_triangles[v1]);
+  s->vertex_triangles[v1] = NULL;
+  s->vertex_triangle_counts[v1] = 0;
+
+  int kept = 0;
+  for(int i = 0; i < s->vertex_triangle_counts[v0]; i++) {
+    if(!s->triangle_removed[s->vertex_triangles[v0][i]]) s->vertex_triangles[v0][kept++] = s->vertex_triangles[v0][i];
+  }
+  s->vertex_triangle_counts[v0] = kept;
+
+  s->mark += 2;
+  for(int i = 0; i < kept; i++) {
+    const int *tri = s->triangles + s->vertex_triangles[v0][i]*3;
+    for(int k = 0; k < 3; k++) {
+      if(tri[k] != v0 && s->marks[tri[k]] != s->mark) {
+        s->marks[tri[k]] = s->mark;
+        LCPushCollapse(s, v0, tri[k]);
+      }
+    }
+  }
+  return true;
+}
+
+void LCPushCollapse(LCSimplifier *simplifier, int v0, int v1)
+{
+  LCSimplifier *s = simplifier;
+  if(s->heap_count == s->heap_capacity) {
+    s->heap_capacity = (s->heap_capacity > 0) ? 2*s->heap_capacity : 1024;
+    s->heap = (LCCollapse *) realloc(s->heap, s->heap_capacity*sizeof(LCCollapse));
+  }
+
+  LCCollapse collapse;
+  LCEvaluateCollapse(s, v0, v1, &collapse);
+  int i = s->heap_count++;
+  while(i > 0 && s->heap[(i - 1)/2].cost > collapse.cost) {
+    s->heap[i] = s->heap[(i - 1)/2];
+    i = (i - 1)/2;
+  }
+  s->heap[i] = collapse;
+}
+
+LCCollapse LCPopCollapse(LCSimplifier *simplifier)
+{
+  LCSimplifier *s = simplifier;
+  LCCollapse top = s->heap[0];
+  LCCollapse last = s->heap[--s->heap_count];
+  int i = 0;
+  while(2*i + 1 < s->heap_count) {
+    int child = 2*i + 1;
+    if(child + 1 < s->heap_count && s->heap[child + 1].cost < s->heap[child].cost) child++;
+    if(s->heap[child].cost >= last.cost) break;
+    s->heap[i] = s->heap[child];
+    i = child;
+  }
+  s->heap[i] = last;
+  return top;
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <raylib.h>
+#include <raymath.h>
+
+//----------------------------------------------------------------------------------
+// Procedural test bodies ("Model File procedural:<body>:<resolution>")
+//
+// Built in RAM from a parametric description instead of read from models/, so benchmarks and validation runs do
+// not depend on assets of unknown complexity. Every body is a set of (u, v) grids with analytic normals and
+// counter-clockwise outward faces; the resolution N sets the grid density and with it the triangle count:
+//   cube      2 x 2 x 2 box, N x N quads per face                              12 N^2
+//   sphere    radius 1, N rings of 2N slices (raylib GenMeshSphere layout)     4 N^2 - 4N
+//   cylinder  radius 1, height 2, 4N slices, N stacks, N rings per cap         24 N^2 - 8N
+//   torus     major radius 1, minor 0.4, 2N segments of N sides                4 N^2
+//   boxwing   unit cube bus between two 2 x 1 x 0.02 panels, N x N per face   36 N^2
+//   dish      paraboloid shell, aperture 2, depth 0.5, N rings of 4N segments  16 N^2
+// so cube:1 is the 12 triangle minimum and cube:289 passes 10^6. boxwing and dish are concave: bus and panels shadow
+// each other and the bowl shadows itself. Degenerate triangles (poles, cap and dish centres) are dropped.
+//
+// raylib's GenMesh*() generators are not used: they go through par_shapes with 16-bit indices, which caps a body at
+// 65535 points, and upload to the GPU as they return. The generated mesh here is CPU only until the model is built.
+// Results go through the same preparation, simplification and .lcmesh cache as an OBJ, keyed by the parsed body.
+//----------------------------------------------------------------------------------
+#define LC_PROCEDURAL_PREFIX          "procedural:"
+#define LC_PROCEDURAL_VERSION         1           // Bump when a generator changes, re-keys the mesh cache
+#define LC_PROCEDURAL_MAX_TRIANGLES   (1 << 22)
+#define LC_PROCEDURAL_PANEL_THICKNESS 0.02f
+#define LC_PROCEDURAL_DISH_DEPTH      0.5f
+#define LC_PROCEDURAL_DISH_THICKNESS  0.02f
+#define LC_PROCEDURAL_TORUS_MINOR     0.4f
+
+enum { LC_BODY_CUBE, LC_BODY_SPHERE, LC_BODY_CYLINDER, LC_BODY_TORUS, LC_BODY_BOXWING, LC_BODY_DISH, LC_BODY_COUNT };
+
+typedef struct {
+  int body;                               // LC_BODY_*
+  int resolution;
+} LCProceduralBody;
+
+// Point and outward unit normal at (u, v) in [0, 1]^2; shape holds the surface's parameters
+typedef void (*LCSurfaceFunction)(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+
+typedef struct {
+  float *vertices;                        // MemAlloc'd, unindexed triangles as GenMesh*() leaves them
+  float *normals;
+  int triangle_count;
+  int capacity;                           // Triangles
+} LCMeshBuilder;
+
+bool IsProceduralModel(const char *model_name);
+bool ParseProceduralBody(const char *model_name, LCProceduralBody *body);
+int ProceduralTriangleCapacity(LCProceduralBody body);
+Mesh GenProceduralMesh(LCProceduralBody body);
+LightCurveModel LoadProceduralLightCurveModel(LCProceduralBody body, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor);
+void LCEmitSurface(LCMeshBuilder *builder, LCSurfaceFunction surface, const float *shape, int u_steps, int v_steps);
+void LCEmitBox(LCMeshBuilder *builder, Vector3 center, Vector3 half_extents, int steps);
+void LCPlaneSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCSphereSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCCylinderSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCDiskSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCTorusSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCParaboloidSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+void LCDishRimSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal);
+float LCTurnAngle(float t);
+
+static const char *lc_body_names[LC_BODY_COUNT] = { "cube", "sphere", "cylinder", "torus", "boxwing", "dish" };
+static const int lc_body_min_resolution[LC_BODY_COUNT] = { 1, 2, 1, 3, 1, 1 };
+
+bool IsProceduralModel(const char *model_name)
+{
+  return strncmp(model_name, LC_PROCEDURAL_PREFIX, strlen(LC_PROCEDURAL_PREFIX)) == 0;
+}
+
+bool ParseProceduralBody(const char *model_name, LCProceduralBody *body)
+{
+  const char *name = model_name + strlen(LC_PROCEDURAL_PREFIX);
+  const char *separator = strchr(name, ':');
+  body->body = -1;
+  for(int b = 0; separator != NULL && b < LC_BODY_COUNT; b++) {
+    if(strlen(lc_body_names[b]) == (size_t) (separator - name) && strncmp(name, lc_body_names[b], separator - name) == 0) body->body = b;
+  }
+  if(body->body < 0) {
+    TraceLog(LOG_ERROR, "BODY: [%s] Expected procedural:<body>:<resolution> with body cube, sphere, cylinder, torus, boxwing or dish", model_name);
+    return false;
+  }
+
+  char *end;
+  long resolution = strtol(separator + 1, &end, 10);
+  if(end == separator + 1 || *end != '\0' || resolution < lc_body_min_resolution[body->body] || resolution > 65536) {
+    TraceLog(LOG_ERROR, "BODY: [%s] Resolution must be an integer of at least %d", model_name, lc_body_min_resolution[body->body]);
+    return false;
+  }
+  body->resolution = (int) resolution;
+
+  if(ProceduralTriangleCapacity(*body) > LC_PROCEDURAL_MAX_TRIANGLES) {
+    TraceLog(LOG_ERROR, "BODY: [%s] More than %d triangles", model_name, LC_PROCEDURAL_MAX_TRIANGLES);
+    return false;
+  }
+  return true;
+}
+
+int ProceduralTriangleCapacity(LCProceduralBody body) //Before degenerate triangles are dropped, saturates past the limit
+{
+  long long n = body.resolution;
+  long long triangles[LC_BODY_COUNT] = { 12*n*n, 4*n*n, 24*n*n, 4*n*n, 36*n*n, 16*n*n };
+  return (triangles[body.body] > LC_PROCEDURAL_MAX_TRIANGLES) ? LC_PROCEDURAL_MAX_TRIANGLES + 1 : (int) triangles[body.body];
+}
+
+// CPU only, no GL context needed. Returns a mesh with vertices == NULL if it could not be allocated.
+Mesh GenProceduralMesh(LCProceduralBody body)
+{
+  Mesh mesh = { 0 };
+  LCMeshBuilder builder = { 0 };
+  builder.capacity = ProceduralTriangleCapacity(body);
+  builder.vertices = (float *) MemAlloc(builder.capacity*9*sizeof(float));
+  builder.normals = (float *) MemAlloc(builder.capacity*9*sizeof(float));
+  if(builder.vertices == NULL || builder.normals == NULL) {
+    TraceLog(LOG_WARNING, "BODY: Could not allocate %d triangles", builder.capacity);
+    MemFree(builder.vertices);
+    MemFree(builder.normals);
+    return mesh;
+  }
+
+  int n = body.resolution;
+  switch(body.body) {
+    case LC_BODY_CUBE:
+      LCEmitBox(&builder, Vector3Zero(), (Vector3) { 1.0f, 1.0f, 1.0f }, n);
+      break;
+    case LC_BODY_SPHERE: {
+      float shape[] = { 1.0f };
+      LCEmitSurface(&builder, LCSphereSurface, shape, 2*n, n);
+    } break;
+    case LC_BODY_CYLINDER: {
+      float side[] = { 1.0f, 2.0f };
+      float bottom[] = { 1.0f, -1.0f }, top[] = { 1.0f, 1.0f }; //Radius, height of the cap (its sign is the normal)
+      LCEmitSurface(&builder, LCCylinderSurface, side, 4*n, n);
+      LCEmitSurface(&builder, LCDiskSurface, bottom, 4*n, n);
+      LCEmitSurface(&builder, LCDiskSurface, top, 4*n, n);
+    } break;
+    case LC_BODY_TORUS: {
+      float shape[] = { 1.0f, LC_PROCEDURAL_TORUS_MINOR };
+      LCEmitSurface(&builder, LCTorusSurface, shape, 2*n, n);
+    } break;
+    case LC_BODY_BOXWING: {
+      Vector3 panel = { 1.0f, 0.5f, 0.5f*LC_PROCEDURAL_PANEL_THICKNESS };
+      LCEmitBox(&builder, Vector3Zero(), (Vector3) { 0.5f, 0.5f, 0.5f }, n);
+      LCEmitBox(&builder, (Vector3) { -1.75f, 0.0f, 0.0f }, panel, n);
+      LCEmitBox(&builder, (Vector3) { 1.75f, 0.0f, 0.0f }, panel, n);
+    } break;
+    case LC_BODY_DISH: {
+      // Aperture radius, depth and the shell's z offset: the bowl faces +z, the outer skin sits one thickness below
+      float inner[] = { 1.0f, LC_PROCEDURAL_DISH_DEPTH, -0.5f*LC_PROCEDURAL_DISH_DEPTH, 1.0f };
+      float outer[] = { 1.0f, LC_PROCEDURAL_DISH_DEPTH, -0.5f*LC_PROCEDURAL_DISH_DEPTH - LC_PROCEDURAL_DISH_THICKNESS, -1.0f };
+      float rim[] = { 1.0f, 0.5f*LC_PROCEDURAL_DISH_DEPTH, LC_PROCEDURAL_DISH_THICKNESS };
+      LCEmitSurface(&builder, LCParaboloidSurface, inner, 4*n, n);
+      LCEmitSurface(&builder, LCParaboloidSurface, outer, 4*n, n);
+      LCEmitSurface(&builder, LCDishRimSurface, rim, 4*n, 1);
+    } break;
+  }
+
+  mesh.vertices = builder.vertices;
+  mesh.normals = builder.normals;
+  mesh.triangleCount = builder.triangle_count;
+  mesh.vertexCount = builder.triangle_count*3;
+  return mesh;
+}
+
+// LoadLightCurveModel() for a parsed procedural body: same cache, preparation and level of detail selection
+LightCurveModel LoadProceduralLightCurveModel(LCProceduralBody body, Camera cam, int instances, int tile_pixels, float lod_tolerance, float *mesh_scale_factor)
+{
+  LightCurveModel lc_model = { 0 };
+  char name[64];
+  snprintf(name, sizeof(name), "%s%s:%d", LC_PROCEDURAL_PREFIX, lc_body_names[body.body], body.resolution);
+
+  int32_t key[3] = { LC_PROCEDURAL_VERSION, body.body, body.resolution };
+  uint64_t source_hash = HashBytes(HashFileContents((const unsigned char *) LC_PROCEDURAL_PREFIX, strlen(LC_PROCEDURAL_PREFIX)),
+                                   (const unsigned char *) key, sizeof(key));
+
+  char cache_file[MAX_FNAME_LENGTH + 64];
+  snprintf(cache_file, sizeof(cache_file), "%s/%016llx.lcmesh", LC_MESH_CACHE_DIR, (unsigned long long) source_hash);
+
+  if(LoadMeshCache(cache_file, source_hash, cam, instances, tile_pixels, lod_tolerance, &lc_model, mesh_scale_factor)) {
+    TraceLog(LOG_INFO, "MESH: [%s] Loaded from cache %s", name, cache_file);
+    return lc_model;
+  }
+
+  Mesh mesh = GenProceduralMesh(body);
+  if(mesh.vertices == NULL) return lc_model;  //meshCount 0
+  TraceLog(LOG_INFO, "BODY: [%s] Generated %d triangles", name, mesh.triangleCount);
+  return BuildLightCurveModel(LoadModelFromMesh(mesh), name, cache_file, source_hash, cam, instances, tile_pixels, lod_tolerance, mesh_scale_factor);
+}
+
+// u_steps x v_steps quads, two triangles each, wound so that (dP/du x dP/dv) faces out
+void LCEmitSurface(LCMeshBuilder *builder, LCSurfaceFunction surface, const float *shape, int u_steps, int v_steps)
+{
+  for(int j = 0; j < v_steps; j++) {
+    for(int i = 0; i < u_steps; i++) {
+      Vector3 p[4], n[4];
+      surface(shape, (float) i / u_steps, (float) j / v_steps, &p[0], &n[0]);
+      surface(shape, (float) (i + 1) / u_steps, (float) j / v_steps, &p[1], &n[1]);
+      surface(shape, (float) (i + 1) / u_steps, (float) (j + 1) / v_steps, &p[2], &n[2]);
+      surface(shape, (float) i / u_steps, (float) (j + 1) / v_steps, &p[3], &n[3]);
+
+      static const int corners[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+      for(int t = 0; t < 2; t++) {
+        Vector3 a = p[corners[t][0]], b = p[corners[t][1]], c = p[corners[t][2]];
+        Vector3 cross = Vector3CrossProduct(Vector3Subtract(b, a), Vector3Subtract(c, a));
+        if(Vector3Length(cross) < 1e-12f) continue; //Collapsed quad edge: pole or centre
+        if(builder->triangle_count == builder->capacity) return;
+
+        float *vertices = builder->vertices + builder->triangle_count*9;
+        float *normals = builder->normals + builder->triangle_count*9;
+        for(int k = 0; k < 3; k++) {
+          Vector3 point = p[corners[t][k]], normal = n[corners[t][k]];
+          vertices[k*3 + 0] = point.x; vertices[k*3 + 1] = point.y; vertices[k*3 + 2] = point.z;
+          normals[k*3 + 0] = normal.x; normals[k*3 + 1] = normal.y; normals[k*3 + 2] = normal.z;
+        }
+        builder->triangle_count++;
+      }
+    }
+  }
+}
+
+void LCEmitBox(LCMeshBuilder *builder, Vector3 center, Vector3 half_extents, int steps)
+{
+  float c[3] = { center.x, center.y, center.z };
+  float h[3] = { half_extents.x, half_extents.y, half_extents.z };
+  for(int axis = 0; axis < 3; axis++) {
+    for(int side = -1; side <= 1; side += 2) {
+      // Origin corner, u edge, v edge and normal; u x v along +axis, swapped on the negative side
+      int a = (axis + 1) % 3, b = (axis + 2) % 3;
+      if(side < 0) { int swap = a; a = b; b = swap; }
+      float shape[12] = { 0 };
+      for(int k = 0; k < 3; k++) shape[k] = c[k] - h[k];
+      shape[axis] = c[axis] + side*h[axis];
+      shape[3 + a] = 2.0f*h[a];
+      shape[6 + b] = 2.0f*h[b];
+      shape[9 + axis] = (float) side;
+      LCEmitSurface(builder, LCPlaneSurface, shape, steps, steps);
+    }
+  }
+}
+
+void LCPlaneSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Origin, u edge, v edge, normal
+{
+  *point = (Vector3) { shape[0] + u*shape[3] + v*shape[6], shape[1] + u*shape[4] + v*shape[7], shape[2] + u*shape[5] + v*shape[8] };
+  *normal = (Vector3) { shape[9], shape[10], shape[11] };
+}
+
+void LCSphereSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Radius; v runs south to north pole
+{
+  float azimuth = LCTurnAngle(u), polar = PI*(1.0f - v);
+  float ring = (v <= 0.0f || v >= 1.0f) ? 0.0f : sinf(polar); //Exact poles, so their quads collapse and get dropped
+  *normal = (Vector3) { ring*cosf(azimuth), ring*sinf(azimuth), cosf(polar) };
+  *point = Vector3Scale(*normal, shape[0]);
+}
+
+void LCCylinderSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Radius, height
+{
+  float azimuth = LCTurnAngle(u);
+  *normal = (Vector3) { cosf(azimuth), sinf(azimuth), 0.0f };
+  *point = (Vector3) { shape[0]*normal->x, shape[0]*normal->y, shape[1]*(v - 0.5f) };
+}
+
+void LCDiskSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Radius, z (its sign picks the facing)
+{
+  float azimuth = LCTurnAngle((shape[1] > 0.0f) ? 1.0f - u : u), radius = shape[0]*v;
+  *point = (Vector3) { radius*cosf(azimuth), radius*sinf(azimuth), shape[1] };
+  *normal = (Vector3) { 0.0f, 0.0f, (shape[1] > 0.0f) ? 1.0f : -1.0f };
+}
+
+void LCTorusSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Major radius, minor radius
+{
+  float azimuth = LCTurnAngle(u), angle = LCTurnAngle(v);
+  *normal = (Vector3) { cosf(angle)*cosf(azimuth), cosf(angle)*sinf(azimuth), sinf(angle) };
+  float ring = shape[0] + shape[1]*cosf(angle);
+  *point = (Vector3) { ring*cosf(azimuth), ring*sinf(azimuth), shape[1]*sinf(angle) };
+}
+
+// Aperture radius R, depth d, z offset, facing (+1: the concave side, up). z = offset + d (r/R)^2
+void LCParaboloidSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal)
+{
+  float azimuth = LCTurnAngle((shape[3] > 0.0f) ? 1.0f - u : u), radius = shape[0]*v;
+  *point = (Vector3) { radius*cosf(azimuth), radius*sinf(azimuth), shape[2] + shape[1]*v*v };
+  float slope = 2.0f*shape[1]*v/shape[0];  //dz/dr
+  *normal = Vector3Scale(Vector3Normalize((Vector3) { -slope*cosf(azimuth), -slope*sinf(azimuth), 1.0f }), shape[3]);
+}
+
+void LCDishRimSurface(const float *shape, float u, float v, Vector3 *point, Vector3 *normal) //Radius, top z, thickness
+{
+  float azimuth = LCTurnAngle(u);
+  *normal = (Vector3) { cosf(azimuth), sinf(azimuth), 0.0f };
+  *point = (Vector3) { shape[0]*normal->x, shape[0]*normal->y, shape[1] - shape[2]*(1.0f - v) };
+}
+
+float LCTurnAngle(float t) //Fraction of a turn in radians, with a full turn mapped to 0 so seams weld
+{
+  return (t >= 1.0f) ? 0.0f : 2.0f*PI*t;
+}
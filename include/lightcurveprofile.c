@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <raylib.h>
+
+//----------------------------------------------------------------------------------
+// Pass and phase profiling (--profile report.json)
+//
+// Every GPU pass of a frame is bracketed by GL_TIME_ELAPSED queries. A pass may run several times per frame (the
+// depth and lighting passes once per instance), so each bracket gets its own query and they are summed per frame.
+// Queries are written into LC_PROFILE_QUERY_SETS sets used round robin: a set is only read back when the frame
+// that wrote it comes around again, long after the GPU finished it, so reading never waits on the pipeline.
+//
+// CPU phases are timed with the monotonic clock. One-shot phases (parse, model load, shader compile) only report
+// their total, per-frame phases also their distribution. The report is JSON: totals, mean and percentiles in ms.
+//----------------------------------------------------------------------------------
+#define LC_PROFILE_QUERY_SETS     2
+#define LC_PROFILE_MAX_QUERIES    (2*MAX_INSTANCES + 16)   // Depth and lighting per instance, the full-screen passes once
+
+#define LC_GL_TIME_ELAPSED        0x88BF
+#define LC_GL_QUERY_RESULT        0x8866
+
+#define LC_PASS_DEPTH             0
+#define LC_PASS_LIGHTING          1
+#define LC_PASS_BRIGHTNESS        2
+#define LC_PASS_EXTRACTION        3
+#define LC_PASS_MINIFY            4
+#define LC_PASS_READBACK          5
+#define LC_GPU_PASSES             6
+
+#define LC_PHASE_PARSE            0        // One-shot
+#define LC_PHASE_MODEL_LOAD       1
+#define LC_PHASE_SHADER_COMPILE   2
+#define LC_PHASE_BATCH            3        // Per frame
+#define LC_PHASE_CALCULATE        4
+#define LC_PHASE_RESULT_WRITE     5
+#define LC_PHASE_FRAME            6
+#define LC_CPU_PHASES             7
+#define LC_FIRST_FRAME_PHASE      LC_PHASE_BATCH
+
+typedef struct {
+  float *values;                          // Per-frame milliseconds
+  long count;
+  long capacity;
+  double total_ms;
+  long calls;
+} LCProfileSeries;
+
+typedef struct {
+  unsigned int queries[LC_PROFILE_MAX_QUERIES];
+  unsigned char passes[LC_PROFILE_MAX_QUERIES]; // Pass each query timed
+  int used;
+  bool pending;                           // Written by a frame and not read back yet
+} LCProfileQuerySet;
+
+typedef struct {
+  bool enabled;
+  bool gpu;                               // Timer queries available and created
+  bool gpu_timed;                         // For the report, gpu is cleared when the queries are deleted
+  double start_ms;
+  double phase_start[LC_CPU_PHASES];
+  double frame_ms[LC_CPU_PHASES];         // Current frame's per-frame phases
+  LCProfileSeries cpu[LC_CPU_PHASES];
+  LCProfileSeries gpu_passes[LC_GPU_PASSES];
+  LCProfileQuerySet sets[LC_PROFILE_QUERY_SETS];
+  int current_set;
+  int active_pass;                        // -1: no query open
+  long frames;
+  long dropped;                           // Brackets beyond LC_PROFILE_MAX_QUERIES in one frame
+  void (LC_GLAPI *GenQueries)(int n, unsigned int *ids);
+  void (LC_GLAPI *DeleteQueries)(int n, const unsigned int *ids);
+  void (LC_GLAPI *BeginQuery)(unsigned int target, unsigned int id);
+  void (LC_GLAPI *EndQuery)(unsigned int target);
+  void (LC_GLAPI *GetQueryObjectui64v)(unsigned int id, unsigned int name, uint64_t *value);
+} LightCurveProfiler;
+
+static const char *lc_gpu_pass_names[LC_GPU_PASSES] = { "depth", "lighting", "brightness", "extraction", "minify", "readback" };
+static const char *lc_cpu_phase_names[LC_CPU_PHASES] = { "parse", "model_load", "shader_compile", "batch", "calculate_light_curve_values", "result_write", "frame" };
+
+void InitProfiler(LightCurveProfiler *profiler, bool enabled);
+void InitProfilerQueries(LightCurveProfiler *profiler);
+void BeginProfilePhase(LightCurveProfiler *profiler, int phase);
+void EndProfilePhase(LightCurveProfiler *profiler, int phase);
+void BeginProfilePass(LightCurveProfiler *profiler, int pass);
+void EndProfilePass(LightCurveProfiler *profiler);
+void EndProfileFrame(LightCurveProfiler *profiler);
+void UnloadProfilerQueries(LightCurveProfiler *profiler);
+bool WriteProfileReport(LightCurveProfiler *profiler, const char *filename, long points);
+void UnloadProfiler(LightCurveProfiler *profiler);
+void LCCollectQuerySet(LightCurveProfiler *profiler, LCProfileQuerySet *set);
+void LCAddProfileSample(LCProfileSeries *series, double ms);
+void LCWriteProfileSeries(FILE *file, const char *name, LCProfileSeries *series, bool distribution, bool last);
+int LCCompareFloats(const void *a, const void *b);
+
+// CPU timing only, usable before the window exists. Disabled profilers ignore every call.
+void InitProfiler(LightCurveProfiler *profiler, bool enabled)
+{
+  memset(profiler, 0, sizeof(LightCurveProfiler));
+  profiler->enabled = enabled;
+  profiler->active_pass = -1;
+  profiler->start_ms = LCMonotonicMs();
+}
+
+// Needs the GL context (after InitWindow())
+void InitProfilerQueries(LightCurveProfiler *profiler)
+{
+  if(!profiler->enabled) return;
+
+  profiler->GenQueries = (void (LC_GLAPI *)(int, unsigned int *)) glfwGetProcAddress("glGenQueries");
+  profiler->DeleteQueries = (void (LC_GLAPI *)(int, const unsigned int *)) glfwGetProcAddress("glDeleteQueries");
+  profiler->BeginQuery = (void (LC_GLAPI *)(unsigned int, unsigned int)) glfwGetProcAddress("glBeginQuery");
+  profiler->EndQuery = (void (LC_GLAPI *)(unsigned int)) glfwGetProcAddress("glEndQuery");
+  profiler->GetQueryObjectui64v = (void (LC_GLAPI *)(unsigned int, unsigned int, uint64_t *)) glfwGetProcAddress("glGetQueryObjectui64v");
+  if(!profiler->GenQueries || !profiler->DeleteQueries || !profiler->BeginQuery || !profiler->EndQuery || !profiler->GetQueryObjectui64v) {
+    TraceLog(LOG_WARNING, "PROFILE: GL_TIME_ELAPSED queries are not available, only CPU phases are timed");
+    return;
+  }
+
+  for(int s = 0; s < LC_PROFILE_QUERY_SETS; s++) profiler->GenQueries(LC_PROFILE_MAX_QUERIES, profiler->sets[s].queries);
+  profiler->gpu = true;
+  profiler->gpu_timed = true;
+}
+
+void BeginProfilePhase(LightCurveProfiler *profiler, int phase)
+{
+  if(profiler->enabled) profiler->phase_start[phase] = LCMonotonicMs();
+}
+
+void EndProfilePhase(LightCurveProfiler *profiler, int phase)
+{
+  if(!profiler->enabled) return;
+  double elapsed = LCMonotonicMs() - profiler->phase_start[phase];
+  if(phase >= LC_FIRST_FRAME_PHASE) profiler->frame_ms[phase] += elapsed;
+  else LCAddProfileSample(&profiler->cpu[phase], elapsed);
+}
+
+// Brackets do not nest, GL allows one GL_TIME_ELAPSED query at a time
+void BeginProfilePass(LightCurveProfiler *profiler, int pass)
+{
+  if(!profiler->gpu) return;
+  LCProfileQuerySet *set = &profiler->sets[profiler->current_set];
+  if(set->used == LC_PROFILE_MAX_QUERIES) {
+    profiler->dropped++;
+    return;
+  }
+  set->passes[set->used] = (unsigned char) pass;
+  profiler->BeginQuery(LC_GL_TIME_ELAPSED, set->queries[set->used++]);
+  profiler->active_pass = pass;
+}
+
+void EndProfilePass(LightCurveProfiler *profiler)
+{
+  if(!profiler->gpu || profiler->active_pass < 0) return;
+  profiler->EndQuery(LC_GL_TIME_ELAPSED);
+  profiler->active_pass = -1;
+}
+
+// Records the frame's CPU phases and moves on to the next query set, reading back the frame that last used it
+void EndProfileFrame(LightCurveProfiler *profiler)
+{
+  if(!profiler->enabled) return;
+  for(int phase = LC_FIRST_FRAME_PHASE; phase < LC_CPU_PHASES; phase++) {
+    LCAddProfileSample(&profiler->cpu[phase], profiler->frame_ms[phase]);
+    profiler->frame_ms[phase] = 0.0;
+  }
+  profiler->frames++;
+
+  if(!profiler->gpu) return;
+  profiler->sets[profiler->current_set].pending = true;
+  profiler->current_set = (profiler->current_set + 1) % LC_PROFILE_QUERY_SETS;
+  LCCollectQuerySet(profiler, &profiler->sets[profiler->current_set]);
+}
+
+void LCCollectQuerySet(LightCurveProfiler *profiler, LCProfileQuerySet *set)
+{
+  if(!set->pending) {
+    set->used = 0;
+    return;
+  }
+
+  double pass_ms[LC_GPU_PASSES] = { 0 };
+  for(int q = 0; q < set->used; q++) {
+    uint64_t nanoseconds = 0;
+    profiler->GetQueryObjectui64v(set->queries[q], LC_GL_QUERY_RESULT, &nanoseconds);
+    pass_ms[set->passes[q]] += nanoseconds * 1e-6;
+  }
+  for(int pass = 0; pass < LC_GPU_PASSES; pass++) LCAddProfileSample(&profiler->gpu_passes[pass], pass_ms[pass]);
+  set->used = 0;
+  set->pending = false;
+}
+
+// Reads back the frames still in flight and deletes the queries, before CloseWindow()
+void UnloadProfilerQueries(LightCurveProfiler *profiler)
+{
+  if(!profiler->gpu) return;
+  for(int s = 1; s <= LC_PROFILE_QUERY_SETS; s++) LCCollectQuerySet(profiler, &profiler->sets[(profiler->current_set + s) % LC_PROFILE_QUERY_SETS]);
+  for(int s = 0; s < LC_PROFILE_QUERY_SETS; s++) profiler->DeleteQueries(LC_PROFILE_MAX_QUERIES, profiler->sets[s].queries);
+  profiler->gpu = false;
+}
+
+void LCAddProfileSample(LCProfileSeries *series, double ms)
+{
+  series->total_ms += ms;
+  series->calls++;
+  if(series->count == series->capacity) {
+    long capacity = (series->capacity > 0) ? 2*series->capacity : 1024;
+    float *values = (float *) realloc(series->values, (size_t) capacity * sizeof(float));
+    if(values == NULL) return;            //Totals stay exact, percentiles cover the samples kept
+    series->values = values;
+    series->capacity = capacity;
+  }
+  series->values[series->count++] = (float) ms;
+}
+
+int LCCompareFloats(const void *a, const void *b)
+{
+  float x = *(const float *) a, y = *(const float *) b;
+  return (x > y) - (x < y);
+}
+
+void LCWriteProfileSeries(FILE *file, const char *name, LCProfileSeries *series, bool distribution, bool last)
+{
+  fprintf(file, "    \"%s\": { \"total_ms\": %.4f, \"calls\": %ld", name, series->total_ms, series->calls);
+  if(distribution && series->count > 0) {
+    qsort(series->values, (size_t) series->count, sizeof(float), LCCompareFloats);
+    double percentiles[3] = { 0.50, 0.90, 0.99 };
+    const char *labels[3] = { "p50_ms", "p90_ms", "p99_ms" };
+    fprintf(file, ", \"mean_ms\": %.4f", series->total_ms / series->calls);
+    for(int p = 0; p < 3; p++) {
+      long rank = (long) ceil(percentiles[p] * series->count) - 1; //Nearest rank
+      fprintf(file, ", \"%s\": %.4f", labels[p], series->values[(rank < 0) ? 0 : rank]);
+    }
+    fprintf(file, ", \"max_ms\": %.4f", series->values[series->count - 1]);
+  }
+  fprintf(file, " }%s\n", last ? "" : ",");
+}
+
+// filename "-" writes to stderr (stdout may carry pipe results)
+bool WriteProfileReport(LightCurveProfiler *profiler, const char *filename, long points)
+{
+  if(!profiler->enabled || filename == NULL) return true;
+  FILE *file = (strcmp(filename, "-") == 0) ? stderr : fopen(filename, "w");
+  if(file == NULL) {
+    TraceLog(LOG_WARNING, "PROFILE: [%s] Could not write the report", filename);
+    return false;
+  }
+
+  double wall_ms = LCMonotonicMs() - profiler->start_ms;
+  for(int phase = LC_FIRST_FRAME_PHASE; phase < LC_CPU_PHASES; phase++) { //Work after the last frame (final flush) counts in the totals only
+    profiler->cpu[phase].total_ms += profiler->frame_ms[phase];
+    profiler->frame_ms[phase] = 0.0;
+  }
+  fprintf(file, "{\n  \"wall_ms\": %.4f,\n  \"frames\": %ld,\n  \"data_points\": %ld,\n", wall_ms, profiler->frames, points);
+  fprintf(file, "  \"gpu_timer_queries\": %s,\n  \"dropped_queries\": %ld,\n", profiler->gpu_timed ? "true" : "false", profiler->dropped);
+  fprintf(file, "  \"cpu\": {\n");
+  for(int phase = 0; phase < LC_CPU_PHASES; phase++) LCWriteProfileSeries(file, lc_cpu_phase_names[phase], &profiler->cpu[phase], phase >= LC_FIRST_FRAME_PHASE, phase == LC_CPU_PHASES - 1);
+  fprintf(file, "  },\n  \"gpu\": {\n");
+  for(int pass = 0; pass < LC_GPU_PASSES; pass++) LCWriteProfileSeries(file, lc_gpu_pass_names[pass], &profiler->gpu_passes[pass], true, pass == LC_GPU_PASSES - 1);
+  fprintf(file, "  }\n}\n");
+
+  bool ok = (file == stderr) ? fflush(file) == 0 : fclose(file) == 0;
+  if(ok && file != stderr) TraceLog(LOG_INFO, "PROFILE: Wrote %s (%ld frames, %.1f ms)", filename, profiler->frames, wall_ms);
+  return ok;
+}
+
+void UnloadProfiler(LightCurveProfiler *profiler)
+{
+  for(int phase = 0; phase < LC_CPU_PHASES; phase++) free(profiler->cpu[phase].values);
+  for(int pass = 0; pass < LC_GPU_PASSES; pass++) free(profiler->gpu_passes[pass].values);
+  memset(profiler->cpu, 0, sizeof(profiler->cpu));
+  memset(profiler->gpu_passes, 0, sizeof(profiler->gpu_passes));
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+
+//----------------------------------------------------------------------------------
+// Progressive refinement
+//
+// Every data point is first rendered on the command's grid. Points whose estimated relative error (see
+// CalculateLightCurveValues) is above the refine tolerance are queued for the next level, which halves the grid
+// width and so roughly doubles the pixels across each tile. A level renders once its queue fills the grid, so
+// only flagged points pay for the larger tiles. Results wait in a window until every earlier point is final and
+// are then written in order, so .lcr/.lcrb files and pipe indices look exactly as they do without refinement.
+// Points whose geometry is already in the geometry table never enter a queue: they finish with the values of the
+// point rendered for it, right away or once that point is final.
+//----------------------------------------------------------------------------------
+#define LC_REFINE_MAX_LEVELS     4
+#define LC_REFINE_WINDOW         4096   // Points that may wait on refinement before new input is held back
+
+typedef struct {
+  int index;                              // Data point index
+  double sun[3];                          // Copied, pipe batches are overwritten by the next read
+  double viewer[3];
+  int geometry;                           // LightCurveGeometryTable entry this point renders for, -1: none
+} LCRefinePoint;
+
+typedef struct {
+  float tolerance;                        // 0: single pass, nothing is queued past level 0
+  int level_count;
+  int grid_widths[LC_REFINE_MAX_LEVELS];  // Tiles per side, level 0 is the command's grid
+  int queue_counts[LC_REFINE_MAX_LEVELS];
+  LCRefinePoint queues[LC_REFINE_MAX_LEVELS][2 * MAX_INSTANCES]; // A full grid plus what one coarser frame can flag
+  bool drain;                             // Input ran dry: render partially filled levels instead of waiting
+  int channel_count;
+  int first_pending;                      // Oldest data point not yet written
+  int next_index;                         // Index of the next input point
+  float values[LC_REFINE_WINDOW * LC_MAX_CHANNELS];
+  bool finished[LC_REFINE_WINDOW];
+  int next_follower[LC_REFINE_WINDOW];    // Chains duplicates waiting on the same geometry, -1 ends a chain
+  LightCurveGeometryTable *geometries;    // NULL: every point is rendered
+  int frames[LC_REFINE_MAX_LEVELS];       // Statistics for LogRefineStatistics()
+  int points[LC_REFINE_MAX_LEVELS];
+} LightCurveRefiner;
+
+void InitRefiner(LightCurveRefiner *refiner, int grid_width, float tolerance, int channel_count, LightCurveGeometryTable *geometries);
+int NextRefineLevel(LightCurveRefiner *refiner, bool input_done);
+void AddRefineBatch(LightCurveRefiner *refiner, const double *sun_vectors, const double *viewer_vectors, int count);
+int RefineBatchSize(const LightCurveRefiner *refiner, int level);
+int RefineInputRoom(const LightCurveRefiner *refiner);
+void LCFinishGeometry(LightCurveRefiner *refiner, LCRefinePoint point);
+void FinishRefineBatch(LightCurveRefiner *refiner, int level, const float *values, const float *relative_errors, LightCurveResultsWriter *writer);
+void LogRefineStatistics(const LightCurveRefiner *refiner, int screen_pixels);
+
+void InitRefiner(LightCurveRefiner *refiner, int grid_width, float tolerance, int channel_count, LightCurveGeometryTable *geometries)
+{
+  memset(refiner, 0, sizeof(LightCurveRefiner));
+  refiner->tolerance = tolerance;
+  refiner->channel_count = channel_count;
+  refiner->geometries = (geometries != NULL && geometries->mode != LC_DEDUP_OFF) ? geometries : NULL;
+  refiner->grid_widths[0] = grid_width;
+  refiner->level_count = 1;
+
+  if(tolerance <= 0.0f) return;
+  while(refiner->level_count < LC_REFINE_MAX_LEVELS && refiner->grid_widths[refiner->level_count - 1] > 1) {
+    refiner->grid_widths[refiner->level_count] = refiner->grid_widths[refiner->level_count - 1] / 2;
+    refiner->level_count++;
+  }
+
+  if(refiner->level_count == 1) TraceLog(LOG_WARNING, "REFINE: A 1x1 grid already renders each point on the whole screen, refinement is off");
+  else TraceLog(LOG_INFO, "REFINE: Tolerance %.2e, %d levels down to a %dx%d grid", tolerance, refiner->level_count,
+                refiner->grid_widths[refiner->level_count - 1], refiner->grid_widths[refiner->level_count - 1]);
+}
+
+// Level to render next, 0 to take new input, -1 when everything has been written
+int NextRefineLevel(LightCurveRefiner *refiner, bool input_done)
+{
+  for(int l = refiner->level_count - 1; l > 0; l--) { //Deepest first: those points are closest to being written
+    if(refiner->queue_counts[l] >= refiner->grid_widths[l]*refiner->grid_widths[l]) return l;
+  }
+
+  bool room = RefineInputRoom(refiner) >= refiner->grid_widths[0]*refiner->grid_widths[0];
+  if(!input_done && room && !refiner->drain) return 0;
+
+  for(int l = refiner->level_count - 1; l > 0; l--) {
+    if(refiner->queue_counts[l] > 0) return l;
+  }
+  refiner->drain = false;
+  return input_done ? -1 : 0;
+}
+
+// Appends the points to the level 0 queue. Duplicates of a known geometry are finished (or chained to the point
+// rendering it) instead, so the queue may grow by less than count, or not at all.
+void AddRefineBatch(LightCurveRefiner *refiner, const double *sun_vectors, const double *viewer_vectors, int count) //Row-major, like LightCurveCommand
+{
+  LightCurveGeometryTable *table = refiner->geometries;
+  int queued = refiner->queue_counts[0];
+
+  for(int i = 0; i < count; i++) {
+    LCRefinePoint *point = &refiner->queues[0][queued];
+    point->index = refiner->next_index++;
+    point->geometry = -1;
+    memcpy(point->sun, sun_vectors + 3*i, sizeof(point->sun));
+    memcpy(point->viewer, viewer_vectors + 3*i, sizeof(point->viewer));
+
+    if(table != NULL) {
+      double key_sun[3], key_viewer[3];
+      CanonicalizeGeometry(table, point->sun, point->viewer, key_sun, key_viewer);
+      bool created;
+      int e = FindGeometry(table, key_sun, key_viewer, &created);
+      if(e >= 0 && !created) {
+        LCGeometryEntry *entry = &table->entries[e];
+        int slot = point->index % LC_REFINE_WINDOW;
+        if(entry->representative < 0) {
+          memcpy(refiner->values + slot*refiner->channel_count, entry->values, refiner->channel_count*sizeof(float));
+          refiner->finished[slot] = true;
+        }
+        else {
+          refiner->next_follower[slot] = entry->first_follower;
+          entry->first_follower = point->index;
+        }
+        continue;
+      }
+      if(created) {
+        table->entries[e].representative = point->index;
+        point->geometry = e;
+      }
+    }
+    queued++;
+  }
+  refiner->queue_counts[0] = queued;
+}
+
+// A rendered point is final: its geometry's waiting duplicates finish with the same values
+void LCFinishGeometry(LightCurveRefiner *refiner, LCRefinePoint point)
+{
+  if(point.geometry < 0) return;
+
+  int channels = refiner->channel_count;
+  LCGeometryEntry *entry = &refiner->geometries->entries[point.geometry];
+  const float *values = refiner->values + (point.index % LC_REFINE_WINDOW)*channels;
+  memcpy(entry->values, values, channels*sizeof(float));
+  entry->representative = -1;
+
+  for(int follower = entry->first_follower; follower >= 0; follower = refiner->next_follower[follower % LC_REFINE_WINDOW]) {
+    int slot = follower % LC_REFINE_WINDOW;
+    memcpy(refiner->values + slot*channels, values, channels*sizeof(float));
+    refiner->finished[slot] = true;
+  }
+  entry->first_follower = -1;
+}
+
+int RefineBatchSize(const LightCurveRefiner *refiner, int level) //Points the next frame at this level renders
+{
+  int tiles = refiner->grid_widths[level]*refiner->grid_widths[level];
+  return (refiner->queue_counts[level] < tiles) ? refiner->queue_counts[level] : tiles;
+}
+
+int RefineInputRoom(const LightCurveRefiner *refiner) //New points the result window can take
+{
+  return LC_REFINE_WINDOW - (refiner->next_index - refiner->first_pending);
+}
+
+// values is batch size x channel_count. Stores the results of the front of the level's queue, passes points above
+// the tolerance on to the next level and writes out every result no earlier point is still waiting on. With an
+// empty queue it only does the latter, for batches that were all duplicates.
+void FinishRefineBatch(LightCurveRefiner *refiner, int level, const float *values, const float *relative_errors, LightCurveResultsWriter *writer)
+{
+  int count = RefineBatchSize(refiner, level);
+  int channels = refiner->channel_count;
+
+  for(int i = 0; i < count; i++) {
+    LCRefinePoint point = refiner->queues[level][i];
+    int slot = point.index % LC_REFINE_WINDOW;
+    memcpy(refiner->values + slot*channels, values + i*channels, channels*sizeof(float));
+
+    if(level + 1 < refiner->level_count && relative_errors[i] > refiner->tolerance) {
+      refiner->queues[level + 1][refiner->queue_counts[level + 1]++] = point;
+    }
+    else {
+      refiner->finished[slot] = true;
+      LCFinishGeometry(refiner, point);
+    }
+  }
+
+  refiner->queue_counts[level] -= count;
+  memmove(refiner->queues[level], refiner->queues[level] + count, refiner->queue_counts[level]*sizeof(LCRefinePoint));
+  if(count > 0) refiner->frames[level]++;
+  refiner->points[level] += count;
+
+  while(refiner->first_pending < refiner->next_index) { //Contiguous runs of finished points, split where the ring wraps
+    int slot = refiner->first_pending % LC_REFINE_WINDOW;
+    int run = 0;
+    while(refiner->first_pending + run < refiner->next_index && slot + run < LC_REFINE_WINDOW && refiner->finished[slot + run]) {
+      refiner->finished[slot + run] = false;
+      run++;
+    }
+    if(run == 0) break;
+
+    WriteLightCurveResultsBatch(writer, refiner->values + slot*channels, run);
+    refiner->first_pending += run;
+  }
+}
+
+void LogRefineStatistics(const LightCurveRefiner *refiner, int screen_pixels)
+{
+  if(refiner->level_count == 1) return;
+
+  int frames = 0;
+  for(int l = 0; l < refiner->level_count; l++) {
+    int grid_width = refiner->grid_widths[l];
+    TraceLog(LOG_INFO, "REFINE: Level %d (%dx%d grid, %d px tiles): %d points in %d frames", l, grid_width, grid_width,
+             screen_pixels / grid_width, refiner->points[l], refiner->frames[l]);
+    frames += refiner->frames[l];
+  }
+
+  //Every frame costs the same full-screen passes, so frames measure pixel work
+  int finest = refiner->grid_widths[refiner->level_count - 1];
+  int uniform_frames = (refiner->points[0] + finest*finest - 1) / (finest*finest);
+  TraceLog(LOG_INFO, "REFINE: %d frames in total, %d to render every point at the finest level (%.1fx)", frames, uniform_frames,
+           (frames > 0) ? (float) uniform_frames / frames : 0.0f);
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <raylib.h>
+#include <rlgl.h>
+
+#if defined(_WIN32)
+  #define LC_GLAPI __stdcall
+#else
+  #define LC_GLAPI
+#endif
+
+//----------------------------------------------------------------------------------
+// Shader variants
+//
+// The lighting shader is written for any number and type of lights, with shadows and a choice of BRDF, selected by
+// preprocessor switches (LC_LIGHT_COUNT, LC_LIGHT_TYPE, LC_SHADOWS, LC_BRDF, LC_OUTPUT_LEVELS) that default to the
+// generic behaviour. A variant is compiled by injecting #defines after the #version line, so the engine's usual
+// single directional sun compiles without light loops, type branches or unused terms. Every compiled variant is
+// kept here by its source files and define block and is handed out again instead of being recompiled.
+//
+// Linked programs are also saved with glGetProgramBinary() under shaders/.lccache, keyed by a hash of both stages'
+// final source and the driver's vendor, renderer and version strings, and later runs load them with
+// glProgramBinary() instead of compiling. A binary the driver rejects (an updated driver with the same strings)
+// is recompiled from source and overwritten. Drivers reporting no binary formats simply always compile.
+//----------------------------------------------------------------------------------
+#define LC_MAX_SHADER_VARIANTS   16
+#define LC_SHADER_DEFINES_LENGTH 512
+#define LC_SHADER_CACHE_DIR      "shaders/.lccache"
+#define LC_PROGRAM_CACHE_VERSION 1
+#define LC_PROGRAM_CACHE_HEADER  64
+
+#define LC_GL_VENDOR                      0x1F00
+#define LC_GL_RENDERER                    0x1F01
+#define LC_GL_VERSION                     0x1F02
+#define LC_GL_LINK_STATUS                 0x8B82
+#define LC_GL_PROGRAM_BINARY_LENGTH       0x8741
+#define LC_GL_NUM_PROGRAM_BINARY_FORMATS  0x87FE
+
+#define LC_LIGHT_DIRECTIONAL     0      // Must match LIGHT_DIRECTIONAL/LIGHT_POINT in rlights.h and the shaders
+#define LC_LIGHT_POINT           1
+#define LC_LIGHT_ANY             -1     // Branch on each light's type at run time
+
+#define LC_BRDF_LAMBERT          0
+#define LC_BRDF_PHONG            1      // Lambertian plus a specular lobe
+
+typedef struct {
+  int light_count;                        // Lights evaluated, 1..4 (rlights.h MAX_LIGHTS)
+  int light_type;                         // LC_LIGHT_*
+  bool shadows;                           // Depth texture test in the lighting pass
+  int brdf;                               // LC_BRDF_*
+  int output_levels;                      // Round irradiance to this many levels, 0: full precision
+} LCShaderOptions;
+
+typedef struct {
+  char vs_file[MAX_FNAME_LENGTH];
+  char fs_file[MAX_FNAME_LENGTH];
+  char defines[LC_SHADER_DEFINES_LENGTH];
+  Shader shader;
+} LCShaderVariant;
+
+typedef struct {
+  char magic[4];                          // "LCPB"
+  uint32_t version;                       // LC_PROGRAM_CACHE_VERSION
+  uint32_t header_size;                   // Byte offset of the binary
+  uint32_t format;                        // Driver-specific binary format from glGetProgramBinary()
+  uint64_t key;                           // Source and driver hash the binary was built from
+  uint64_t length;                        // Bytes of binary
+} LCProgramCacheHeader;
+
+typedef void (*LCGLProc)(void);
+LCGLProc glfwGetProcAddress(const char *procname); // raylib's desktop platform creates its context with GLFW
+
+typedef struct {
+  LCShaderVariant variants[LC_MAX_SHADER_VARIANTS];
+  int variant_count;
+  bool binaries;                          // Program binaries can be saved and loaded
+  uint64_t driver_hash;                   // Vendor, renderer and version strings
+  const unsigned char *(LC_GLAPI *GetString)(unsigned int name);
+  void (LC_GLAPI *GetIntegerv)(unsigned int name, int *value);
+  unsigned int (LC_GLAPI *CreateProgram)(void);
+  void (LC_GLAPI *DeleteProgram)(unsigned int program);
+  void (LC_GLAPI *GetProgramiv)(unsigned int program, unsigned int name, int *value);
+  void (LC_GLAPI *GetProgramBinary)(unsigned int program, int size, int *length, unsigned int *format, void *binary);
+  void (LC_GLAPI *ProgramBinary)(unsigned int program, unsigned int format, const void *binary, int length);
+  unsigned int (LC_GLAPI *GetError)(void);
+  long hits;                              // Statistics
+  int compiled;
+  int from_binary;
+  double load_ms;
+} LightCurveShaderCache;
+
+LCShaderOptions DefaultShaderOptions(void);
+void InitShaderCache(LightCurveShaderCache *cache, bool binaries);
+Shader LoadShaderVariant(LightCurveShaderCache *cache, const char *vs_file, const char *fs_file, const LCShaderOptions *options);
+void UnloadShaderCache(LightCurveShaderCache *cache);
+void LogShaderCacheStatistics(const LightCurveShaderCache *cache);
+void LCFormatShaderDefines(const LCShaderOptions *options, char *defines, int size);
+char *LCInjectShaderDefines(const char *filename, const char *defines);
+Shader LCLoadProgramBinary(LightCurveShaderCache *cache, const char *binary_file, uint64_t key);
+void LCSaveProgramBinary(LightCurveShaderCache *cache, const char *binary_file, uint64_t key, unsigned int program);
+Shader LCShaderFromProgram(unsigned int program);
+
+LCShaderOptions DefaultShaderOptions(void) //What the engine renders: one directional sun, shadows, Lambertian
+{
+  LCShaderOptions options = { 1, LC_LIGHT_DIRECTIONAL, true, LC_BRDF_LAMBERT, 0 };
+  return options;
+}
+
+// Needs the GL context (after InitWindow()). binaries false keeps everything in memory.
+void InitShaderCache(LightCurveShaderCache *cache, bool binaries)
+{
+  memset(cache, 0, sizeof(LightCurveShaderCache));
+  if(!binaries) return;
+
+  cache->GetString = (const unsigned char *(LC_GLAPI *)(unsigned int)) glfwGetProcAddress("glGetString");
+  cache->GetIntegerv = (void (LC_GLAPI *)(unsigned int, int *)) glfwGetProcAddress("glGetIntegerv");
+  cache->CreateProgram = (unsigned int (LC_GLAPI *)(void)) glfwGetProcAddress("glCreateProgram");
+  cache->DeleteProgram = (void (LC_GLAPI *)(unsigned int)) glfwGetProcAddress("glDeleteProgram");
+  cache->GetProgramiv = (void (LC_GLAPI *)(unsigned int, unsigned int, int *)) glfwGetProcAddress("glGetProgramiv");
+  cache->GetProgramBinary = (void (LC_GLAPI *)(unsigned int, int, int *, unsigned int *, void *)) glfwGetProcAddress("glGetProgramBinary");
+  cache->ProgramBinary = (void (LC_GLAPI *)(unsigned int, unsigned int, const void *, int)) glfwGetProcAddress("glProgramBinary");
+  cache->GetError = (unsigned int (LC_GLAPI *)(void)) glfwGetProcAddress("glGetError");
+  if(!cache->GetString || !cache->GetIntegerv || !cache->CreateProgram || !cache->DeleteProgram || !cache->GetProgramiv ||
+     !cache->GetProgramBinary || !cache->ProgramBinary || !cache->GetError) {
+    TraceLog(LOG_INFO, "SHADER: Program binaries are not available, shaders are compiled on every run");
+    return;
+  }
+
+  int formats = 0;
+  cache->GetIntegerv(LC_GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  if(formats <= 0) {
+    TraceLog(LOG_INFO, "SHADER: The driver offers no program binary formats, shaders are compiled on every run");
+    return;
+  }
+
+  uint64_t hash = LC_FNV_OFFSET;
+  unsigned int names[3] = { LC_GL_VENDOR, LC_GL_RENDERER, LC_GL_VERSION };
+  for(int n = 0; n < 3; n++) {
+    const unsigned char *name = cache->GetString(names[n]);
+    if(name != NULL) hash = HashBytes(hash, name, strlen((const char *) name) + 1);
+  }
+  cache->driver_hash = hash;
+  cache->binaries = true;
+}
+
+void LCFormatShaderDefines(const LCShaderOptions *options, char *defines, int size)
+{
+  snprintf(defines, size, "#define MAX_MODELS %d\n", MAX_INSTANCES);
+  if(options == NULL) return;
+
+  int length = (int) strlen(defines);
+  snprintf(defines + length, size - length,
+           "#define LC_LIGHT_COUNT %d\n#define LC_LIGHT_TYPE %d\n#define LC_SHADOWS %d\n#define LC_BRDF %d\n#define LC_OUTPUT_LEVELS %d\n",
+           options->light_count, options->light_type, options->shadows ? 1 : 0, options->brdf, options->output_levels);
+}
+
+// Source of filename with defines inserted after its #version line (GLSL requires #version first) and a #line
+// directive so compiler messages keep the file's line numbers. Free with free().
+char *LCInjectShaderDefines(const char *filename, const char *defines)
+{
+  char *source = LoadFileText(filename);
+  if(source == NULL) return NULL;
+
+  size_t split = 0;
+  if(strncmp(source, "#version", 8) == 0) {
+    const char *newline = strchr(source, '\n');
+    split = (newline != NULL) ? (size_t) (newline - source) + 1 : strlen(source);
+  }
+
+  char *injected = (char *) malloc(strlen(source) + strlen(defines) + 16);
+  if(injected != NULL) {
+    memcpy(injected, source, split);
+    size_t at = split;
+    if(split > 0 && source[split - 1] != '\n') injected[at++] = '\n'; //#version was the last line
+    strcpy(injected + at, defines);
+    if(split > 0) strcat(injected + at, "#line 2\n");
+    strcat(injected + at, source + split);
+  }
+  UnloadFileText(source);
+  return injected;
+}
+
+// options may be NULL for shaders without switches. The returned shader belongs to the cache.
+Shader LoadShaderVariant(LightCurveShaderCache *cache, const char *vs_file, const char *fs_file, const LCShaderOptions *options)
+{
+  char defines[LC_SHADER_DEFINES_LENGTH];
+  LCFormatShaderDefines(options, defines, LC_SHADER_DEFINES_LENGTH);
+
+  for(int v = 0; v < cache->variant_count; v++) {
+    LCShaderVariant *variant = &cache->variants[v];
+    if(strcmp(variant->vs_file, vs_file) == 0 && strcmp(variant->fs_file, fs_file) == 0 && strcmp(variant->defines, defines) == 0) {
+      cache->hits++;
+      return variant->shader;
+    }
+  }
+
+  double start = LCMonotonicMs();
+  char *vs_code = LCInjectShaderDefines(vs_file, defines);
+  char *fs_code = LCInjectShaderDefines(fs_file, defines);
+  if(vs_code == NULL || fs_code == NULL) TraceLog(LOG_WARNING, "SHADER: [%s, %s] Could not read the sources, using raylib's default shader", vs_file, fs_file);
+
+  Shader shader = { 0 };
+  char binary_file[64];
+  uint64_t key = 0;
+  if(cache->binaries && vs_code != NULL && fs_code != NULL) {
+    key = HashBytes(cache->driver_hash, (const unsigned char *) vs_code, strlen(vs_code) + 1);
+    key = HashBytes(key, (const unsigned char *) fs_code, strlen(fs_code) + 1);
+    snprintf(binary_file, sizeof(binary_file), "%s/%016llx.lcpb", LC_SHADER_CACHE_DIR, (unsigned long long) key);
+    shader = LCLoadProgramBinary(cache, binary_file, key);
+  }
+
+  if(shader.id != 0) cache->from_binary++;
+  else {
+    shader = LoadShaderFromMemory(vs_code, fs_code); //NULL code selects the default stage
+    cache->compiled++;
+    if(key != 0 && shader.id != rlGetShaderIdDefault()) LCSaveProgramBinary(cache, binary_file, key, shader.id);
+  }
+  free(vs_code);
+  free(fs_code);
+  cache->load_ms += LCMonotonicMs() - start;
+
+  if(cache->variant_count == LC_MAX_SHADER_VARIANTS) {
+    TraceLog(LOG_WARNING, "SHADER: Variant cache is full, [%s, %s] is not cached", vs_file, fs_file);
+    return shader;
+  }
+
+  LCShaderVariant *variant = &cache->variants[cache->variant_count++];
+  snprintf(variant->vs_file, MAX_FNAME_LENGTH, "%s", vs_file);
+  snprintf(variant->fs_file, MAX_FNAME_LENGTH, "%s", fs_file);
+  snprintf(variant->defines, LC_SHADER_DEFINES_LENGTH, "%s", defines);
+  variant->shader = shader;
+  return shader;
+}
+
+void UnloadShaderCache(LightCurveShaderCache *cache)
+{
+  for(int v = 0; v < cache->variant_count; v++) UnloadShader(cache->variants[v].shader);
+  cache->variant_count = 0;
+}
+
+void LogShaderCacheStatistics(const LightCurveShaderCache *cache) //Cold start: everything compiled, warm start: everything from binaries
+{
+  TraceLog(LOG_INFO, "SHADER: %d programs ready in %.1f ms (%s start): %d loaded from program binaries, %d compiled, %ld repeated loads shared",
+           cache->from_binary + cache->compiled, cache->load_ms, (cache->compiled == 0) ? "warm" : (cache->from_binary == 0) ? "cold" : "partly warm",
+           cache->from_binary, cache->compiled, cache->hits);
+}
+
+// Program of a cache entry, or id 0 when there is none or the driver rejects it
+Shader LCLoadProgramBinary(LightCurveShaderCache *cache, const char *binary_file, uint64_t key)
+{
+  Shader shader = { 0 };
+  size_t size;
+  const unsigned char *data = MapFileReadOnly(binary_file, &size);
+  if(data == NULL) return shader;
+
+  LCProgramCacheHeader header;
+  bool valid = size >= LC_PROGRAM_CACHE_HEADER;
+  if(valid) {
+    memcpy(&header, data, sizeof(LCProgramCacheHeader));
+    valid = memcmp(header.magic, "LCPB", 4) == 0 && header.version == LC_PROGRAM_CACHE_VERSION && header.key == key &&
+            header.header_size >= LC_PROGRAM_CACHE_HEADER && header.length <= size - header.header_size && header.length <= INT32_MAX;
+  }
+
+  if(valid) {
+    unsigned int program = cache->CreateProgram();
+    cache->ProgramBinary(program, header.format, data + header.header_size, (int) header.length);
+    int linked = 0;
+    cache->GetProgramiv(program, LC_GL_LINK_STATUS, &linked);
+    if(linked) shader = LCShaderFromProgram(program);
+    else {
+      while(cache->GetError() != 0) { }   //An unknown format raises GL_INVALID_ENUM, don't leave it for raylib
+      cache->DeleteProgram(program);
+      TraceLog(LOG_INFO, "SHADER: [%s] Program binary rejected by the driver, recompiling", binary_file);
+    }
+  }
+  else TraceLog(LOG_WARNING, "SHADER: [%s] Not a valid program binary, recompiling", binary_file);
+
+  UnmapFile(data, size);
+  return shader;
+}
+
+void LCSaveProgramBinary(LightCurveShaderCache *cache, const char *binary_file, uint64_t key, unsigned int program) //Best effort, like the mesh cache
+{
+  int length = 0;
+  cache->GetProgramiv(program, LC_GL_PROGRAM_BINARY_LENGTH, &length);
+  void *binary = (length > 0) ? malloc((size_t) length) : NULL;
+  if(binary == NULL) return;
+
+  unsigned int format = 0;
+  int written = 0;
+  cache->GetProgramBinary(program, length, &written, &format, binary);
+  if(written <= 0) {
+    free(binary);
+    return;
+  }
+
+#if !defined(LC_NO_POSIX)
+  mkdir("shaders", 0755);
+  mkdir(LC_SHADER_CACHE_DIR, 0755);
+#endif
+
+  unsigned char header_bytes[LC_PROGRAM_CACHE_HEADER] = { 0 };
+  LCProgramCacheHeader header = { { 'L', 'C', 'P', 'B' }, LC_PROGRAM_CACHE_VERSION, LC_PROGRAM_CACHE_HEADER, format, key, (uint64_t) written };
+  memcpy(header_bytes, &header, sizeof(LCProgramCacheHeader));
+
+  char temp_file[96];
+  snprintf(temp_file, sizeof(temp_file), "%s.tmp", binary_file);
+  FILE *file = fopen(temp_file, "wb");
+  bool ok = file != NULL;
+  ok = ok && fwrite(header_bytes, 1, LC_PROGRAM_CACHE_HEADER, file) == LC_PROGRAM_CACHE_HEADER;
+  ok = ok && fwrite(binary, 1, (size_t) written, file) == (size_t) written;
+  if(file != NULL) ok = (fclose(file) == 0) && ok;
+  free(binary);
+
+  if(ok && rename(temp_file, binary_file) == 0) TraceLog(LOG_INFO, "SHADER: Wrote program binary %s", binary_file);
+  else {
+    remove(temp_file);
+    TraceLog(LOG_WARNING, "SHADER: [%s] Could not write program binary", binary_file);
+  }
+}
+
+Shader LCShaderFromProgram(unsigned int program) //Same default locations as LoadShaderFromMemory() looks up
+{
+  Shader shader = { 0 };
+  shader.id = program;
+  shader.locs = (int *) RL_CALLOC(RL_MAX_SHADER_LOCATIONS, sizeof(int));
+  for(int i = 0; i < RL_MAX_SHADER_LOCATIONS; i++) shader.locs[i] = -1;
+
+  shader.locs[SHADER_LOC_VERTEX_POSITION] = rlGetLocationAttrib(program, "vertexPosition");
+  shader.locs[SHADER_LOC_VERTEX_TEXCOORD01] = rlGetLocationAttrib(program, "vertexTexCoord");
+  shader.locs[SHADER_LOC_VERTEX_TEXCOORD02] = rlGetLocationAttrib(program, "vertexTexCoord2");
+  shader.locs[SHADER_LOC_VERTEX_NORMAL] = rlGetLocationAttrib(program, "vertexNormal");
+  shader.locs[SHADER_LOC_VERTEX_TANGENT] = rlGetLocationAttrib(program, "vertexTangent");
+  shader.locs[SHADER_LOC_VERTEX_COLOR] = rlGetLocationAttrib(program, "vertexColor");
+  shader.locs[SHADER_LOC_MATRIX_MVP] = rlGetLocationUniform(program, "mvp");
+  shader.locs[SHADER_LOC_MATRIX_VIEW] = rlGetLocationUniform(program, "matView");
+  shader.locs[SHADER_LOC_MATRIX_PROJECTION] = rlGetLocationUniform(program, "matProjection");
+  shader.locs[SHADER_LOC_MATRIX_MODEL] = rlGetLocationUniform(program, "matModel");
+  shader.locs[SHADER_LOC_MATRIX_NORMAL] = rlGetLocationUniform(program, "matNormal");
+  shader.locs[SHADER_LOC_COLOR_DIFFUSE] = rlGetLocationUniform(program, "colDiffuse");
+  shader.locs[SHADER_LOC_MAP_DIFFUSE] = rlGetLocationUniform(program, "texture0");
+  shader.locs[SHADER_LOC_MAP_SPECULAR] = rlGetLocationUniform(program, "texture1");
+  shader.locs[SHADER_LOC_MAP_NORMAL] = rlGetLocationUniform(program, "texture2");
+  return shader;
+}
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+#include <raymath.h>
+
+//----------------------------------------------------------------------------------
+// Shadow map cache
+//
+// The depth pass only depends on the sun vector: the depth shader works in model space and the tile offset is a
+// shift in the light's view plane. Maps rendered on the command's grid are copied into slots of an atlas texture,
+// keyed by their sun vector, and later points under the same sun (or one within the tolerance) skip the depth
+// pass and sample their slot instead. Slots are recycled least recently used first.
+//
+// Slots are filed in hash buckets: by the bits of the sun vector when only identical vectors match, otherwise by
+// the cell of a grid over unit directions whose side is the chord of the tolerance angle, so a lookup only visits
+// the 27 cells around its direction. Eviction takes the tail of a recency list.
+//
+// Copies are whole-pixel aligned, so a slot holds the tile exactly as rendered and the shadow lookup only needs
+// its texture coordinate mapping shifted and scaled into the atlas. The cache is off unless a budget is set.
+//----------------------------------------------------------------------------------
+#define LC_SHADOW_ATLAS_MAX_PIXELS   8192   // Atlas side limit, well within GL_MAX_TEXTURE_SIZE of GL 3.3 hardware
+#define LC_SHADOW_BYTES_PER_PIXEL    8      // RGBA8 colour plus the 24/8 depth attachment of LoadRenderTexture()
+#define LC_SHADOW_MIN_CELL           1e-6f  // Keeps cell coordinates within int range for tiny tolerances
+
+typedef struct {
+  Vector3 sun;                            // Sun vector the map was rendered for
+  Matrix shadow_matrix;                   // Model space -> atlas texture coordinates, for the lighting shader's light_mvp
+  bool used;
+  int bucket;                             // Bucket the slot is filed in
+  int next;                               // Next slot in that bucket, -1: last
+  int older;                              // Recency list neighbours, -1: none
+  int newer;
+} LCShadowEntry;
+
+typedef struct {
+  RenderTexture2D atlas;
+  int slot_pixels;                        // A tile plus the pixel lost to whole-pixel alignment
+  int slots_per_side;
+  int slot_count;                         // 0: cache disabled
+  LCShadowEntry *entries;
+  int *buckets;                           // First slot per bucket, -1: empty
+  int bucket_mask;                        // Bucket count - 1, a power of two
+  int oldest;                             // Least recently used slot, the next one recycled
+  int newest;
+  int screen_pixels;
+  int grid_width;
+  float min_cosine;                       // Largest allowed angle between sun directions, as a cosine
+  float cell_size;                        // Direction grid spacing, the chord of that angle
+  bool exact;                             // Zero tolerance: only bit-identical sun vectors match
+  long hits;
+  long misses;
+  long evictions;
+} LightCurveShadowCache;
+
+void InitShadowCache(LightCurveShadowCache *cache, int screen_pixels, int grid_width, float budget_mb, float tolerance_degrees);
+void UnloadShadowCache(LightCurveShadowCache *cache);
+bool FindShadowMap(LightCurveShadowCache *cache, Vector3 sun, Texture2D *shadow_map, Matrix *shadow_matrix, Vector3 *shadow_sun);
+void StoreShadowMap(LightCurveShadowCache *cache, RenderTexture2D depth_texture, int instance, Vector3 sun, Matrix mvp_light_bias);
+void LogShadowCacheStatistics(const LightCurveShadowCache *cache);
+int LCShadowBucket(const LightCurveShadowCache *cache, Vector3 sun, int dx, int dy, int dz);
+void LCUnlinkShadowEntry(LightCurveShadowCache *cache, int slot);
+void LCTouchShadowEntry(LightCurveShadowCache *cache, int slot);
+
+void InitShadowCache(LightCurveShadowCache *cache, int screen_pixels, int grid_width, float budget_mb, float tolerance_degrees)
+{
+  memset(cache, 0, sizeof(LightCurveShadowCache));
+  cache->screen_pixels = screen_pixels;
+  cache->grid_width = grid_width;
+  cache->exact = tolerance_degrees <= 0.0f;
+  cache->min_cosine = cosf(tolerance_degrees * DEG2RAD);
+  cache->cell_size = fmaxf(sqrtf(fmaxf(2.0f - 2.0f * cache->min_cosine, 0.0f)), LC_SHADOW_MIN_CELL);
+  cache->slot_pixels = (screen_pixels + grid_width - 1) / grid_width + 1;
+  if(budget_mb <= 0.0f) return;
+
+  double budget_pixels = budget_mb * 1024.0 * 1024.0 / LC_SHADOW_BYTES_PER_PIXEL;
+  int side = (int) fmin(sqrt(budget_pixels), (double) LC_SHADOW_ATLAS_MAX_PIXELS);
+  cache->slots_per_side = side / cache->slot_pixels;
+  if(cache->slots_per_side == 0) {
+    TraceLog(LOG_WARNING, "SHADOW: %.1f MB cannot hold a %d px shadow map, caching is off", budget_mb, cache->slot_pixels);
+    return;
+  }
+
+  cache->slot_count = cache->slots_per_side * cache->slots_per_side;
+  int bucket_count = 1;
+  while(bucket_count < 2 * cache->slot_count) bucket_count *= 2;
+  cache->bucket_mask = bucket_count - 1;
+  cache->entries = (LCShadowEntry *) calloc(cache->slot_count, sizeof(LCShadowEntry));
+  cache->buckets = (int *) malloc(bucket_count * sizeof(int));
+  cache->atlas = LoadRenderTexture(cache->slots_per_side * cache->slot_pixels, cache->slots_per_side * cache->slot_pixels);
+  if(cache->entries == NULL || cache->buckets == NULL || cache->atlas.id == 0) {
+    TraceLog(LOG_WARNING, "SHADOW: Could not allocate the shadow map atlas, caching is off");
+    UnloadShadowCache(cache);
+    return;
+  }
+
+  memset(cache->buckets, 0xff, bucket_count * sizeof(int)); //-1: empty bucket
+  for(int i = 0; i < cache->slot_count; i++) {              //Empty slots are the oldest, in order
+    cache->entries[i].older = i - 1;
+    cache->entries[i].newer = (i + 1 < cache->slot_count) ? i + 1 : -1;
+  }
+  cache->oldest = 0;
+  cache->newest = cache->slot_count - 1;
+
+  TraceLog(LOG_INFO, "SHADOW: %d cached shadow maps of %d px (%.1f MB), %s", cache->slot_count, cache->slot_pixels,
+           (double) cache->atlas.texture.width * cache->atlas.texture.height * LC_SHADOW_BYTES_PER_PIXEL / (1024.0 * 1024.0),
+           cache->exact ? "exact sun vectors" : TextFormat("sun directions within %.3g deg", tolerance_degrees));
+}
+
+void UnloadShadowCache(LightCurveShadowCache *cache)
+{
+  if(cache->atlas.id > 0) UnloadRenderTexture(cache->atlas);
+  free(cache->entries);
+  free(cache->buckets);
+  cache->entries = NULL;
+  cache->buckets = NULL;
+  cache->slot_count = 0;
+}
+
+// On a hit, fills in what the lighting pass samples instead of the depth texture: the atlas, the slot's texture
+// coordinate mapping and the sun vector the slot was rendered for (the shadow depth test has to use that one)
+bool FindShadowMap(LightCurveShadowCache *cache, Vector3 sun, Texture2D *shadow_map, Matrix *shadow_matrix, Vector3 *shadow_sun)
+{
+  if(cache->slot_count == 0) return false;
+
+  int best = -1;
+  float best_cosine = cache->min_cosine;
+  Vector3 direction = Vector3Normalize(sun);
+
+  if(cache->exact) {
+    for(int i = cache->buckets[LCShadowBucket(cache, sun, 0, 0, 0)]; i != -1 && best < 0; i = cache->entries[i].next) {
+      if(cache->entries[i].sun.x == sun.x && cache->entries[i].sun.y == sun.y && cache->entries[i].sun.z == sun.z) best = i;
+    }
+  }
+  else {
+    for(int cell = 0; cell < 27; cell++) {
+      int bucket = LCShadowBucket(cache, direction, cell % 3 - 1, (cell / 3) % 3 - 1, cell / 9 - 1);
+      for(int i = cache->buckets[bucket]; i != -1; i = cache->entries[i].next) {
+        float cosine = Vector3DotProduct(direction, Vector3Normalize(cache->entries[i].sun));
+        if(cosine >= best_cosine) {
+          best = i;
+          best_cosine = cosine;
+        }
+      }
+    }
+  }
+
+  if(best < 0) {
+    cache->misses++;
+    return false;
+  }
+
+  cache->hits++;
+  LCTouchShadowEntry(cache, best);
+  *shadow_map = cache->atlas.texture;
+  *shadow_matrix = cache->entries[best].shadow_matrix;
+  *shadow_sun = cache->entries[best].sun;
+  return true;
+}
+
+// Copies the instance's tile of a freshly rendered depth texture into the least recently used slot
+void StoreShadowMap(LightCurveShadowCache *cache, RenderTexture2D depth_texture, int instance, Vector3 sun, Matrix mvp_light_bias)
+{
+  if(cache->slot_count == 0) return;
+
+  int slot = cache->oldest;
+  if(cache->entries[slot].used) {
+    LCUnlinkShadowEntry(cache, slot);
+    cache->evictions++;
+  }
+
+  //Tile of the instance (see GenerateTranslations: column-major from the bottom left), in whole texture pixels
+  float tile = (float) cache->screen_pixels / cache->grid_width;
+  int source_x = (int) floorf((instance / cache->grid_width) * tile);
+  int source_y = (int) floorf((instance % cache->grid_width) * tile);
+  if(source_x + cache->slot_pixels > depth_texture.texture.width) source_x = depth_texture.texture.width - cache->slot_pixels;
+  if(source_y + cache->slot_pixels > depth_texture.texture.height) source_y = depth_texture.texture.height - cache->slot_pixels;
+
+  int atlas_pixels = cache->atlas.texture.width;
+  int slot_x = (slot % cache->slots_per_side) * cache->slot_pixels;
+  int slot_y = (slot / cache->slots_per_side) * cache->slot_pixels;
+
+  BeginTextureMode(cache->atlas);          //Negative source height keeps the rows in GL order
+    DrawTextureRec(depth_texture.texture, (Rectangle) { (float) source_x, (float) source_y, (float) cache->slot_pixels, (float) -cache->slot_pixels },
+                   (Vector2) { (float) slot_x, (float) (atlas_pixels - slot_y - cache->slot_pixels) }, WHITE);
+  EndTextureMode();
+
+  float scale = (float) depth_texture.texture.width / atlas_pixels;
+  Matrix to_slot = MatrixMultiply(MatrixScale(scale, scale, 1.0f), MatrixTranslate((float) (slot_x - source_x) / atlas_pixels, (float) (slot_y - source_y) / atlas_pixels, 0.0f));
+
+  LCShadowEntry *entry = &cache->entries[slot];
+  entry->sun = sun;
+  entry->shadow_matrix = MatrixMultiply(mvp_light_bias, to_slot);
+  entry->used = true;
+  entry->bucket = LCShadowBucket(cache, cache->exact ? sun : Vector3Normalize(sun), 0, 0, 0);
+  entry->next = cache->buckets[entry->bucket];
+  cache->buckets[entry->bucket] = slot;
+  LCTouchShadowEntry(cache, slot);
+}
+
+void LogShadowCacheStatistics(const LightCurveShadowCache *cache)
+{
+  if(cache->slot_count == 0) return;
+  long lookups = cache->hits + cache->misses;
+  TraceLog(LOG_INFO, "SHADOW: %ld of %ld depth passes served from the cache (%.1f%%), %ld evictions", cache->hits, lookups,
+           (lookups > 0) ? 100.0 * cache->hits / lookups : 0.0, cache->evictions);
+}
+
+// Exact mode: the sun vector's bits, signed zeros folded. Otherwise the direction grid cell, offset by (dx, dy, dz).
+int LCShadowBucket(const LightCurveShadowCache *cache, Vector3 sun, int dx, int dy, int dz)
+{
+  int key[3];
+  if(cache->exact) {
+    float folded[3] = { sun.x + 0.0f, sun.y + 0.0f, sun.z + 0.0f };
+    memcpy(key, folded, sizeof(key));
+  }
+  else {
+    key[0] = (int) floorf(sun.x / cache->cell_size) + dx;
+    key[1] = (int) floorf(sun.y / cache->cell_size) + dy;
+    key[2] = (int) floorf(sun.z / cache->cell_size) + dz;
+  }
+  uint64_t hash = HashFileContents((const unsigned char *) key, sizeof(key));
+  return (int) (hash ^ (hash >> 32)) & cache->bucket_mask;
+}
+
+void LCUnlinkShadowEntry(LightCurveShadowCache *cache, int slot) //Takes a slot out of its bucket
+{
+  int *link = &cache->buckets[cache->entries[slot].bucket];
+  while(*link != slot) link = &cache->entries[*link].next;
+  *link = cache->entries[slot].next;
+  cache->entries[slot].used = false;
+}
+
+void LCTouchShadowEntry(LightCurveShadowCache *cache, int slot) //Moves a slot to the most recently used end
+{
+  LCShadowEntry *entry = &cache->entries[slot];
+  if(cache->newest == slot) return;
+  if(entry->older != -1) cache->entries[entry->older].newer = entry->newer;
+  else cache->oldest = entry->newer;
+  cache->entries[entry->newer].older = entry->older;
+
+  entry->older = cache->newest;
+  entry->newer = -1;
+  cache->entries[cache->newest].newer = slot;
+  cache->newest = slot;
+}
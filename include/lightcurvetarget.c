@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <raylib.h>
+#include <rlgl.h>
+
+//----------------------------------------------------------------------------------
+// Render targets ("Render Target", "MSAA Samples")
+//
+// The lighting, brightness, extraction and minify passes render into textures of the command's format. RGBA8
+// quantizes every stage, most visibly the minify pass's row averages, to 1/255; RGBA32F carries them unrounded to
+// the readback in CalculateLightCurveValues().
+//
+// With MSAA the lighting pass draws into a multisampled framebuffer that is resolved (averaged) into the rendered
+// texture before the brightness pass. Edge pixels then carry their covered fraction of the irradiance, which is
+// what the irradiance sum wants; the lit area channel still counts any covered pixel as lit. raylib's window MSAA
+// flag only affects the default framebuffer, so this is the only place samples reach the light curve.
+//----------------------------------------------------------------------------------
+#define LC_GL_FRAMEBUFFER          0x8D40
+#define LC_GL_READ_FRAMEBUFFER     0x8CA8
+#define LC_GL_DRAW_FRAMEBUFFER     0x8CA9
+#define LC_GL_RENDERBUFFER         0x8D41
+#define LC_GL_COLOR_ATTACHMENT0    0x8CE0
+#define LC_GL_DEPTH_ATTACHMENT     0x8D00
+#define LC_GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#define LC_GL_COLOR_BUFFER_BIT     0x4000
+#define LC_GL_NEAREST              0x2600
+#define LC_GL_MAX_SAMPLES          0x8D57
+#define LC_GL_RGBA8                0x8058
+#define LC_GL_RGBA32F              0x8814
+#define LC_GL_DEPTH_COMPONENT24    0x81A6
+
+typedef struct {
+  RenderTexture2D target;                 // id is the multisampled framebuffer, texture only carries the size for BeginTextureMode()
+  unsigned int color_buffer;              // Multisampled renderbuffers
+  unsigned int depth_buffer;
+  int samples;                            // 0: not loaded, render straight into the texture
+  void (LC_GLAPI *GenFramebuffers)(int n, unsigned int *ids);
+  void (LC_GLAPI *DeleteFramebuffers)(int n, const unsigned int *ids);
+  void (LC_GLAPI *BindFramebuffer)(unsigned int target, unsigned int id);
+  void (LC_GLAPI *GenRenderbuffers)(int n, unsigned int *ids);
+  void (LC_GLAPI *DeleteRenderbuffers)(int n, const unsigned int *ids);
+  void (LC_GLAPI *BindRenderbuffer)(unsigned int target, unsigned int id);
+  void (LC_GLAPI *RenderbufferStorageMultisample)(unsigned int target, int samples, unsigned int format, int width, int height);
+  void (LC_GLAPI *FramebufferRenderbuffer)(unsigned int target, unsigned int attachment, unsigned int renderbuffer_target, unsigned int renderbuffer);
+  unsigned int (LC_GLAPI *CheckFramebufferStatus)(unsigned int target);
+  void (LC_GLAPI *BlitFramebuffer)(int x0, int y0, int x1, int y1, int dx0, int dy0, int dx1, int dy1, unsigned int mask, unsigned int filter);
+  void (LC_GLAPI *GetIntegerv)(unsigned int name, int *value);
+} LightCurveMultisampleTarget;
+
+RenderTexture2D LoadLightCurveRenderTexture(int width, int height, int render_target);
+bool LoadMultisampleTarget(LightCurveMultisampleTarget *msaa, int width, int height, int samples, int render_target);
+void ResolveMultisampleTarget(const LightCurveMultisampleTarget *msaa, RenderTexture2D destination);
+void UnloadMultisampleTarget(LightCurveMultisampleTarget *msaa);
+
+RenderTexture2D LoadLightCurveRenderTexture(int width, int height, int render_target) //LoadRenderTexture() with the command's colour format
+{
+  if(render_target != LC_TARGET_RGBA32F) return LoadRenderTexture(width, height);
+
+  RenderTexture2D target = { 0 };
+  target.id = rlLoadFramebuffer(width, height);
+  if(target.id == 0) {
+    TraceLog(LOG_WARNING, "TARGET: Float framebuffer could not be created");
+    return target;
+  }
+
+  rlEnableFramebuffer(target.id);
+  target.texture.id = rlLoadTexture(NULL, width, height, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32, 1);
+  target.texture.width = width;
+  target.texture.height = height;
+  target.texture.format = PIXELFORMAT_UNCOMPRESSED_R32G32B32A32;
+  target.texture.mipmaps = 1;
+
+  target.depth.id = rlLoadTextureDepth(width, height, true);
+  target.depth.width = width;
+  target.depth.height = height;
+  target.depth.format = 19;               //DEPTH_COMPONENT_24BIT, as LoadRenderTexture()
+  target.depth.mipmaps = 1;
+
+  rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+  rlFramebufferAttach(target.id, target.depth.id, RL_ATTACHMENT_DEPTH, RL_ATTACHMENT_RENDERBUFFER, 0);
+  if(!rlFramebufferComplete(target.id)) TraceLog(LOG_WARNING, "TARGET: [ID %i] Float framebuffer is incomplete", target.id);
+  rlDisableFramebuffer();
+  return target;
+}
+
+// Needs the GL context. Returns false (and leaves msaa->samples 0) when multisampling is unavailable.
+bool LoadMultisampleTarget(LightCurveMultisampleTarget *msaa, int width, int height, int samples, int render_target)
+{
+  memset(msaa, 0, sizeof(LightCurveMultisampleTarget));
+  if(samples <= 1) return false;
+
+  msaa->GenFramebuffers = (void (LC_GLAPI *)(int, unsigned int *)) glfwGetProcAddress("glGenFramebuffers");
+  msaa->DeleteFramebuffers = (void (LC_GLAPI *)(int, const unsigned int *)) glfwGetProcAddress("glDeleteFramebuffers");
+  msaa->BindFramebuffer = (void (LC_GLAPI *)(unsigned int, unsigned int)) glfwGetProcAddress("glBindFramebuffer");
+  msaa->GenRenderbuffers = (void (LC_GLAPI *)(int, unsigned int *)) glfwGetProcAddress("glGenRenderbuffers");
+  msaa->DeleteRenderbuffers = (void (LC_GLAPI *)(int, const unsigned int *)) glfwGetProcAddress("glDeleteRenderbuffers");
+  msaa->BindRenderbuffer = (void (LC_GLAPI *)(unsigned int, unsigned int)) glfwGetProcAddress("glBindRenderbuffer");
+  msaa->RenderbufferStorageMultisample = (void (LC_GLAPI *)(unsigned int, int, unsigned int, int, int)) glfwGetProcAddress("glRenderbufferStorageMultisample");
+  msaa->FramebufferRenderbuffer = (void (LC_GLAPI *)(unsigned int, unsigned int, unsigned int, unsigned int)) glfwGetProcAddress("glFramebufferRenderbuffer");
+  msaa->CheckFramebufferStatus = (unsigned int (LC_GLAPI *)(unsigned int)) glfwGetProcAddress("glCheckFramebufferStatus");
+  msaa->BlitFramebuffer = (void (LC_GLAPI *)(int, int, int, int, int, int, int, int, unsigned int, unsigned int)) glfwGetProcAddress("glBlitFramebuffer");
+  msaa->GetIntegerv = (void (LC_GLAPI *)(unsigned int, int *)) glfwGetProcAddress("glGetIntegerv");
+  if(!msaa->GenFramebuffers || !msaa->DeleteFramebuffers || !msaa->BindFramebuffer || !msaa->GenRenderbuffers || !msaa->DeleteRenderbuffers ||
+     !msaa->BindRenderbuffer || !msaa->RenderbufferStorageMultisample || !msaa->FramebufferRenderbuffer || !msaa->CheckFramebufferStatus ||
+     !msaa->BlitFramebuffer || !msaa->GetIntegerv) {
+    TraceLog(LOG_WARNING, "TARGET: Multisampled framebuffers are not available, rendering single-sampled");
+    return false;
+  }
+
+  int max_samples = 0;
+  msaa->GetIntegerv(LC_GL_MAX_SAMPLES, &max_samples);
+  if(samples > max_samples) {
+    TraceLog(LOG_WARNING, "TARGET: %d MSAA samples requested, the driver allows %d", samples, max_samples);
+    samples = max_samples;
+    if(samples <= 1) return false;
+  }
+
+  unsigned int framebuffer = 0;
+  msaa->GenFramebuffers(1, &framebuffer);
+  msaa->GenRenderbuffers(1, &msaa->color_buffer);
+  msaa->GenRenderbuffers(1, &msaa->depth_buffer);
+
+  msaa->BindRenderbuffer(LC_GL_RENDERBUFFER, msaa->color_buffer);
+  msaa->RenderbufferStorageMultisample(LC_GL_RENDERBUFFER, samples, (render_target == LC_TARGET_RGBA32F) ? LC_GL_RGBA32F : LC_GL_RGBA8, width, height);
+  msaa->BindRenderbuffer(LC_GL_RENDERBUFFER, msaa->depth_buffer);
+  msaa->RenderbufferStorageMultisample(LC_GL_RENDERBUFFER, samples, LC_GL_DEPTH_COMPONENT24, width, height);
+  msaa->BindRenderbuffer(LC_GL_RENDERBUFFER, 0);
+
+  msaa->BindFramebuffer(LC_GL_FRAMEBUFFER, framebuffer);
+  msaa->FramebufferRenderbuffer(LC_GL_FRAMEBUFFER, LC_GL_COLOR_ATTACHMENT0, LC_GL_RENDERBUFFER, msaa->color_buffer);
+  msaa->FramebufferRenderbuffer(LC_GL_FRAMEBUFFER, LC_GL_DEPTH_ATTACHMENT, LC_GL_RENDERBUFFER, msaa->depth_buffer);
+  bool complete = msaa->CheckFramebufferStatus(LC_GL_FRAMEBUFFER) == LC_GL_FRAMEBUFFER_COMPLETE;
+  msaa->BindFramebuffer(LC_GL_FRAMEBUFFER, 0);
+
+  msaa->target.id = framebuffer;
+  msaa->target.texture.width = width;
+  msaa->target.texture.height = height;
+  if(!complete) {
+    TraceLog(LOG_WARNING, "TARGET: %dx MSAA framebuffer is incomplete, rendering single-sampled", samples);
+    msaa->samples = 1;                    //Lets UnloadMultisampleTarget() free what was created
+    UnloadMultisampleTarget(msaa);
+    return false;
+  }
+
+  msaa->samples = samples;
+  TraceLog(LOG_INFO, "TARGET: Lighting pass renders %dx multisampled", samples);
+  return true;
+}
+
+void ResolveMultisampleTarget(const LightCurveMultisampleTarget *msaa, RenderTexture2D destination) //Outside texture mode, after the lighting pass
+{
+  if(msaa->samples == 0) return;
+  int width = msaa->target.texture.width, height = msaa->target.texture.height;
+  msaa->BindFramebuffer(LC_GL_READ_FRAMEBUFFER, msaa->target.id);
+  msaa->BindFramebuffer(LC_GL_DRAW_FRAMEBUFFER, destination.id);
+  msaa->BlitFramebuffer(0, 0, width, height, 0, 0, width, height, LC_GL_COLOR_BUFFER_BIT, LC_GL_NEAREST);
+  msaa->BindFramebuffer(LC_GL_FRAMEBUFFER, 0);
+}
+
+void UnloadMultisampleTarget(LightCurveMultisampleTarget *msaa)
+{
+  if(msaa->samples == 0) return;
+  msaa->DeleteFramebuffers(1, &msaa->target.id);
+  msaa->DeleteRenderbuffers(1, &msaa->color_buffer);
+  msaa->DeleteRenderbuffers(1, &msaa->depth_buffer);
+  msaa->samples = 0;
+}
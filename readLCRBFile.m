@@ -0,0 +1,28 @@
+function [light_curve, lit_area] = readLCRBFile(results_file)
+    % Reads a binary .lcrb results file. The engine appends a record per data
+    % point as each frame finishes, so this also works on a file that is still
+    % being written and returns the points completed so far.
+    f = fopen(results_file, 'r', 'ieee-le');
+
+    magic = fread(f, 4, 'char*1=>char')';
+    assert(strcmp(magic, 'LCRB'), "%s is not an .lcrb file", results_file);
+    fread(f, 1, 'uint32');                          % version
+    header_size = fread(f, 1, 'uint32');
+    channel_count = fread(f, 1, 'uint32');
+    channel_mask = fread(f, 1, 'uint32');
+    sample_size = fread(f, 1, 'uint32');
+
+    fseek(f, header_size, 'bof');
+    if sample_size == 8
+        samples = fread(f, [channel_count, Inf], 'double')';
+    else
+        samples = fread(f, [channel_count, Inf], 'single=>double')';
+    end
+    fclose(f);
+
+    light_curve = samples(:, 1);
+    lit_area = [];
+    if bitand(channel_mask, 2)
+        lit_area = samples(:, 2);
+    end
+end
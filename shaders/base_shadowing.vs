@@ -22,7 +22,11 @@ out vec4 ShadowCoord;
 out vec3 lightPosition;
 
 // NOTE: Add here your custom variables
-uniform mat4 mvp_from_script;
+#ifndef MAX_MODELS
+#define MAX_MODELS   25                          // Injected as MAX_INSTANCES by LoadShaderVariant()
+#endif
+
+uniform vec4 viewer_mvps[4*MAX_MODELS];         // Column-major MVP per instance, the whole batch in one upload
 uniform int model_id;
 uniform vec3 lightPos;
 
@@ -34,6 +38,9 @@ uniform vec3 lightPos;
 
 uniform mat4 light_mvp;
 
+#define MAX_MATERIALS   32                       // Must match LC_MAX_MATERIALS
+uniform float material_reflectance[MAX_MATERIALS];
+
 void main()
 {
     // mat4 light_mvp_from_arr = light_mvps[model_id].mat;
@@ -44,9 +51,13 @@ void main()
 
     fragTexCoord = vertexTexCoord;
 
-    fragColor = vertexColor;
+    int material_id = int(vertexColor.r*255.0 + 0.5); // Merged meshes carry their material ID in the red channel
+    float reflectance = 1.0;                          // Untagged meshes get raylib's default white, ID 255
+    if (material_id < MAX_MATERIALS) reflectance = material_reflectance[material_id];
+    fragColor = vec4(vec3(reflectance), 1.0);
     fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
 
+    mat4 mvp_from_script = mat4(viewer_mvps[4*model_id], viewer_mvps[4*model_id + 1], viewer_mvps[4*model_id + 2], viewer_mvps[4*model_id + 3]);
     gl_Position = mvp_from_script*vec4(vertexPosition, 1.0);
     ShadowCoord = light_mvp*vec4(vertexPosition, 1.0);
     // lightPosition = vec3(matModel*vec4(lightPos, 1.0));
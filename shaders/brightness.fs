@@ -25,5 +25,15 @@ void main()
       areaUnit = 1.0; //Indicates that area is present here
     }
 
-    finalColor = vec4(texelColor.r, areaUnit, texelColor.b, 1.0); //Indicates that irradiance is present here
+    // Lit pixels next to an unlit one trace the lit region's edge (limb, terminator, shadow), where coverage is only
+    // known to half a pixel. Their count drives the per-point error estimate for progressive refinement.
+    vec2 texel = 1.0 / vec2(textureSize(texture0, 0));
+    float boundaryUnit = 0.0;
+
+    if(areaUnit > 0.0 && (texture(texture0, fragTexCoord + vec2(texel.x, 0.0)).r == 0.0 || texture(texture0, fragTexCoord - vec2(texel.x, 0.0)).r == 0.0 ||
+                          texture(texture0, fragTexCoord + vec2(0.0, texel.y)).r == 0.0 || texture(texture0, fragTexCoord - vec2(0.0, texel.y)).r == 0.0)) {
+      boundaryUnit = 1.0;
+    }
+
+    finalColor = vec4(texelColor.r, areaUnit, boundaryUnit, 1.0); //Indicates that irradiance is present here
 }
\ No newline at end of file
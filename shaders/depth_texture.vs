@@ -44,20 +44,15 @@ uniform mat4 light_mvp;
 uniform int model_id;
 uniform vec3 lightPos;
 
-#define MAX_MODELS   25
+#ifndef MAX_MODELS
+#define MAX_MODELS   25                          // Injected as MAX_INSTANCES by LoadShaderVariant()
+#endif
 
-struct MatArr {
-    mat4 mat;
-};
-
-uniform MatArr light_mvps[MAX_MODELS];
+uniform vec4 light_mvps[4*MAX_MODELS];          // Column-major MVP per instance, the whole batch in one upload
 
 void main()
 {
-    for(int i = 0; i < 4; i++) {
-        mat4 test = light_mvps[i].mat;
-    }
-    mat4 light_mvp_from_arr = light_mvps[model_id].mat;
+    mat4 light_mvp_from_arr = mat4(light_mvps[4*model_id], light_mvps[4*model_id + 1], light_mvps[4*model_id + 2], light_mvps[4*model_id + 3]);
     // Send vertex attributes to fragment shader
     // fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
     fragPosition = vertexPosition;
@@ -21,6 +21,23 @@ out vec4 finalColor;
 #define     LIGHT_DIRECTIONAL       0
 #define     LIGHT_POINT             1
 
+// Variant switches, injected by LoadShaderVariant() (lightcurveshader.c). The defaults give the generic shader.
+#ifndef LC_LIGHT_COUNT
+#define     LC_LIGHT_COUNT          MAX_LIGHTS  // Lights evaluated
+#endif
+#ifndef LC_LIGHT_TYPE
+#define     LC_LIGHT_TYPE           -1          // LIGHT_DIRECTIONAL or LIGHT_POINT for every light, -1: per light at run time
+#endif
+#ifndef LC_SHADOWS
+#define     LC_SHADOWS              1           // Depth texture test
+#endif
+#ifndef LC_BRDF
+#define     LC_BRDF                 0           // 0: Lambertian, 1: Lambertian plus a Phong lobe (shine 16)
+#endif
+#ifndef LC_OUTPUT_LEVELS
+#define     LC_OUTPUT_LEVELS        0           // Round irradiance to this many levels, 0: leave it to the render target
+#endif
+
 struct MaterialProperty {
     vec3 color;
     int useSampler;
@@ -36,7 +53,7 @@ struct Light {
 };
 
 // Input lighting values
-uniform Light lights[MAX_LIGHTS];
+uniform Light lights[LC_LIGHT_COUNT];
 uniform vec3 viewPos;
 uniform sampler2D depthTex;
 uniform int grid_width;
@@ -53,10 +70,17 @@ void main()
 
     // NOTE: Implement here your fragment shader code
 
-    for (int i = 0; i < MAX_LIGHTS; i++)
+    for (int i = 0; i < LC_LIGHT_COUNT; i++)
     {
-        if (lights[i].enabled == 1)
+#if LC_LIGHT_COUNT > 1
+        if (lights[i].enabled == 1)             // A single light is the sun, always enabled
+#endif
         {
+#if LC_LIGHT_TYPE == LIGHT_DIRECTIONAL
+            vec3 light = -normalize(lights[i].target - lights[i].position);
+#elif LC_LIGHT_TYPE == LIGHT_POINT
+            vec3 light = normalize(lights[i].position - fragPosition);
+#else
             vec3 light = vec3(0.0);
 
             if (lights[i].type == LIGHT_DIRECTIONAL)
@@ -68,23 +92,30 @@ void main()
             {
                 light = normalize(lights[i].position - fragPosition);
             }
+#endif
 
             float NdotL = max(dot(normal, light), 0.0);
             lightDot += lights[i].color.rgb*NdotL;
 
+#if LC_BRDF == 1
             float specCo = 0.0;
             if (NdotL > 0.0) specCo = pow(max(0.0, dot(viewD, reflect(-(light), normal))), 16.0); // 16 refers to shine
             specular += specCo;
+#endif
         }
     }
 
-    vec4 irradiance = fragColor*(vec4(lightDot, 1.0));
+    vec4 irradiance = fragColor*(vec4(lightDot + specular, 1.0));
 
-    float irradUnit = irradiance.r * 255; //Finds the integer RGB (out of 255)
-    float irradDecimal = 0.5 + (irradUnit - round(irradUnit)); //Finds what would be dropped otherwise
+#if LC_OUTPUT_LEVELS > 0
+    float irradUnit = round(irradiance.r * float(LC_OUTPUT_LEVELS)) / float(LC_OUTPUT_LEVELS);
+#else
+    float irradUnit = irradiance.r;
+#endif
 
-    finalColor = vec4(irradUnit / 255.0, irradUnit / 255.0, irradUnit / 255.0, 1.0);
+    finalColor = vec4(irradUnit, irradUnit, irradUnit, 1.0);
 
+#if LC_SHADOWS
     //SHADOWING
     vec3 normalOffset = normalize(fragNormal) * 0.06; //was 0.04
 
@@ -107,13 +138,14 @@ void main()
     float cosTheta = dot(normalize(lightPosition), normalize(fragNormal));
 
     // float bias = 0.001 * tan(acos(cosTheta));
-    float bias = 0.002 * tan(acos(cosTheta));
+    float bias = 0.002 * sqrt(max(1.0 - cosTheta*cosTheta, 0.0)) / cosTheta; // tan(acos(c)) = sqrt(1 - c^2) / c
     bias = clamp(bias, 0.001, 0.04);
 
     if((textureDepth < d - bias / grid_width) && (finalColor.r > 0)) {
         // finalColor = vec4(0.651, 0.1176, 0.1176, 1.0);
         finalColor = vec4(0.0, 0.0, 0.0, 1.0);
     }
+#endif
 
     // if(finalColor.r == 0) {
     //     finalColor = vec4(0.0, 0.5, 0.7, 1.0);
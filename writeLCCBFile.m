@@ -0,0 +1,77 @@
+function writeLCCBFile(command_file, results_file, model_file, instances, dimensions, ...
+    data_points, sun_vectors, viewer_vectors, frame_rate, epochs, results_precision, results_channels, lod_tolerance, refine_tolerance, ...
+    shadow_cache_mb, shadow_cache_tolerance, dedup, attitudes, render_target, msaa_samples)
+    % Binary counterpart of writeLCRFile: a 512 byte header followed by
+    % float64 sun and viewer arrays (data_points x 3) and optional epochs.
+    % The engine memory-maps this file instead of parsing it.
+    % results_precision (32 or 64) and results_channels (e.g. ["Irradiance" "LitArea"])
+    % only matter when results_file ends in .lcrb (see readLCRBFile).
+    % lod_tolerance > 0 lets the engine render a simplified mesh whose predicted
+    % relative light curve error stays below it (default 0: full mesh).
+    % refine_tolerance > 0 re-renders points whose estimated relative error
+    % exceeds it at progressively larger tiles (default 0: one pass).
+    % shadow_cache_mb (default 0: off) bounds the cache of shadow maps
+    % reused by points under the same sun; shadow_cache_tolerance (degrees,
+    % default 0: identical vectors) lets nearby sun directions share one.
+    % dedup (default "Off", "Exact" or "Reciprocal") renders repeated geometries
+    % once; "Reciprocal" also merges pairs with sun and viewer swapped.
+    % attitudes (data_points x 4, [w x y z]) makes sun_vectors and viewer_vectors
+    % inertial; the engine rotates them into the body frame, v_body = q v q*,
+    % so they need not be pre-rotated here.
+    % render_target ("RGBA8" default or "RGBA32F") is the colour format of the
+    % lighting through minify passes; msaa_samples (default 0) multisamples the
+    % lighting pass. benchmark_accuracy.py trades both off against cost.
+    f = fopen(command_file, 'w', 'ieee-le');
+
+    has_epochs = nargin > 9 && ~isempty(epochs);
+    if nargin < 11, results_precision = 32; end
+    if nargin < 12, results_channels = "Irradiance"; end
+    if nargin < 13, lod_tolerance = 0; end
+    if nargin < 14, refine_tolerance = 0; end
+    if nargin < 15, shadow_cache_mb = 0; end
+    if nargin < 16, shadow_cache_tolerance = 0; end
+    if nargin < 17, dedup = "Off"; end
+    inertial = nargin > 17 && ~isempty(attitudes);
+    if nargin < 19, render_target = "RGBA8"; end
+    if nargin < 20, msaa_samples = 0; end
+    channel_mask = 1 + 2 * any(results_channels == "LitArea");
+
+    fwrite(f, 'LCCB', 'char*1');
+    fwrite(f, 1, 'uint32');                 % version
+    fwrite(f, 512, 'uint32');               % header size
+    fwrite(f, has_epochs, 'uint32');        % flags (bit 0: epochs present)
+    fwrite(f, instances, 'int32');
+    fwrite(f, dimensions, 'int32');
+    fwrite(f, frame_rate, 'int32');
+    fwrite(f, inertial, 'int32');           % reference frame (0: ObjectBody, 1: Inertial)
+    fwrite(f, data_points, 'uint64');
+    fwrite(f, paddedName(model_file), 'char*1');
+    fwrite(f, paddedName(results_file), 'char*1');
+    fwrite(f, results_precision, 'int32');
+    fwrite(f, channel_mask, 'uint32');
+    fwrite(f, lod_tolerance, 'single');
+    fwrite(f, refine_tolerance, 'single');
+    fwrite(f, shadow_cache_mb, 'single');
+    fwrite(f, shadow_cache_tolerance, 'single');
+    fwrite(f, find(dedup == ["Off" "Exact" "Reciprocal"]) - 1, 'uint32');
+    fwrite(f, find(render_target == ["RGBA8" "RGBA32F"]) - 1, 'uint32');
+    fwrite(f, msaa_samples, 'uint32');
+    fwrite(f, zeros(1, 512 - ftell(f)), 'uint8');
+
+    fwrite(f, sun_vectors(1:data_points, :)', 'double');    % row-major: x, y, z per data point
+    fwrite(f, viewer_vectors(1:data_points, :)', 'double');
+    if has_epochs
+        fwrite(f, epochs(1:data_points), 'double');
+    end
+    if inertial
+        fwrite(f, attitudes(1:data_points, :)', 'double');  % w, x, y, z per data point
+    end
+
+    fclose(f);
+end
+
+function name = paddedName(name)
+    name = char(name);
+    assert(~isempty(name) && length(name) <= 99, "File names in .lccb headers must be 1 to 99 characters"); % MAX_FNAME_LENGTH - 1 in the engine
+    name = [name zeros(1, 128 - length(name))];
+end
@@ -0,0 +1,101 @@
+"""Writes binary light curve command files (.lccb) for LightCurveEngine.
+
+Python counterpart of writeLCCBFile.m. The layout is a 512 byte header followed by
+float64 sun and viewer arrays (data_points x 3), optional float64 epochs and optional
+attitude quaternions. Vectors may be any sequence of (x, y, z) rows, including N x 3
+numpy arrays.
+
+With attitudes (data_points rows of w, x, y, z) the sun and viewer vectors are
+inertial and the engine rotates them into the body frame, v_body = q v q*.
+"""
+import struct
+import sys
+from array import array
+
+LCCB_HEADER_SIZE = 512
+LCCB_FLAG_EPOCHS = 1
+NAME_LIMIT = 99                  # MAX_FNAME_LENGTH - 1 in the engine; the header fields hold 128 bytes
+LC_CHANNELS = {'Irradiance': 1, 'LitArea': 2}
+LC_DEDUP = {'Off': 0, 'Exact': 1, 'Reciprocal': 2}
+LC_RENDER_TARGETS = {'RGBA8': 0, 'RGBA32F': 1}
+LC_MAX_MSAA_SAMPLES = 16
+LC_FRAME_OBJECT_BODY = 0
+LC_FRAME_INERTIAL = 1
+
+
+def write_lccb(command_file, results_file, model_file, instances, dimensions,
+               sun_vectors, viewer_vectors, frame_rate, epochs=None,
+               results_precision=32, results_channels=('Irradiance',),
+               lod_tolerance=0.0, refine_tolerance=0.0, shadow_cache_mb=0.0,
+               shadow_cache_tolerance=0.0, dedup='Off', attitudes=None,
+               render_target='RGBA8', msaa_samples=0):
+    sun = _flatten(sun_vectors)
+    viewer = _flatten(viewer_vectors)
+    data_points = len(sun) // 3
+    if len(viewer) != len(sun):
+        raise ValueError("sun_vectors and viewer_vectors must have the same number of rows")
+
+    flags = 0
+    if epochs is not None:
+        epochs = array('d', (float(t) for t in epochs))
+        if len(epochs) != data_points:
+            raise ValueError("epochs must have one entry per data point")
+        flags |= LCCB_FLAG_EPOCHS
+
+    reference_frame = LC_FRAME_OBJECT_BODY
+    if attitudes is not None:
+        attitudes = _flatten(attitudes, 4)
+        if len(attitudes) != 4 * data_points:
+            raise ValueError("attitudes must have one (w, x, y, z) row per data point")
+        reference_frame = LC_FRAME_INERTIAL
+
+    if results_precision not in (32, 64):
+        raise ValueError("results_precision must be 32 or 64")
+    channel_mask = 0
+    for channel in results_channels:
+        channel_mask |= LC_CHANNELS[channel]
+
+    if lod_tolerance < 0:
+        raise ValueError("lod_tolerance must be non-negative (0 renders the full mesh)")
+    if refine_tolerance < 0:
+        raise ValueError("refine_tolerance must be non-negative (0 disables refinement)")
+    if shadow_cache_mb < 0 or shadow_cache_tolerance < 0:
+        raise ValueError("shadow_cache_mb and shadow_cache_tolerance (degrees) must be non-negative")
+    if dedup not in LC_DEDUP:
+        raise ValueError("dedup must be one of Off, Exact, Reciprocal")
+    if render_target not in LC_RENDER_TARGETS:
+        raise ValueError("render_target must be RGBA8 or RGBA32F")
+    if not 0 <= msaa_samples <= LC_MAX_MSAA_SAMPLES:
+        raise ValueError("msaa_samples must be between 0 and %d" % LC_MAX_MSAA_SAMPLES)
+
+    header = struct.pack('<4sIIIiiiiQ128s128siIffffIII', b'LCCB', 1, LCCB_HEADER_SIZE, flags,
+                         instances, dimensions, frame_rate, reference_frame, data_points,
+                         _name(model_file), _name(results_file),
+                         results_precision, channel_mask, lod_tolerance,
+                         refine_tolerance, shadow_cache_mb, shadow_cache_tolerance,
+                         LC_DEDUP[dedup], LC_RENDER_TARGETS[render_target], msaa_samples)
+
+    with open(command_file, 'wb') as f:
+        f.write(header.ljust(LCCB_HEADER_SIZE, b'\0'))
+        for block in (sun, viewer, epochs, attitudes):
+            if block is None:
+                continue
+            if sys.byteorder != 'little':
+                block.byteswap()
+            block.tofile(f)
+
+
+def _flatten(vectors, width=3):
+    flat = array('d')
+    for row in vectors:
+        if len(row) != width:
+            raise ValueError("Expected rows of %d values" % width)
+        flat.extend(float(v) for v in row)
+    return flat
+
+
+def _name(name):
+    encoded = name.encode()
+    if not 0 < len(encoded) <= NAME_LIMIT:
+        raise ValueError("File names in .lccb headers must be 1 to %d bytes" % NAME_LIMIT)
+    return encoded